@@ -159,21 +159,33 @@ typedef struct __attribute__((__packed__)){
 #else
 #define ACS_CMD(a)   do{red(#a); printf("\n"); a; }while(0)
 #endif
+static struct BTA_Data snap; // consistent copy of shared data, `sdt` points to it
+
+// completion predicate for SetRADec: input coordinates are equal to requested
+static int radec_set(const struct BTA_Data *d, void *arg){
+	double *rd = (double*)arg;
+	return (d->i_alpha == rd[0] && d->i_delta == rd[1]);
+}
+
 /**
  * send input RA/Decl (j2000!) coordinates to tel
  * both coords are in seconds (ra in time, dec in angular)
  */
 int setCoords(double ra, double dec){
-	double r, d;
-	calc_AP(ra, dec, &r, &d);
-	DBG("Set RA/Decl to %g, %g", r/3600, d/3600);
-	ACS_CMD(SetRADec(r, d));
-	int i;
-	for(i = 0; i < 10; ++i){
-		if(InpAlpha == r && InpDelta == d) break;
-		usleep(100000);
+	static double rd[2];
+	bta_snapshot(&snap); // apparent place is calculated for current JDate
+	calc_AP(ra, dec, &rd[0], &rd[1]);
+	DBG("Set RA/Decl to %g, %g", rd[0]/3600, rd[1]/3600);
+	int tk = bta_ticket_open(radec_set, rd, 1.);
+	if(tk < 0){
+		WARNX(_("Too many commands in progress"));
+		return 0;
 	}
-	if(InpAlpha != r || InpDelta != d){
+	ACS_CMD(SetRADec(rd[0], rd[1]));
+	bta_tickets_wait(1.); // checked on each data update during 1 second
+	int st = bta_ticket_state(tk);
+	bta_ticket_close(tk);
+	if(st != BTA_TK_DONE){
 		WARNX(_("Can't send data to system!"));
 		return 0;
 	}
@@ -230,6 +242,7 @@ void handle_socket(int sock){
 		double r, d;//, ca, cd;
 		//calc_AD(val_A, val_Z, S_time, &ca, &cd); // calculate current telescope polar coordinates
 		//calc_mean(ca, cd, &r, &d);
+		bta_snapshot(&snap);
 		calc_mean(val_Alp, val_Del, &r, &d);
 		dout.ra = htole32(HRS2RA(r));
 		dout.dec = (int32_t)htole32(DEG2DEC(d));
@@ -378,14 +391,18 @@ int main(_U_ int argc, char **argv){
 	signal(SIGTSTP, SIG_IGN); // ignore ctrl+Z
 	if(!get_shm_block(&sdat, ClientSide))
 		ERRX(_("Can't find shared memory block"));
+	bta_snapshot(&snap);
+	sdt = &snap;
 	if(!check_shm_block(&sdat))
 		ERRX(_("There's no connection to BTA!"));
 	double last = M_time;
 	int i;
+	uint32_t gen = bta_update_gen();
 	printf(_("Test connection\n"));
 	for(i = 0; i < 10 && fabs(M_time - last) < 0.02; ++i){
 		printf("."); fflush(stdout);
-		sleep(1);
+		bta_wait_update(&gen, 1.);
+		bta_snapshot(&snap);
 	}
 	printf("\n");
 	if(fabs(M_time - last) < 0.02)
@@ -0,0 +1,775 @@
+/* Columnar archive of BTA_Data fields
+ * Usage:
+ *    bta_archive rec dir [rate=Hz]
+ *          - sample "Sdat" segment (only updated data) and append fields to archive
+ *    bta_archive get dir from to [field ...]
+ *          - print fields (all by default) for given time range as table
+ *    bta_archive info dir [from to]
+ *          - show archive chunks, amount of samples and column sizes
+ * Time is UNIX time, "YYYY-MM-DD[ HH:MM:SS]" (UTC) or "now".
+ *
+ * Archive is divided into hourly chunks: directories dir/YYYYMMDDHH (UTC). Each
+ * chunk has one file per column and "index" file. Data is written by blocks of
+ * ARC_BLKLEN samples; every block of every column is coded independently, so
+ * reader finds blocks of time range in index and decodes only them and only
+ * requested columns:
+ *    time               - delta-of-delta of microseconds (zigzag varints)
+ *    double values      - XOR with previous value (bit stream: same/new window of meaningful bits)
+ *    codes and modes    - run-length: (value, count) varint pairs
+ * Index entry of block is written after its data, so after crash the chunk is
+ * truncated to the last complete block.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "bta_shdata.h"
+#include "bta_fields.h"
+
+#define ARC_MAGIC   (0x63724142)        /* "BArc" */
+#define ARC_VER     1
+#define ARC_BLKLEN  256                 /* samples in block */
+#define ARC_NAMELEN 24
+#define ARC_MAXBLK  (ARC_BLKLEN*10 + 16) /* max size of coded block */
+
+enum{
+     ARC_TIME = 0   // sample time
+    ,ARC_XOR        // double, XOR coding
+    ,ARC_RLE        // uint32_t/int32_t, run-length coding
+};
+
+/* mode enums which are not in bta_fields table */
+static const struct {
+    const char *name;
+    size_t offset;
+} arc_modes[] = {
+     {"SysMode",   offsetof(struct BTA_Data, system)}
+    ,{"SysTarget", offsetof(struct BTA_Data, sys_target)}
+    ,{"TelFocus",  offsetof(struct BTA_Data, tel_focus)}
+    ,{"TelState",  offsetof(struct BTA_Data, tel_state)}
+    ,{"TelMode",   offsetof(struct BTA_Data, tel_mode)}
+    ,{"P2State",   offsetof(struct BTA_Data, p2_state)}
+    ,{"FocState",  offsetof(struct BTA_Data, focus_state)}
+    ,{"DomeState", offsetof(struct BTA_Data, dome_state)}
+    ,{"MeteoMode", offsetof(struct BTA_Data, meteo_stat)}
+};
+#define ARC_NMODES  (sizeof(arc_modes)/sizeof(arc_modes[0]))
+#define ARC_NCOLS   (1 + BTA_FIELDS_AMOUNT + ARC_NMODES)
+
+/* column of archive */
+typedef struct{
+    const char *name;
+    int type;           // ARC_xx
+    size_t offset;      // offset in struct BTA_Data
+    const char *fmt;    // output format (for codes)
+} arc_column;
+
+/* index file: header, column descriptors, block entries */
+struct arc_ihdr {
+    uint32_t magic;
+    uint32_t version;   /* ARC_VER */
+    uint32_t ncols;
+    uint32_t blklen;    /* ARC_BLKLEN */
+    uint32_t hlen;      /* header + column descriptors length (first entry offset) */
+    uint32_t reserve[3];
+};
+struct arc_icol {
+    char name[ARC_NAMELEN];
+    uint32_t type;
+    uint32_t reserve;
+};
+struct arc_blk {
+    double t0, t1;      /* time of first and last samples */
+    uint32_t nrows;
+    uint32_t reserve;
+    uint32_t end[];     /* column file length after this block (block begins at previous end) */
+};
+#define ARC_ENTLEN(nc)  (sizeof(struct arc_blk) + (nc)*sizeof(uint32_t))
+
+static arc_column columns[ARC_NCOLS];
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int sig) {
+   (void)sig;
+   stop = 1;
+}
+
+static double real_time() {
+   struct timespec ts;
+   clock_gettime(CLOCK_REALTIME, &ts);
+   return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static void init_columns() {
+   size_t i, n = 0;
+   columns[n++] = (arc_column){"time", ARC_TIME, 0, NULL};
+   for(i = 0; i < BTA_FIELDS_AMOUNT; i++, n++) {
+      const BTA_Field *f = &bta_fields[i];
+      columns[n] = (arc_column){f->name, f->kind == BTA_F_CODE ? ARC_RLE : ARC_XOR, f->offset,
+                                f->kind == BTA_F_CODE ? f->fmt : NULL};
+   }
+   for(i = 0; i < ARC_NMODES; i++, n++)
+      columns[n] = (arc_column){arc_modes[i].name, ARC_RLE, arc_modes[i].offset, "%d"};
+}
+
+/*************************** coding of blocks ***************************/
+
+typedef struct{
+    uint8_t *p;
+    size_t pos;     // position in bits
+    size_t len;     // buffer length in bits (for reading)
+} bitbuf;
+
+static void put_bits(bitbuf *b, uint64_t v, int n) {
+   while(n > 0) {
+      int room = 8 - (b->pos & 7), k = (n < room) ? n : room;
+      b->p[b->pos >> 3] |= ((v >> (n - k)) & ((1U << k) - 1)) << (room - k);
+      b->pos += k;
+      n -= k;
+   }
+}
+
+static int get_bits(bitbuf *b, uint64_t *v, int n) {
+   uint64_t r = 0;
+   if(b->pos + n > b->len) return -1;
+   while(n > 0) {
+      int room = 8 - (b->pos & 7), k = (n < room) ? n : room;
+      r = (r << k) | ((b->p[b->pos >> 3] >> (room - k)) & ((1U << k) - 1));
+      b->pos += k;
+      n -= k;
+   }
+   *v = r;
+   return 0;
+}
+
+static size_t put_varint(uint8_t *p, uint64_t v) {
+   size_t n = 0;
+   while(v >= 0x80) {
+      p[n++] = (uint8_t)v | 0x80;
+      v >>= 7;
+   }
+   p[n++] = (uint8_t)v;
+   return n;
+}
+
+static int get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+   uint64_t r = 0;
+   int sh;
+   for(sh = 0; *p < end && sh < 64; sh += 7) {
+      uint8_t c = *(*p)++;
+      r |= (uint64_t)(c & 0x7f) << sh;
+      if(!(c & 0x80)) {
+         *v = r;
+         return 0;
+      }
+   }
+   return -1;
+}
+
+#define ZIGZAG(x)   (((uint64_t)(x) << 1) ^ (uint64_t)((int64_t)(x) >> 63))
+#define UNZIGZAG(x) ((int64_t)((x) >> 1) ^ -(int64_t)((x) & 1))
+
+static size_t time_encode(const double *t, int n, uint8_t *out) {
+   int64_t prev = 0, pdelta = 0, us;
+   size_t len = 0;
+   int i;
+   for(i = 0; i < n; i++) {
+      us = (int64_t)(t[i]*1e6 + 0.5);
+      len += put_varint(out + len, ZIGZAG(us - prev - pdelta));
+      if(i) pdelta = us - prev;
+      prev = us;
+   }
+   return len;
+}
+
+static int time_decode(const uint8_t *p, size_t len, double *t, int n) {
+   const uint8_t *end = p + len;
+   int64_t prev = 0, pdelta = 0, us;
+   uint64_t v;
+   int i;
+   for(i = 0; i < n; i++) {
+      if(get_varint(&p, end, &v)) return -1;
+      us = prev + pdelta + UNZIGZAG(v);
+      if(i) pdelta = us - prev;
+      prev = us;
+      t[i] = us / 1e6;
+   }
+   return 0;
+}
+
+static size_t xor_encode(const double *d, int n, uint8_t *out) {
+   bitbuf b = {out, 0, 0};
+   uint64_t prev, cur, x;
+   int i, lead = -1, trail = 0, l, t;
+   memset(out, 0, ARC_MAXBLK);
+   memcpy(&prev, &d[0], 8);
+   put_bits(&b, prev, 64);
+   for(i = 1; i < n; i++) {
+      memcpy(&cur, &d[i], 8);
+      x = cur ^ prev;
+      prev = cur;
+      if(!x) {
+         put_bits(&b, 0, 1);
+         continue;
+      }
+      put_bits(&b, 1, 1);
+      l = __builtin_clzll(x);
+      t = __builtin_ctzll(x);
+      if(l > 31) l = 31;
+      if(lead >= 0 && l >= lead && t >= trail) {  /* fits into previous window */
+         put_bits(&b, 0, 1);
+         put_bits(&b, x >> trail, 64 - lead - trail);
+      } else {
+         lead = l;
+         trail = t;
+         put_bits(&b, 1, 1);
+         put_bits(&b, l, 5);
+         put_bits(&b, 63 - l - t, 6);
+         put_bits(&b, x >> t, 64 - l - t);
+      }
+   }
+   return (b.pos + 7) / 8;
+}
+
+static int xor_decode(const uint8_t *p, size_t len, double *d, int n) {
+   bitbuf b = {(uint8_t *)p, 0, len*8};
+   uint64_t prev, v, l, s;
+   int i, lead = -1, trail = 0;
+   if(get_bits(&b, &prev, 64)) return -1;
+   memcpy(&d[0], &prev, 8);
+   for(i = 1; i < n; i++) {
+      if(get_bits(&b, &v, 1)) return -1;
+      if(v) {
+         if(get_bits(&b, &v, 1)) return -1;
+         if(v) {
+            if(get_bits(&b, &l, 5) || get_bits(&b, &s, 6)) return -1;
+            lead = l;
+            trail = 63 - l - s;
+         } else if(lead < 0)
+            return -1;
+         if(get_bits(&b, &v, 64 - lead - trail)) return -1;
+         prev ^= v << trail;
+      }
+      memcpy(&d[i], &prev, 8);
+   }
+   return 0;
+}
+
+static size_t rle_encode(const uint32_t *u, int n, uint8_t *out) {
+   size_t len = 0;
+   int i, j;
+   for(i = 0; i < n; i = j) {
+      for(j = i + 1; j < n && u[j] == u[i]; j++);
+      len += put_varint(out + len, u[i]);
+      len += put_varint(out + len, j - i);
+   }
+   return len;
+}
+
+static int rle_decode(const uint8_t *p, size_t len, uint32_t *u, int n) {
+   const uint8_t *end = p + len;
+   uint64_t v, cnt;
+   int i = 0;
+   while(i < n) {
+      if(get_varint(&p, end, &v) || get_varint(&p, end, &cnt) || cnt > (uint64_t)(n - i))
+         return -1;
+      while(cnt--) u[i++] = (uint32_t)v;
+   }
+   return 0;
+}
+
+/*************************** writer ***************************/
+
+static struct {
+    int hour;                   /* UNIX hour of current chunk (-1 if none) */
+    int idx;                    /* index file */
+    int fd[ARC_NCOLS];          /* column files */
+    uint32_t end[ARC_NCOLS];    /* column file lengths */
+    int nrows;                  /* samples in buffer */
+    double t[ARC_BLKLEN];
+    union {
+        double d;
+        uint32_t u;
+    } val[ARC_NCOLS][ARC_BLKLEN];
+} w = {.hour = -1};
+
+static void chunk_name(char *buf, size_t len, const char *dir, int hour) {
+   time_t t = (time_t)hour * 3600;
+   struct tm tm;
+   char s[16];
+   gmtime_r(&t, &tm);
+   strftime(s, sizeof(s), "%Y%m%d%H", &tm);
+   snprintf(buf, len, "%s/%s", dir, s);
+}
+
+/* path of file `name` in chunk directory */
+static int chunk_file(char *buf, const char *cdir, const char *name) {
+   if(snprintf(buf, PATH_MAX, "%s/%s", cdir, name) >= PATH_MAX) {
+      fprintf(stderr, "%s/%s: too long path\n", cdir, name);
+      return -1;
+   }
+   return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+   const uint8_t *p = buf;
+   ssize_t r;
+   while(len) {
+      if((r = write(fd, p, len)) < 0) {
+         if(errno == EINTR) continue;
+         return -1;
+      }
+      p += r;
+      len -= r;
+   }
+   return 0;
+}
+
+/* check that index header describes our columns */
+static int check_ihdr(const uint8_t *p, size_t len) {
+   const struct arc_ihdr *h = (const struct arc_ihdr *)p;
+   const struct arc_icol *c = (const struct arc_icol *)(p + sizeof(*h));
+   size_t i;
+   if(len < sizeof(*h) || h->magic != ARC_MAGIC || h->version != ARC_VER ||
+      h->hlen != sizeof(*h) + h->ncols*sizeof(*c) || len < h->hlen)
+      return -1;
+   if(h->ncols != ARC_NCOLS || h->blklen != ARC_BLKLEN)
+      return 1;
+   for(i = 0; i < ARC_NCOLS; i++)
+      if(strcmp(c[i].name, columns[i].name) || c[i].type != (uint32_t)columns[i].type)
+         return 1;
+   return 0;
+}
+
+static void close_chunk() {
+   int i;
+   if(w.hour < 0) return;
+   for(i = 0; i < (int)ARC_NCOLS; i++)
+      close(w.fd[i]);
+   close(w.idx);
+   w.hour = -1;
+}
+
+/* open (create or continue) chunk for `hour` */
+static int open_chunk(const char *dir, int hour) {
+   char path[PATH_MAX], cdir[PATH_MAX];
+   uint8_t hbuf[sizeof(struct arc_ihdr) + ARC_NCOLS*sizeof(struct arc_icol)];
+   struct arc_ihdr *h = (struct arc_ihdr *)hbuf;
+   struct arc_icol *c = (struct arc_icol *)(hbuf + sizeof(*h));
+   struct stat st;
+   off_t nent = 0;
+   size_t i, elen = ARC_ENTLEN(ARC_NCOLS);
+   chunk_name(cdir, sizeof(cdir), dir, hour);
+   if(mkdir(cdir, 0755) < 0 && errno != EEXIST) {
+      perror(cdir);
+      return -1;
+   }
+   if(chunk_file(path, cdir, "index"))
+      return -1;
+   if((w.idx = open(path, O_RDWR|O_CREAT, 0644)) < 0 || fstat(w.idx, &st) < 0) {
+      perror(path);
+      return -1;
+   }
+   memset(w.end, 0, sizeof(w.end));
+   if(st.st_size == 0) {
+      memset(hbuf, 0, sizeof(hbuf));
+      h->magic = ARC_MAGIC;
+      h->version = ARC_VER;
+      h->ncols = ARC_NCOLS;
+      h->blklen = ARC_BLKLEN;
+      h->hlen = sizeof(hbuf);
+      for(i = 0; i < ARC_NCOLS; i++) {
+         strncpy(c[i].name, columns[i].name, ARC_NAMELEN-1);
+         c[i].type = columns[i].type;
+      }
+      if(write_all(w.idx, hbuf, sizeof(hbuf))) {
+         perror(path);
+         return -1;
+      }
+   } else {
+      uint8_t ent[ARC_ENTLEN(ARC_NCOLS)];
+      if(pread(w.idx, hbuf, sizeof(hbuf), 0) != (ssize_t)sizeof(hbuf) || check_ihdr(hbuf, sizeof(hbuf))) {
+         fprintf(stderr, "%s: not an archive index or other set of columns; move it away\n", path);
+         close(w.idx);
+         return -1;
+      }
+      nent = (st.st_size - sizeof(hbuf)) / elen;
+      if(nent > 0) {
+         if(pread(w.idx, ent, elen, sizeof(hbuf) + (nent-1)*elen) != (ssize_t)elen) {
+            perror(path);
+            return -1;
+         }
+         memcpy(w.end, ((struct arc_blk *)ent)->end, sizeof(w.end));
+      }
+      /* drop incomplete entry */
+      if(ftruncate(w.idx, sizeof(hbuf) + nent*elen) < 0) {
+         perror(path);
+         return -1;
+      }
+   }
+   lseek(w.idx, 0, SEEK_END);
+   for(i = 0; i < ARC_NCOLS; i++) {
+      if(chunk_file(path, cdir, columns[i].name))
+         return -1;
+      /* drop data of incomplete block */
+      if((w.fd[i] = open(path, O_RDWR|O_CREAT, 0644)) < 0 || ftruncate(w.fd[i], w.end[i]) < 0) {
+         perror(path);
+         return -1;
+      }
+      lseek(w.fd[i], 0, SEEK_END);
+   }
+   w.hour = hour;
+   return 0;
+}
+
+/* code buffered samples and append them to chunk */
+static int flush_block() {
+   static uint8_t buf[ARC_MAXBLK];
+   static double dv[ARC_BLKLEN];
+   static uint32_t uv[ARC_BLKLEN];
+   uint8_t ent[ARC_ENTLEN(ARC_NCOLS)];
+   struct arc_blk *e = (struct arc_blk *)ent;
+   size_t i, len;
+   int j, n = w.nrows;
+   if(!n || w.hour < 0) return 0;
+   w.nrows = 0;
+   for(i = 0; i < ARC_NCOLS; i++) {
+      switch(columns[i].type) {
+         case ARC_TIME:
+            len = time_encode(w.t, n, buf);
+         break;
+         case ARC_XOR:
+            for(j = 0; j < n; j++) dv[j] = w.val[i][j].d;
+            len = xor_encode(dv, n, buf);
+         break;
+         default:
+            for(j = 0; j < n; j++) uv[j] = w.val[i][j].u;
+            len = rle_encode(uv, n, buf);
+      }
+      if(write_all(w.fd[i], buf, len)) {
+         perror(columns[i].name);
+         return -1;
+      }
+      w.end[i] += len;
+   }
+   memset(ent, 0, sizeof(ent));
+   e->t0 = w.t[0];
+   e->t1 = w.t[n-1];
+   e->nrows = n;
+   memcpy(e->end, w.end, sizeof(w.end));
+   if(write_all(w.idx, ent, sizeof(ent))) {
+      perror("writing index");
+      return -1;
+   }
+   return 0;
+}
+
+static int add_sample(const char *dir, const struct BTA_Data *d, double t) {
+   int hour = (int)(t / 3600.);
+   size_t i;
+   if(hour != w.hour) {
+      if(flush_block()) return -1;
+      close_chunk();
+      if(open_chunk(dir, hour)) return -1;
+   }
+   w.t[w.nrows] = t;
+   for(i = 1; i < ARC_NCOLS; i++) {
+      const uint8_t *p = (const uint8_t *)d + columns[i].offset;
+      if(columns[i].type == ARC_XOR)
+         memcpy(&w.val[i][w.nrows].d, p, sizeof(double));
+      else
+         memcpy(&w.val[i][w.nrows].u, p, sizeof(uint32_t));
+   }
+   if(++w.nrows == ARC_BLKLEN)
+      return flush_block();
+   return 0;
+}
+
+static int record(const char *dir, double rate) {
+   static struct BTA_Data snap;
+   struct timespec tn;
+   unsigned long nsamp = 0;
+   uint32_t gen, lastgen;
+   long period = (long)(1e9 / rate);
+
+   if(mkdir(dir, 0755) < 0 && errno != EEXIST) {
+      perror(dir);
+      return 1;
+   }
+   if(!get_shm_block(&sdat, ClientSide))
+      return 1;
+   lastgen = bta_update_gen() - 1;
+   clock_gettime(CLOCK_MONOTONIC, &tn);
+   while(!stop) {
+      tn.tv_nsec += period;
+      while(tn.tv_nsec >= 1000000000L) {
+         tn.tv_sec++;
+         tn.tv_nsec -= 1000000000L;
+      }
+      while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tn, NULL) == EINTR && !stop);
+      if(stop) break;
+      gen = bta_update_gen();
+      if(gen == lastgen || bta_snapshot(&snap) || snap.magic != sdat.key.code)
+         continue;      /* no new data */
+      lastgen = gen;
+      if(add_sample(dir, &snap, real_time()))
+         break;
+      nsamp++;
+   }
+   flush_block();
+   close_chunk();
+   fprintf(stderr, "%lu samples archived\n", nsamp);
+   return 0;
+}
+
+/*************************** reader ***************************/
+
+typedef struct{
+    uint8_t *map;
+    size_t len;
+} mapped;
+
+static int map_file(const char *path, mapped *m) {
+   struct stat st;
+   int fd = open(path, O_RDONLY);
+   m->map = NULL;
+   m->len = 0;
+   if(fd < 0) return -1;
+   if(fstat(fd, &st) < 0 || st.st_size == 0) {
+      close(fd);
+      return -1;
+   }
+   m->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if(m->map == MAP_FAILED) {
+      m->map = NULL;
+      return -1;
+   }
+   m->len = st.st_size;
+   return 0;
+}
+
+static void unmap_file(mapped *m) {
+   if(m->map) munmap(m->map, m->len);
+   m->map = NULL;
+}
+
+static double parse_time(const char *s) {
+   struct tm tm;
+   char *e;
+   double t;
+   if(strcmp(s, "now") == 0)
+      return real_time();
+   memset(&tm, 0, sizeof(tm));
+   if((e = strptime(s, "%Y-%m-%d", &tm))) {
+      if(*e == ' ' || *e == 'T')
+         e = strptime(e+1, "%H:%M:%S", &tm);
+      if(e && *e == 0)
+         return (double)timegm(&tm);
+   }
+   t = strtod(s, &e);
+   if(*e) {
+      fprintf(stderr, "%s: wrong time\n", s);
+      exit(1);
+   }
+   return t;
+}
+
+/* column number in index or -1 */
+static int find_column(const uint8_t *idx, const char *name) {
+   const struct arc_ihdr *h = (const struct arc_ihdr *)idx;
+   const struct arc_icol *c = (const struct arc_icol *)(idx + sizeof(*h));
+   uint32_t i;
+   for(i = 0; i < h->ncols; i++)
+      if(strncmp(c[i].name, name, ARC_NAMELEN) == 0)
+         return i;
+   return -1;
+}
+
+/* decode block of column `c` described by index entry `e` (`prev` - previous entry or NULL) */
+static int decode_block(mapped *col, const struct arc_blk *e, const struct arc_blk *prev, int c,
+                        int type, double *dv, uint32_t *uv) {
+   uint32_t start = prev ? prev->end[c] : 0, end = e->end[c];
+   if(!col->map || end > col->len || start > end) return -1;
+   switch(type) {
+      case ARC_TIME:
+         return time_decode(col->map + start, end - start, dv, e->nrows);
+      case ARC_XOR:
+         return xor_decode(col->map + start, end - start, dv, e->nrows);
+      default:
+         return rle_decode(col->map + start, end - start, uv, e->nrows);
+   }
+}
+
+static int query(const char *dir, double from, double to, int nsel, char **sel, int info) {
+   static double tv[ARC_BLKLEN], dv[ARC_NCOLS][ARC_BLKLEN];
+   static uint32_t uv[ARC_NCOLS][ARC_BLKLEN];
+   const char *names[ARC_NCOLS], *fmts[ARC_NCOLS];
+   char cdir[PATH_MAX], path[PATH_MAX];
+   int hour, i, j, k, ncol = 0, hdr = 0;
+   unsigned long nout = 0;
+
+   if(nsel == 0) {      /* all columns */
+      for(i = 1; i < (int)ARC_NCOLS; i++)
+         names[ncol++] = columns[i].name;
+   } else {
+      for(i = 0; i < nsel && ncol < (int)ARC_NCOLS; i++)
+         names[ncol++] = sel[i];
+   }
+   for(i = 0; i < ncol; i++) {
+      fmts[i] = "%d";
+      for(k = 0; k < (int)ARC_NCOLS; k++)
+         if(strcmp(columns[k].name, names[i]) == 0 && columns[k].fmt)
+            fmts[i] = columns[k].fmt;
+   }
+   for(hour = (int)(from / 3600.); hour <= (int)(to / 3600.) && !stop; hour++) {
+      mapped idx, tcol, cols[ARC_NCOLS];
+      const struct arc_ihdr *h;
+      const struct arc_blk *e, *prev = NULL;
+      int cn[ARC_NCOLS], ctype[ARC_NCOLS], ok[ARC_NCOLS];
+      size_t elen, nent, n;
+      unsigned long rows = 0;
+
+      chunk_name(cdir, sizeof(cdir), dir, hour);
+      if(chunk_file(path, cdir, "index") || map_file(path, &idx))
+         continue;
+      if(check_ihdr(idx.map, idx.len) < 0) {
+         fprintf(stderr, "%s: broken index\n", path);
+         unmap_file(&idx);
+         continue;
+      }
+      h = (const struct arc_ihdr *)idx.map;
+      elen = ARC_ENTLEN(h->ncols);
+      nent = (idx.len - h->hlen) / elen;
+      if(info) {
+         const struct arc_icol *c = (const struct arc_icol *)(idx.map + sizeof(*h));
+         const struct arc_blk *last = nent ? (const struct arc_blk *)(idx.map + h->hlen + (nent-1)*elen) : NULL;
+         for(n = 0; n < nent; n++)
+            rows += ((const struct arc_blk *)(idx.map + h->hlen + n*elen))->nrows;
+         printf("%s: %zu blocks, %lu samples", cdir, nent, rows);
+         if(last) {
+            unsigned long total = 0;
+            for(i = 0; i < (int)h->ncols; i++) total += last->end[i];
+            printf(", %lu bytes (%.1f bytes/sample)\n", total, rows ? (double)total/rows : 0.);
+            for(i = 0; i < (int)h->ncols; i++)
+               printf("\t%-*s %10u bytes\n", ARC_NAMELEN, c[i].name, last->end[i]);
+         } else
+            printf("\n");
+         unmap_file(&idx);
+         continue;
+      }
+      if(chunk_file(path, cdir, "time") || map_file(path, &tcol))
+         tcol.map = NULL;
+      for(i = 0; i < ncol; i++) {
+         const struct arc_icol *c = (const struct arc_icol *)(idx.map + sizeof(*h));
+         cols[i].map = NULL;
+         if((cn[i] = find_column(idx.map, names[i])) < 0)
+            continue;
+         ctype[i] = c[cn[i]].type;
+         if(!chunk_file(path, cdir, names[i]))
+            map_file(path, &cols[i]);
+      }
+      if(!hdr) {
+         printf("# time");
+         for(i = 0; i < ncol; i++) printf("\t%s", names[i]);
+         printf("\n");
+         hdr = 1;
+      }
+      for(n = 0; n < nent && !stop; n++, prev = e) {
+         e = (const struct arc_blk *)(idx.map + h->hlen + n*elen);
+         if(e->t1 < from || e->t0 > to || e->nrows > ARC_BLKLEN)
+            continue;
+         if(decode_block(&tcol, e, prev, 0, ARC_TIME, tv, NULL)) {
+            fprintf(stderr, "%s: broken block %zu\n", cdir, n);
+            continue;
+         }
+         for(i = 0; i < ncol; i++)  /* absent or broken column is printed as "-" */
+            ok[i] = cn[i] >= 0 && !decode_block(&cols[i], e, prev, cn[i], ctype[i], dv[i], uv[i]);
+         for(j = 0; j < (int)e->nrows; j++) {
+            if(tv[j] < from || tv[j] > to) continue;
+            printf("%.3f", tv[j]);
+            for(i = 0; i < ncol; i++) {
+               if(!ok[i])
+                  printf("\t-");
+               else if(ctype[i] == ARC_XOR)
+                  printf("\t%.10g", dv[i][j]);
+               else {
+                  printf("\t");
+                  printf(fmts[i], uv[i][j]);
+               }
+            }
+            printf("\n");
+            nout++;
+         }
+      }
+      for(i = 0; i < ncol; i++)
+         unmap_file(&cols[i]);
+      unmap_file(&tcol);
+      unmap_file(&idx);
+   }
+   if(!info)
+      fprintf(stderr, "%lu samples\n", nout);
+   return 0;
+}
+
+static void usage(char *name) {
+   fprintf(stderr, "Usage:\n");
+   fprintf(stderr, "\t%s rec dir [rate=Hz]\n", name);
+   fprintf(stderr, "\t%s get dir from to [field ...]\n", name);
+   fprintf(stderr, "\t%s info dir [from to]\n", name);
+   fprintf(stderr, "\"rec\" - sample BTA data (default 1Hz, unchanged data is skipped) into archive directory;\n");
+   fprintf(stderr, "\"get\" - print fields (all by default) for time range as tab-separated table;\n");
+   fprintf(stderr, "\"info\" - show chunks of archive (for last 24 hours by default);\n");
+   fprintf(stderr, "time is UNIX time, \"YYYY-MM-DD[ HH:MM:SS]\" (UTC) or \"now\"\n");
+   exit(1);
+}
+
+int main(int argc, char *argv[]) {
+   struct sigaction sa;
+   double rate = 1.;
+   int i;
+
+   if(argc < 3)
+      usage(argv[0]);
+   init_columns();
+   memset(&sa, 0, sizeof(sa));
+   sa.sa_handler = on_signal;
+   sigaction(SIGINT, &sa, NULL);
+   sigaction(SIGTERM, &sa, NULL);
+   sigaction(SIGHUP, &sa, NULL);
+   signal(SIGPIPE, SIG_IGN);
+   if(strcmp(argv[1], "rec") == 0) {
+      for(i = 3; i < argc; i++) {
+         if(strncmp(argv[i], "rate=", 5) == 0)
+            rate = atof(argv[i]+5);
+         else
+            usage(argv[0]);
+      }
+      if(rate <= 0. || rate > 1000.)
+         usage(argv[0]);
+      return record(argv[2], rate);
+   }
+   if(strcmp(argv[1], "get") == 0) {
+      if(argc < 5)
+         usage(argv[0]);
+      return query(argv[2], parse_time(argv[3]), parse_time(argv[4]), argc - 5, argv + 5, 0);
+   }
+   if(strcmp(argv[1], "info") == 0) {
+      double now = real_time();
+      if(argc > 4)
+         return query(argv[2], parse_time(argv[3]), parse_time(argv[4]), 0, NULL, 1);
+      return query(argv[2], now - 86400., now, 0, NULL, 1);
+   }
+   usage(argv[0]);
+   return 1;
+}
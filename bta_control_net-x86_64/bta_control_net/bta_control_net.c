@@ -23,9 +23,15 @@
 #include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/times.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <pthread.h>
 
 /*#define SHM_OLD_SIZE*/
 #include "bta_shdata.h"
+#include "bta_log.h"
+#include "bta_netpkt.h"
 
 #ifndef TRUE
 #define TRUE (1)
@@ -49,53 +55,167 @@ const char *mcast_base = "239.0.0.0";
 static union{
     unsigned char ubuf[4100]; /* buffer area >= sdat.maxsize+2 ! */
     int ival;
+    uint32_t w[1025];
 } u_buff;
 //static unsigned char buff[4100];  /* buffer area >= sdat.maxsize+2 ! */
 
 #define buff u_buff.ubuf
 
+/* delta packets (formats are in bta_netpkt.h) */
+static int delta_n = 0;                 /* keyframe period (0 - send full blocks only) */
+static union{
+    unsigned char ubuf[4100+sizeof(struct delta_hdr)];
+    uint32_t w[1025+sizeof(struct delta_hdr)/4];
+} u_key, u_delta;                       /* last keyframe and delta packet buffers */
+static int key_size = 0;                /* size of keyframe stored (0 - no keyframe) */
+static uint32_t key_seq = 0;            /* keyframe sequence number */
+
+static int use_hdr = 0;                 /* add header to sent packets */
+/* per-sender statistics */
+#define MAX_PEERS 16
+#define LAT_BINS  11
+static const double lat_bin[LAT_BINS-1] = {1.,2.,5.,10.,20.,50.,100.,200.,500.,1000.}; /* ms */
+static struct peer_stat {
+    in_addr_t ip;
+    time_t last_time;               /* last packet receiving time */
+    uint32_t last_seq;              /* max sequence number got */
+    uint64_t win;                   /* bitmap of got packets: bit N - last_seq-N */
+    unsigned long npkt, nlost, nreord, ndup, nrestart;
+    unsigned long lat_hist[LAT_BINS];
+    double lat_min, lat_max, lat_sum; /* latency, ms */
+} peers[MAX_PEERS];
+static unsigned long nohdr_pkts = 0;    /* packets without header */
+
+/* Subscription request for "remote" mode: host gets data blocks with given
+ * period until the lease expires (clients renew it every SUBS_LEASE/3 seconds)
+ */
+#define SUBS_MAGIC (0x73415442)         /* "BTAs" */
+#define SUBS_LEASE 10                   /* default lease time, s */
+#define MAX_SUBS   32
+struct subs_req {
+    int32_t magic;
+    int32_t period_ms;  /* wanted period of data blocks */
+    int32_t lease;      /* lease time, s */
+};
+static struct subscriber {
+    struct sockaddr_in addr;        /* where to send data (port - dport) */
+    double period;                  /* s, not less than tsec */
+    double next;                    /* next sending time (CLOCK_MONOTONIC) */
+    double lease_end;               /* subscription end time */
+    uint32_t seq;                   /* own sequence numbers for header */
+} subs[MAX_SUBS];
+static int nsubs = 0;
+static double subs_period = 0.;         /* receiver: wanted period (0 - don't subscribe) */
+
+/* Command batches: the receiver's forwarding thread sends all commands found in
+ * local queues in one datagram:
+ *    int32_t BATCH_MAGIC, int32_t n
+ *    n items: int32_t code (queue access code), int32_t len, len bytes of
+ *             message (as for single command), padded to 4 bytes
+ *    2 bytes of additive checksum
+ * A single command is sent in the old format (code, message, checksum).
+ */
+#define BATCH_MAGIC  (0x62415442)       /* "BTAb" */
+#define BATCH_MAX    16                 /* max commands in one datagram */
+#define BATCH_SIZE   (8 + BATCH_MAX*(8+sizeof(struct my_msgbuf)) + 2)
+#define CMD_PERIOD   0.02               /* queues check period of forwarding thread, s */
+static int cmds_sent = 0;               /* commands were sent since last sync check */
+static volatile sig_atomic_t dump_stats = 0;
+
+/* main loop: epoll on sockets and timers */
+static int epfd = -1;                   /* epoll descriptor */
+static int tfd = -1;                    /* periodic timer (tsec) */
+static int ctfd = -1;                   /* command socket pause timer */
+static double tick0;                    /* first tick time (CLOCK_MONOTONIC) */
+static int show_stats = 0;              /* print achieved period statistics */
+static int got_data = 0;                /* data packet received since last tick */
+
+static char *host = NULL;
+static int ip, my_ip;
+static char msg[100];
+static struct in_addr mcast_addr;
+static unsigned long maskC;
+static struct ip_mreq mr;
+static int hist_len = 0;                /* history ring length (0 - don't write history) */
+static int use_sync=0,syncnt=0;      /* send sync requests */
+static double mcast_t=0.,mcast_tout=10.;
+
 static char *myname;
-static double prog_time();
-static void my_sleep(double);
-static void log_message(char *);
+static void get_localtime(time_t, struct tm *);
 static void myabort(int);
+static int put_cs(unsigned char *, int);
+static void delta_keyframe(unsigned char *, int, uint32_t);
+static int delta_encode(int);
+static int delta_decode(int *, uint32_t *);
+static int send_pkt(int, unsigned char *, int, struct sockaddr_in *);
+static int strip_hdr(int);
+static void print_stats();
+static int loop_init();
+static void cmd_pause(int);
+static void on_tick();
+static void recv_data();
+static void recv_cmd();
+static void send_sync(int);
+static void *cmd_thread(void *);
+static void send_data(struct sockaddr_in *, int);
+static void subscribe(struct subs_req *);
+static void send_subs();
+static void subs_request();
+static void make_hdr(struct net_hdr *, uint32_t);
 
 int main(int argc, char *argv[])
 {
    int i, length;
-   char *host = NULL;
-   char  myhost[128],msg[100];
+   char  myhost[128];
    static struct sched_param shp;
    struct hostent *h;
-   int ip, my_ip;
-   struct in_addr acs_addr,my_addr,bcast_addr,mcast_addr;
+   struct in_addr acs_addr,my_addr,bcast_addr;
    unsigned char ttl = 1;
-   unsigned long maskC,maskSAO;
-   struct ip_mreq mr;
-   int sync=0,syncnt=0;
-   double timeout, mcast_t=0.,mcast_tout=10.;
+   unsigned long maskSAO;
 
    myname = argv[0];
    if (argc>1) {
       host = strdup(argv[1]);
       for(i=2; i<argc; i++) {
-     if (*argv[i]=='s'){
-        sync=1;
+     if (strcmp(argv[i],"--stats")==0) {
+        show_stats=1;
+     }else if (*argv[i]=='s'){
+        use_sync=1;
         char *p = strchr(argv[i],'=');
         if(p) tsync=atof(p+1);
         if(tsync<0.4) tsync=0.4;
      }else if (*argv[i]=='t') {
         char *p = strchr(argv[i],'=');
         if(p!=NULL) tsec=atof(p+1);
-        if(tsec<0.14) tsec=0.14;
+     }else if (*argv[i]=='d') {
+        char *p = strchr(argv[i],'=');
+        delta_n = (p!=NULL)? atoi(p+1) : 20;
+        if(delta_n<2) delta_n=2;
+     }else if (*argv[i]=='r') {
+        char *p = strchr(argv[i],'=');
+        double rate = (p!=NULL)? atof(p+1) : 0.;
+        subs_period = (rate>0.)? 1./rate : 1.;
+     }else if (strncmp(argv[i],"hist",4)==0) {
+        char *p = strchr(argv[i],'=');
+        hist_len = (p!=NULL)? atoi(p+1) : BTA_HIST_LEN;
+        if(hist_len<2) hist_len = BTA_HIST_LEN;
+     }else if (*argv[i]=='h') {
+        use_hdr=1;
      }
       }
+      /* delta packets are small, so we can send them much more frequently */
+      if(tsec<(delta_n? 0.02 : 0.14)) tsec = delta_n? 0.02 : 0.14;
    } else {
       fprintf(stderr, "Usage:\n");
-      fprintf(stderr, "\t%s BTA_control_host[:mcast_addr] [sync[=sec]]\n",argv[0]);
-      fprintf(stderr, "\t%s local [t=sec]\n",argv[0]);
-      fprintf(stderr, "\t%s mcast[:mcast_addr][/ttl] [t=sec]\n",argv[0]);
-      fprintf(stderr, "\t%s remote\n",argv[0]);
+      fprintf(stderr, "\t%s BTA_control_host[:mcast_addr] [sync[=sec]] [rate=Hz] [hist[=N]] [hdr]\n",argv[0]);
+      fprintf(stderr, "\t%s local [t=sec] [delta[=N]] [hdr]\n",argv[0]);
+      fprintf(stderr, "\t%s mcast[:mcast_addr][/ttl] [t=sec] [delta[=N]] [hdr]\n",argv[0]);
+      fprintf(stderr, "\t%s remote [t=sec] [hdr]\n",argv[0]);
+      fprintf(stderr, "\"rate\" - subscribe to \"remote\" ACS host data with given rate;\n");
+      fprintf(stderr, "\"hist\" - keep last N (default %d) data blocks in shared history ring;\n", BTA_HIST_LEN);
+      fprintf(stderr, "\"hdr\" - send packets with sequence numbers and timestamps;\n");
+      fprintf(stderr, "SIGUSR1 - print statistics of packets with such headers\n");
+      fprintf(stderr, "\"--stats\" - print achieved send/check period statistics every 10s\n");
       exit(1);
    }
    signal(SIGHUP, myabort);
@@ -105,6 +225,7 @@ int main(int argc, char *argv[])
    signal(SIGPIPE,myabort);
    signal(SIGSEGV,myabort);
    signal(SIGTERM,myabort);
+   signal(SIGUSR1,myabort);
 
 
    maskC = htonl(IN_CLASSC_NET);
@@ -239,6 +360,10 @@ auto_mcast:
       if(ServPID>0 && kill(ServPID, 0) >= 0) {
      fprintf(stderr,"bta_control or bta_control_net server process  already running! (PID=%d)\n", ServPID);
      exit(1);
+      }
+      if(hist_len && !bta_hist_create(hist_len)) {
+     fprintf(stderr,"Can't create history ring, work without it\n");
+     hist_len = 0;
       }
       /* Listen and receive data packets form another host */
       if (bind(dsock, (struct sockaddr *)&data, sizeof(data)) < 0) {
@@ -269,6 +394,10 @@ auto_mcast:
       }
    }
 
+   /* messages from realtime loop are written by logger thread */
+   bta_log_init(NULL);
+   tzset();
+   bta_log_settime(get_localtime);
    shp.sched_priority = 1;
    if (sched_setscheduler(0, SCHED_FIFO, &shp)) {
       perror("Can't enter realtime mode! Not a SuperUser?");
@@ -280,346 +409,854 @@ auto_mcast:
      fprintf(stderr,"Entering realtime mode - Ok\n");
    }
 
-   /* Wait and Read from the socket. */
-   timeout = tsec;
+   /* Wait and Read from the sockets, send data and check commands by timer */
+   if (loop_init() < 0)
+      exit(1);
+   if (host) {
+      pthread_t thr;
+      if (pthread_create(&thr, NULL, cmd_thread, NULL)) {
+     perror("Can't start command forwarding thread");
+     exit(1);
+      }
+   }
    while (TRUE) {
-      int rll;
-      fd_set fdset;
-      //unsigned char *p = host?sdat.addr:buff;
-      int sock = host?dsock:csock;
-      int size = host?(sdat.maxsize+2):1024;
-      struct timeval tv;
-      int ret, code, csize;
-      union {
-     unsigned char b[2];
-     unsigned short w;
-      } cs;
-      struct my_msgbuf mbuf, *mbp;
-
-      FD_ZERO(&fdset);
-      FD_SET(sock, &fdset);
-      tv.tv_sec=(int)timeout;
-      tv.tv_usec=(int)((timeout-tv.tv_sec)*1000000.+0.5);
-
-      if ((ret=select(FD_SETSIZE, &fdset, NULL, NULL, &tv)) < 0) {
-      perror("select() fault");
-      continue;
+      struct epoll_event ev[4];
+      int n;
+      if(dump_stats) {
+     dump_stats = 0;
+     print_stats();
       }
-      rll = 0;
-      if (ret>0 && FD_ISSET(sock, &fdset)) {
-     fromlen = sizeof(from);
-     if ((rll = recvfrom(sock, buff, size, 0, (struct sockaddr *) &from, (socklen_t*)&fromlen)) < 0) {
-        if (errno != EINTR) {
-           perror("receiving UDP packet");
-        }
-     } else {
-//fprintf(stderr, "Recv time %07.2f ", prog_time());
-//fprintf(stderr, "Recv UDP pack (%d bytes) from  %s\n", rll,inet_ntoa(from.sin_addr));
-     }
-     if (host) {mcast_t = 0.;mcast_tout = 10.;}
-      } else if (host) {         /* 2.4.x kernel iface down/up problem?  */
-     mcast_t += timeout;                 /* (with recv multicast?) */
+      if ((n = epoll_wait(epfd, ev, 4, -1)) < 0) {
+     if (errno != EINTR)
+        bta_log(BTA_LOG_STDERR|BTA_LOG_ERRNO, "epoll_wait() fault");
+     continue;
+      }
+      for(i=0; i<n; i++) {
+     int fd = ev[i].data.fd;
+     if(fd == tfd) on_tick();
+     else if(fd == ctfd) cmd_pause(0);
+     else if(fd == dsock) recv_data();
+     else if(fd == csock) recv_cmd();
+      }
+   }
+}
+
+static struct timespec dbl2ts(double t) {
+   struct timespec ts;
+   ts.tv_sec = (time_t)t;
+   ts.tv_nsec = (long)((t - ts.tv_sec)*1e9);
+   if(ts.tv_nsec >= 1000000000L) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000L;
+   }
+   return ts;
+}
+
+static double mono_time() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/* Create epoll set for both sockets and timers; periodic timer is armed
+ * at absolute deadlines (start + N*tsec), so the period doesn't drift */
+static int loop_init() {
+   struct itimerspec its;
+   struct epoll_event ev;
+   int fds[4], i;
+   epfd = epoll_create1(0);
+   tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+   ctfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+   if(epfd < 0 || tfd < 0 || ctfd < 0) {
+      perror("Can't create epoll or timer descriptor");
+      return -1;
+   }
+   fds[0] = dsock; fds[1] = csock; fds[2] = tfd; fds[3] = ctfd;
+   for(i=0; i<4; i++) {
+      ev.events = EPOLLIN;
+      ev.data.fd = fds[i];
+      if(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev) < 0) {
+     perror("epoll_ctl()");
+     return -1;
+      }
+   }
+   tick0 = mono_time() + tsec;
+   its.it_value = dbl2ts(tick0);
+   its.it_interval = dbl2ts(tsec);
+   if(timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+      perror("timerfd_settime()");
+      return -1;
+   }
+   return 0;
+}
+
+/* Stop (on!=0) reading of command socket for 0.1s or resume it by timer */
+static void cmd_pause(int on) {
+   struct epoll_event ev;
+   struct itimerspec its;
+   uint64_t nexp;
+   if(on) {
+      memset(&its, 0, sizeof(its));
+      its.it_value.tv_nsec = 100000000L;
+      timerfd_settime(ctfd, 0, &its, NULL);
+   } else if(read(ctfd, &nexp, sizeof(nexp)) != sizeof(nexp))
+      return;
+   ev.events = on? 0 : EPOLLIN;
+   ev.data.fd = csock;
+   if(epoll_ctl(epfd, EPOLL_CTL_MOD, csock, &ev) < 0)
+      perror("epoll_ctl()");
+}
+
+/* Achieved period & lateness statistics ("--stats" option) */
+static void period_account(uint64_t nexp) {
+   static double last = 0., sum = 0., sum2 = 0., pmin = 0., pmax = 0.;
+   static double late_sum = 0., late_max = 0.;
+   static unsigned long n = 0, nlate = 0, overruns = 0;
+   static uint64_t nticks = 0;
+   double t = mono_time(), late;
+   nticks += nexp;
+   if(nexp > 1) overruns += nexp-1;
+   late = t - (tick0 + (nticks-1)*tsec);   /* delay after the deadline */
+   late_sum += late;
+   if(late > late_max) late_max = late;
+   nlate++;
+   if(last > 0.) {
+      double dt = t - last;
+      if(n == 0 || dt < pmin) pmin = dt;
+      if(n == 0 || dt > pmax) pmax = dt;
+      sum += dt;
+      sum2 += dt*dt;
+      n++;
+   }
+   last = t;
+   if(n*tsec >= 10.) {
+      double mean = sum/n, var = sum2/n - mean*mean;
+      bta_log(BTA_LOG_STDERR, "Period (ms): need %.2f, mean %.3f, sd %.3f, min %.3f, max %.3f; "
+          "lateness: mean %.3f, max %.3f; overruns: %lu",
+          tsec*1e3, mean*1e3, (var>0.)? sqrt(var)*1e3 : 0., pmin*1e3, pmax*1e3,
+          late_sum/nlate*1e3, late_max*1e3, overruns);
+      sum = sum2 = late_sum = late_max = 0.;
+      n = nlate = overruns = 0;
+   }
+}
+
+/* Periodic timer: send data (sender) or check commands queues (receiver) */
+static void on_tick() {
+   uint64_t nexp;
+   if(read(tfd, &nexp, sizeof(nexp)) != sizeof(nexp))
+      return;
+   if(show_stats)
+      period_account(nexp);
+   if (host) {
+      if(!got_data) {              /* 2.4.x kernel iface down/up problem?  */
+     mcast_t += tsec*nexp;             /* (with recv multicast?) */
      if(mcast_t>mcast_tout) {   /* no packets? */
         mcast_t = 0.;           /* may be need to re-add to multicast group? */
         setsockopt(dsock, IPPROTO_IP, IP_DROP_MEMBERSHIP, (char *)&mr, sizeof(mr));
         if (setsockopt(dsock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char *)&mr, sizeof(mr)) < 0) {
-           sprintf(msg,"ReJoining multicast group %s", inet_ntoa(mcast_addr));
-           perror(msg);
+           bta_log(BTA_LOG_STDERR|BTA_LOG_ERRNO, "ReJoining multicast group %s", inet_ntoa(mcast_addr));
         } else if(mcast_tout<999.) {
-           fprintf(stderr,"Multicast timeout? ReJoin group %s\n", inet_ntoa(mcast_addr));
+           bta_log(BTA_LOG_STDERR, "Multicast timeout? ReJoin group %s", inet_ntoa(mcast_addr));
            mcast_tout *= 10.;
         }
      }
+     send_sync(0);            /* sync is checked on every data packet too */
       }
-      if (host) {
-     static int last_err = 0;
-     static int err_type = 0;
-     int currt = time(NULL);
+      got_data = 0;
+      if(subs_period > 0.) {
+     static double subs_t = SUBS_LEASE;
+     subs_t += tsec*nexp;
+     /* renew subscription or repeat request every second while no data */
+     if(subs_t >= SUBS_LEASE/3. || (mcast_t > 1. && subs_t >= 1.)) {
+        subs_t = 0.;
+        subs_request();
+     }
+      }
+   } else if(ip != 0)                  /* not "remote"-mode */
+      send_data(&data, TRUE);
+   else if(nsubs)
+      send_subs();
+}
+
+/* Receive packet into buff, returns its length (header stripped) */
+static int recv_pkt(int sock, int size) {
+   int rll;
+   fromlen = sizeof(from);
+   if ((rll = recvfrom(sock, buff, size, 0, (struct sockaddr *) &from, (socklen_t*)&fromlen)) < 0) {
+      if (errno != EINTR && errno != EAGAIN)
+     bta_log(BTA_LOG_STDERR|BTA_LOG_ERRNO, "receiving UDP packet");
+      return rll;
+   }
+//bta_log(BTA_LOG_STDERR, "Recv UDP pack (%d bytes) from  %s", rll,inet_ntoa(from.sin_addr));
+   return strip_hdr(rll);
+}
+
+/* Data packet from ACS host: check it and put into shared memory */
+static void recv_data() {
+   int err_type = 0;    /* 0 - Ok, 1..5 - errors, 6 - no keyframe for delta yet */
+   int i, ret, rll;
+   uint32_t keyseq = 0;
+   union {
+      unsigned char b[2];
+      unsigned short w;
+   } cs;
+   struct my_msgbuf mbuf;
+
+   if ((rll = recv_pkt(dsock, sdat.maxsize+2)) < 0 || !host)
+      return;
+   mcast_t = 0.;mcast_tout = 10.;
+   got_data = 1;
      if(rll>2) {
         struct BTA_Data *pb = (void *)buff;
+        int is_key = (u_buff.ival == KEY_MAGIC);
+        int is_delta = is_key || (u_buff.ival == DELTA_MAGIC);
         ServPID = getpid();
-        if(pb->magic != sdat.key.code) {
-           if(currt-last_err>60 || err_type!=1) {
-          fprintf(stderr,"Wrong shared data (maybe server %s turned off)\n", inet_ntoa(from.sin_addr));
-          last_err=currt;
-          err_type=1;
+        /* the same errors are reported once a minute (or more rarely) */
+        if(is_delta && (ret = delta_decode(&rll, &keyseq)) != 0) {
+           if(ret==1) { /* wrong CS, say about it */
+              err_type=5;
+              if(bta_log_ratelimit(err_type, 60))
+                 bta_log(BTA_LOG_STDERR, "Wrong CS of delta packet from %s!", inet_ntoa(from.sin_addr));
+           } else { /* no keyframe yet or wrong one - just wait for the next */
+              err_type=6;
+              if(ret==3 && bta_log_ratelimit(7, 60))
+                 bta_log(BTA_LOG_STDERR, "Wrong CRC of block rebuilt from packet of %s", inet_ntoa(from.sin_addr));
            }
         }
+        else if(pb->magic != sdat.key.code) {
+           err_type=1;
+           if(bta_log_ratelimit(err_type, 60))
+              bta_log(BTA_LOG_STDERR, "Wrong shared data (maybe server %s turned off)", inet_ntoa(from.sin_addr));
+        }
         else if(pb->version == 0) {
-           if(currt-last_err>60 || err_type!=2) {
-          fprintf(stderr,"Null shared data version (maybe server at %s turned off)\n",inet_ntoa(from.sin_addr));
-          last_err=currt;
-          err_type=2;
-           }
+           err_type=2;
+           if(bta_log_ratelimit(err_type, 60))
+              bta_log(BTA_LOG_STDERR, "Null shared data version (maybe server at %s turned off)",inet_ntoa(from.sin_addr));
         }
         else if(pb->size != sizeof(struct BTA_Data)) {
            int perr = (pb->size>sdat.size&&pb->size<sdat.maxsize)? 3600 : 60;
-           if(currt-last_err>perr || err_type!=3) {
-          fprintf(stderr,"Wrong shared area size: I needs - %zd, but server %s - %d ...\n",
+           err_type=3;
+           if(bta_log_ratelimit(err_type, perr)) {
+              bta_log(BTA_LOG_STDERR, "Wrong shared area size: I needs - %zd, but server %s - %d ...",
                    sizeof(struct BTA_Data), inet_ntoa(from.sin_addr), pb->size );
-          last_err=currt;
-          err_type=3;
-          if(pb->size > sdat.maxsize) pb->size = sdat.maxsize;
-          if(pb->version != BTA_Data_Ver)
-             goto wrongver;
-           } else
-          if(pb->size > sdat.maxsize) pb->size = sdat.maxsize;
+              if(pb->version != BTA_Data_Ver)
+                 bta_log(BTA_LOG_STDERR, "Wrong shared data version: I'am - %d, but server %s - %d ...",
+                      BTA_Data_Ver, inet_ntoa(from.sin_addr), pb->version );
+           }
+           if(pb->size > sdat.maxsize) pb->size = sdat.maxsize;
         }
         else if(pb->version != BTA_Data_Ver) {
-           if(currt-last_err>600 || err_type!=4) {
-          last_err=currt;
-          err_type=4;
-     wrongver:
-          fprintf(stderr,"Wrong shared data version: I'am - %d, but server %s - %d ...\n",
+           err_type=4;
+           if(bta_log_ratelimit(err_type, 600))
+              bta_log(BTA_LOG_STDERR, "Wrong shared data version: I'am - %d, but server %s - %d ...",
                    BTA_Data_Ver, inet_ntoa(from.sin_addr), pb->version );
-           }
         }
         else {
            for(i=0,cs.w=0; i<rll-2; i++)
           cs.w += buff[i];
            if(buff[rll-2] != cs.b[0] || buff[rll-1] != cs.b[1]) {
-          if(currt-last_err>60 || err_type!=5) {
-             fprintf(stderr,"Wrong CS from %s! %2x%02x %4x\n",
+          err_type=5;
+          if(bta_log_ratelimit(err_type, 60))
+             bta_log(BTA_LOG_STDERR, "Wrong CS from %s! %2x%02x %4x",
                      inet_ntoa(from.sin_addr),
                   buff[rll-1], buff[rll-2], cs.w);
-             last_err=currt;
-             err_type=5;
-          }
-           } else
-          err_type=0;
+           }
         }
-        if(err_type==0 || err_type==3)
+        if(err_type==0 || err_type==6)      /* not an error, just remember it */
+           bta_log_ratelimit(err_type, 0.);
+        if(is_key && (err_type==0 || err_type==3))
+           delta_keyframe(buff, rll-2, keyseq);
+        if(err_type==0 || err_type==3) {
+           bta_write_begin();
            memcpy(sdat.addr, buff, pb->size);
-     }
-     if(rll<=0 || err_type==0 || err_type==3) {
-        if(sync) {
-           int nsync = (int)(tsync/tsec+0.5); /* e.g. tsync=0.9,tsec=0.05 => nsync=18 */
-           if(nsync<2) nsync=2;
-           if(rll>0) syncnt = 1;  /*  ,   sync-*/
-           else syncnt = (syncnt+1)%nsync; /* e.g. nsync=18 => 18*0.05=0.9sec */
-        }
-       /*        */
-       /*      ""*/
-        code = mcmd.key.code;
-        ret = msgrcv ( mcmd.id, (struct msgbuf *)&mbuf, 112, StopTel, IPC_NOWAIT);
-        if (ret <= 0 ) {
-           if (errno != ENOMSG)
-          perror("Getting command from 'MainOperator' fault");
-        }
-        else goto do_cmd;
-       /*       */
-        ret = msgrcv ( mcmd.id, (struct msgbuf *)&mbuf, 112, 0, IPC_NOWAIT);
-        if (ret <= 0 ) {
-           if (errno != ENOMSG)
-          perror("Getting command from 'MainOperator' fault");
-        }
-        else goto do_cmd;
-       /*       */
-       /*       ""*/
-        code = ocmd.key.code;
-        ret = msgrcv ( ocmd.id, (struct msgbuf *)&mbuf, 112, StopTel, IPC_NOWAIT);
-        if (ret <= 0 ) {
-           if (errno != ENOMSG)
-          perror("Getting command from 'Operator' fault");
-        }
-        else goto do_cmd;
-       /*       */
-        ret = msgrcv ( ocmd.id, (struct msgbuf *)&mbuf, 112, 0, IPC_NOWAIT);
-        if (ret <= 0 ) {
-           if (errno != ENOMSG)
-          perror("Getting command from 'Operator' fault");
-        }
-        else goto do_cmd;
-       /*      */
-        code = ucmd.key.code;
-        ret = msgrcv ( ucmd.id, (struct msgbuf *)&mbuf, 112, 0, IPC_NOWAIT);
-        if (ret <= 0 ) {
-           if (errno != ENOMSG)
-          perror("Getting command from 'User' fault");
-        /* no commands at all... */
-           if(sync && syncnt==0) {
-          code = 0;         /*need to send sync pack to remote network */
-          mbuf.mtype = 0;
-          mbuf.acckey = 0;
-          mbuf.src_pid = getpid();
-          mbuf.src_ip = my_ip;
-          mbuf.mtext[0] = 0;
-          ret=1;
-           } else
-          continue;            /* nothing to send...*/
-        }
-      do_cmd:
-        if(mbuf.src_ip == 0)
-           mbuf.src_ip = my_ip;
-        u_buff.ival = code;
-        //*((int *)buff) = code;
-        memcpy(buff+sizeof(code), &mbuf, sizeof(mbuf.mtype)+ret);
-        csize = sizeof(code)+sizeof(mbuf.mtype)+ret;
-        for(i=0,cs.w=0; i<csize; i++)
-           cs.w += buff[i];
-        buff[csize++] = cs.b[0];
-        buff[csize++] = cs.b[1];
-        if (sendto(csock, buff, csize,
-           0, (struct sockaddr *)&cmd, sizeof(cmd)) < 0) {
-           perror("sending command datagram");
-           continue;
+           bta_write_end();
+           if(hist_len) {
+              struct timeval tv;
+              gettimeofday(&tv, NULL);
+              bta_hist_append(pb, tv.tv_sec + tv.tv_usec/1e6);
+           }
         }
-/*fprintf(stderr, "Send %d bytes to %s.\n", csize, inet_ntoa(cmd.sin_addr));
- */
-     } else {
+     }
+     if(rll<=0 || err_type==0 || err_type==3 || err_type==6)
+        send_sync(rll>0);
+     else {
         /* Shm-data error? Suspicious server! Cmd-queues Cleanup...*/
         ret = msgrcv ( mcmd.id, (struct msgbuf *)&mbuf, 112, 0, IPC_NOWAIT);
         ret = msgrcv ( ocmd.id, (struct msgbuf *)&mbuf, 112, 0, IPC_NOWAIT);
         ret = msgrcv ( ucmd.id, (struct msgbuf *)&mbuf, 112, 0, IPC_NOWAIT);
      }
-      } else {
-     static double last_recv=0.;
-     static double last_send=0.;
-     double tcurr = prog_time();
-     if(rll > 0) {                              /* recv. somewhat packet ? */
-        int id=-1;
-        if(rll>2) {
-           for(i=0,cs.w=0; i<rll-2; i++)
-          cs.w += buff[i];
-           if(buff[rll-2] != cs.b[0] || buff[rll-1] != cs.b[1]) {
-          fprintf(stderr,"Wrong CS from %s! %2x%02x %4x\n",
-                     inet_ntoa(from.sin_addr),
-                  buff[rll-1], buff[rll-2], cs.w);
-           } else {
-          code = u_buff.ival;
-          //code = *((int *)buff);
-          csize = rll-sizeof(code)-sizeof(mbuf.mtype);
-          if(code==mcmd.key.code) id=mcmd.id;
-          else if(code==ocmd.key.code) id=ocmd.id;
-          else if(code==ucmd.key.code) id=ucmd.id;
-           }
+}
+
+/* Send sync request to ACS host if there were no data and commands for tsync */
+static void send_sync(int got) {
+   int nsync, csize;
+   int32_t code = 0;
+   struct my_msgbuf mbuf;
+
+   if(!use_sync)
+      return;
+   nsync = (int)(tsync/tsec+0.5); /* e.g. tsync=0.9,tsec=0.05 => nsync=18 */
+   if(nsync<2) nsync=2;
+   if(got) syncnt = 1;  /*  ,   sync-*/
+   else syncnt = (syncnt+1)%nsync; /* e.g. nsync=18 => 18*0.05=0.9sec */
+   if(__atomic_exchange_n(&cmds_sent, 0, __ATOMIC_RELAXED) || syncnt != 0)
+      return;
+   mbuf.mtype = 0;     /*need to send sync pack to remote network */
+   mbuf.acckey = 0;
+   mbuf.src_pid = getpid();
+   mbuf.src_ip = my_ip;
+   mbuf.mtext[0] = 0;
+   memcpy(buff, &code, sizeof(code));
+   memcpy(buff+sizeof(code), &mbuf, sizeof(mbuf.mtype)+1);
+   csize = put_cs(buff, sizeof(code)+sizeof(mbuf.mtype)+1);
+   if (send_pkt(csock, buff, csize, &cmd) < 0)
+      bta_log(BTA_LOG_STDERR|BTA_LOG_ERRNO, "sending sync datagram");
+}
+
+/* local command queues in order of priority */
+static struct {
+   struct CMD_Queue *q;
+   long type;                  /* message type to get (0 - any) */
+   const char *name;
+   int err;                    /* last error (to report it once) */
+} cmd_src[] = {
+   /*     ,     "" */
+   {&mcmd, StopTel, "MainOperator", 0},
+   {&mcmd, 0, "MainOperator", 0},
+   /*      */
+   {&ocmd, StopTel, "Operator", 0},
+   {&ocmd, 0, "Operator", 0},
+   /*      */
+   {&ucmd, 0, "User", 0},
+};
+#define CMD_SRC_N ((int)(sizeof(cmd_src)/sizeof(cmd_src[0])))
+
+/* Drain local command queues and send all commands found to ACS host */
+static void forward_cmds() {
+   static unsigned char cbuf[BATCH_SIZE];
+   struct my_msgbuf mbuf;
+   int32_t item[2];
+   int i, ret, n = 0, len = 2*sizeof(int32_t), csize;
+
+   for(i=0; i<CMD_SRC_N; i++) {
+      while(n < BATCH_MAX) {
+     ret = msgrcv(cmd_src[i].q->id, (struct msgbuf *)&mbuf, 112, cmd_src[i].type, IPC_NOWAIT);
+     if(ret <= 0) {
+        if(ret < 0 && errno != ENOMSG && errno != EINTR && errno != cmd_src[i].err) {
+           bta_log(BTA_LOG_STDERR|BTA_LOG_ERRNO, "Getting command from '%s' fault", cmd_src[i].name);
+           cmd_src[i].err = errno;
         }
-        if(id>=0) {                             /* command packet? */
-           static unsigned long prev_ip=0;      /* IP-.  */
-           unsigned long netaddr;
-           struct in_addr src_addr;
-           char *acc;
-           static char *prev_acc=NULL;
-
-           mbp = (struct my_msgbuf *)(buff+sizeof(code));
-           netaddr = ntohl(mbp->src_ip);
-           if(mbp->src_ip == 0) {
-          fprintf(stderr,"  : 0.0.0.0 (  %s)!\n",
-                 inet_ntoa(from.sin_addr));
-          mbp->src_ip = from.sin_addr.s_addr;
-           } else if(((mbp->src_ip&maskC)==(from.sin_addr.s_addr&maskC)) &&
-             ((ntohl(from.sin_addr.s_addr)&ACSMask) != (ACSNet & ACSMask)) &&
-             (mbp->src_ip != from.sin_addr.s_addr)) {
-          src_addr.s_addr = mbp->src_ip;
-          fprintf(stderr, "  : %s (  %s)!\n",
-              inet_ntoa(src_addr),inet_ntoa(from.sin_addr));
-          mbp->src_ip = from.sin_addr.s_addr;
-           }
-           if(((netaddr & NetMask) == (NetWork & NetMask)) ||
-          ((netaddr & ACSMask) == (ACSNet & ACSMask))) {
-          msgsnd(id, (struct msgbuf *)mbp, csize, IPC_NOWAIT);
-          acc = "Accept";
-           } else
-          acc = "Failed";
-           if( prev_ip != mbp->src_ip || prev_acc != acc) {
-          src_addr.s_addr = mbp->src_ip;
-          sprintf(msg, "Cmds from %s - %s", inet_ntoa(src_addr),acc);
-          if((netaddr & ACSMask) != (ACSNet & ACSMask))
-             log_message(msg);
-           }
-           prev_acc=acc;
-           prev_ip=mbp->src_ip;
+        break;
+     }
+     cmd_src[i].err = 0;
+     if(mbuf.src_ip == 0)
+        mbuf.src_ip = my_ip;
+     item[0] = cmd_src[i].q->key.code;
+     item[1] = sizeof(mbuf.mtype)+ret;
+     memcpy(cbuf+len, item, sizeof(item));
+     memcpy(cbuf+len+sizeof(item), &mbuf, item[1]);
+     len += sizeof(item) + ((item[1]+3) & ~3);
+     n++;
+      }
+   }
+   if(!n)
+      return;
+   if(n == 1) {               /* old format: code, message */
+      memmove(cbuf+2*sizeof(int32_t)+sizeof(int32_t), cbuf+2*sizeof(int32_t)+sizeof(item), item[1]);
+      csize = put_cs(cbuf+2*sizeof(int32_t), sizeof(int32_t)+item[1]);
+      ret = send_pkt(csock, cbuf+2*sizeof(int32_t), csize, &cmd);
+   } else {
+      item[0] = BATCH_MAGIC;
+      item[1] = n;
+      memcpy(cbuf, item, sizeof(item));
+      csize = put_cs(cbuf, len);
+      ret = send_pkt(csock, cbuf, csize, &cmd);
+   }
+   if(ret < 0)
+      bta_log(BTA_LOG_STDERR|BTA_LOG_ERRNO, "sending command datagram");
+   __atomic_store_n(&cmds_sent, 1, __ATOMIC_RELAXED);
+}
+
+/* Command forwarding thread (receiver): check local queues every CMD_PERIOD,
+ * so commands don't wait for data packets or timer ticks */
+static void *cmd_thread(void *arg) {
+   struct timespec ts = dbl2ts(CMD_PERIOD);
+   sigset_t ss;
+   (void)arg;
+   sigfillset(&ss);              /* signals are handled by main thread */
+   pthread_sigmask(SIG_BLOCK, &ss, NULL);
+   while (TRUE) {
+      forward_cmds();
+      clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+   }
+   return NULL;
+}
+
+/* Queue ID for command access code or -1 */
+static int cmd_queue_id(int code) {
+   if(code==mcmd.key.code) return mcmd.id;
+   if(code==ocmd.key.code) return ocmd.id;
+   if(code==ucmd.key.code) return ucmd.id;
+   return -1;
+}
+
+/* Check source of received command and put it into queue `id` */
+static void put_cmd(int id, struct my_msgbuf *mbp, int csize) {
+   static unsigned long prev_ip=0;      /* IP-.  */
+   static char *prev_acc=NULL;
+   unsigned long netaddr;
+   struct in_addr src_addr;
+   char *acc;
+
+   netaddr = ntohl(mbp->src_ip);
+   if(mbp->src_ip == 0) {
+      bta_log(BTA_LOG_STDERR, "  : 0.0.0.0 (  %s)!",
+          inet_ntoa(from.sin_addr));
+      mbp->src_ip = from.sin_addr.s_addr;
+   } else if(((mbp->src_ip&maskC)==(from.sin_addr.s_addr&maskC)) &&
+         ((ntohl(from.sin_addr.s_addr)&ACSMask) != (ACSNet & ACSMask)) &&
+         (mbp->src_ip != from.sin_addr.s_addr)) {
+      src_addr.s_addr = mbp->src_ip;
+      bta_log(BTA_LOG_STDERR, "  : %s (  %s)!",
+          inet_ntoa(src_addr),inet_ntoa(from.sin_addr));
+      mbp->src_ip = from.sin_addr.s_addr;
+   }
+   if(((netaddr & NetMask) == (NetWork & NetMask)) ||
+      ((netaddr & ACSMask) == (ACSNet & ACSMask))) {
+      msgsnd(id, (struct msgbuf *)mbp, csize, IPC_NOWAIT);
+      acc = "Accept";
+   } else
+      acc = "Failed";
+   if( prev_ip != mbp->src_ip || prev_acc != acc) {
+      src_addr.s_addr = mbp->src_ip;
+      if((netaddr & ACSMask) != (ACSNet & ACSMask))
+     bta_log(BTA_LOG_STDOUT, "Cmds from %s - %s", inet_ntoa(src_addr), acc);
+   }
+   prev_acc=acc;
+   prev_ip=mbp->src_ip;
+}
+
+/* Unpack commands batch of `len` bytes (without checksum) */
+static void put_batch(int len) {
+   int32_t item[2];
+   int n, pos = 2*sizeof(int32_t), id;
+   memcpy(item, buff, sizeof(item));
+   for(n = item[1]; n > 0 && pos+(int)sizeof(item) <= len; n--) {
+      memcpy(item, buff+pos, sizeof(item));
+      pos += sizeof(item);
+      if(item[1] < (int)sizeof(int32_t) || item[1] > (int)sizeof(struct my_msgbuf) || pos+item[1] > len)
+     break;
+      if((id = cmd_queue_id(item[0])) >= 0)
+     put_cmd(id, (struct my_msgbuf *)(buff+pos), item[1]-sizeof(int32_t));
+      pos += (item[1]+3) & ~3;
+   }
+   if(n)
+      bta_log(BTA_LOG_STDERR, "Broken commands batch from %s!", inet_ntoa(from.sin_addr));
+}
+
+/* Command packet (or "remote" request): put command into queue, reply with data */
+static void recv_cmd() {
+   int i, rll, code, csize = 0;
+   int id=-1;
+   union {
+      unsigned char b[2];
+      unsigned short w;
+   } cs;
+   struct my_msgbuf mbuf;
+
+   if ((rll = recv_pkt(csock, sizeof(buff))) <= 0 || host)
+      return;
+     if(rll>2) {
+        for(i=0,cs.w=0; i<rll-2; i++)
+       cs.w += buff[i];
+        if(buff[rll-2] != cs.b[0] || buff[rll-1] != cs.b[1]) {
+       bta_log(BTA_LOG_STDERR, "Wrong CS from %s! %2x%02x %4x",
+                  inet_ntoa(from.sin_addr),
+               buff[rll-1], buff[rll-2], cs.w);
+        } else {
+       code = u_buff.ival;
+       //code = *((int *)buff);
+       csize = rll-sizeof(code)-sizeof(mbuf.mtype);
+       if(code==BATCH_MAGIC && rll>=(int)(2*sizeof(int32_t))+2)
+          put_batch(rll-2);
+       else if(ip==0 && code==SUBS_MAGIC && rll==sizeof(struct subs_req)+2) {
+          subscribe((struct subs_req *)buff);
+          return;
+       } else
+          id = cmd_queue_id(code);
         }
-        if(tcurr-last_recv < 0.1)       /* max 10 cmd-packs per second */
-           my_sleep(0.11-(tcurr-last_recv));
-        last_recv = tcurr;
      }
-     if(ip==0) {         /*"remote"-mode ?*/
-        if(rll <= 0)     /* recv. somewhat packet ? */
-           continue;
+     if(id>=0)                               /* command packet? */
+        put_cmd(id, (struct my_msgbuf *)(buff+sizeof(code)), csize);
+     cmd_pause(1);                   /* max 10 cmd-packs per second */
+     if(ip==0)          /*"remote"-mode: data to requesting host */
         data.sin_addr.s_addr = from.sin_addr.s_addr;
-     }
-     if(ip==0 || rll==0 || fabs(last_send-tcurr)>tsec ) { /*"remote"||timeout*/
-        struct BTA_Data *pb = (void *)buff;
-        memcpy(buff, sdat.addr, sdat.size);
-        csize = pb->size = sdat.size;
-        for(i=0,cs.w=0; i<csize; i++)
-           cs.w += buff[i];
-        buff[csize++] = cs.b[0];
-        buff[csize++] = cs.b[1];
-        if (sendto(dsock, buff, csize,
-           0, (struct sockaddr *)&data, sizeof(data)) < 0) {
-           perror("sending datagram message");
-           continue;
-        }
-        last_send = tcurr;
-        timeout = tsec;
+     else               /* send TCS data block as a reply to cmd */
+        from.sin_port = htons(dport);
+     send_data(ip==0? &data : &from, FALSE);
+}
+
+/* Send data block to given address; deltas are used only for periodic sending:
+ * "remote" hosts and replies get plain full blocks as they could miss keyframe */
+static void send_data(struct sockaddr_in *to, int periodic) {
+   struct BTA_Data *pb = (void *)buff;
+   unsigned char *pkt = buff;
+   int csize, dsize;
+   bta_snapshot(pb);
+   csize = pb->size = sdat.size;
+   if(periodic && delta_n && (dsize = delta_encode(csize)) > 0) {
+      pkt = u_delta.ubuf;
+      csize = dsize;
+   } else if(periodic && delta_n) { /* keyframe packet */
+      struct delta_hdr *dh = (struct delta_hdr *)u_delta.ubuf;
+      delta_keyframe(buff, csize, key_seq+1);
+      dh->magic = KEY_MAGIC;
+      dh->size = csize;
+      dh->keyseq = key_seq;
+      dh->crc = bta_crc32(buff, csize);
+      dh->nwords = 0;
+      memcpy(u_delta.ubuf+sizeof(*dh), buff, csize);
+      pkt = u_delta.ubuf;
+      csize = put_cs(pkt, sizeof(*dh)+csize);
+   } else
+      csize = put_cs(buff, csize);
+   if (send_pkt(dsock, pkt, csize, to) < 0)
+      bta_log(BTA_LOG_STDERR|BTA_LOG_ERRNO, "sending datagram message");
+/*bta_log(BTA_LOG_STDERR, "Send %d bytes to %s.", sdat.size, inet_ntoa(to->sin_addr));*/
+}
+
+/* Add or renew subscription of `from` host ("remote" mode) */
+static void subscribe(struct subs_req *r) {
+   struct subscriber *s = NULL;
+   double now = mono_time();
+   int i, lease = r->lease;
+   for(i=0; i<nsubs; i++)
+      if(subs[i].addr.sin_addr.s_addr == from.sin_addr.s_addr) {
+     s = &subs[i];
+     break;
+      }
+   if(!s) {
+      if(nsubs >= MAX_SUBS) {
+     bta_log(BTA_LOG_STDERR, "Too many subscribers, %s rejected", inet_ntoa(from.sin_addr));
+     return;
+      }
+      s = &subs[nsubs++];
+      memset(s, 0, sizeof(*s));
+      s->addr.sin_family = AF_INET;
+      s->addr.sin_addr = from.sin_addr;
+      s->addr.sin_port = htons(dport);
+      s->next = now;                  /* send the first block at next tick */
+      bta_log(BTA_LOG_STDERR, "New subscriber %s (period %dms, lease %ds)",
+          inet_ntoa(from.sin_addr), r->period_ms, lease);
+   }
+   s->period = r->period_ms/1000.;
+   if(s->period < tsec) s->period = tsec;
+   if(lease < 1) lease = 1;
+   else if(lease > 600) lease = 600;
+   s->lease_end = now + lease;
+}
 
-/*fprintf(stderr, "Send time %07.2f\n", last_send);*/
-/*fprintf(stderr, "Send %d bytes to %s.\n", sdat.size,
- *          (ip==0)?inet_ntoa(data.sin_addr):"All");
+/* Send one data block to all subscribers that are due with one sendmmsg() */
+static void send_subs() {
+   static struct mmsghdr mm[MAX_SUBS];
+   static struct iovec iov[MAX_SUBS][2];
+   static struct net_hdr hdr[MAX_SUBS];
+   struct BTA_Data *pb = (void *)buff;
+   double now = mono_time();
+   int i, n = 0, csize, ret;
+   /* drop expired subscriptions */
+   for(i=0; i<nsubs; i++) {
+      if(subs[i].lease_end > now) continue;
+      bta_log(BTA_LOG_STDERR, "Subscription of %s expired", inet_ntoa(subs[i].addr.sin_addr));
+      subs[i--] = subs[--nsubs];
+   }
+   bta_snapshot(pb);
+   csize = pb->size = sdat.size;
+   csize = put_cs(buff, csize);
+   for(i=0; i<nsubs; i++) {
+      struct subscriber *s = &subs[i];
+      struct msghdr *mh = &mm[n].msg_hdr;
+      int niov = 0;
+      if(now < s->next - tsec/2.) continue;  /* not yet (within half of tick) */
+      s->next += s->period;
+      if(s->next < now) s->next = now + s->period; /* don't send bursts after delay */
+      if(use_hdr) {
+     make_hdr(&hdr[n], ++s->seq);
+     iov[n][niov].iov_base = &hdr[n];
+     iov[n][niov++].iov_len = sizeof(struct net_hdr);
+      }
+      iov[n][niov].iov_base = buff;
+      iov[n][niov++].iov_len = csize;
+      memset(mh, 0, sizeof(*mh));
+      mh->msg_name = &s->addr;
+      mh->msg_namelen = sizeof(s->addr);
+      mh->msg_iov = iov[n];
+      mh->msg_iovlen = niov;
+      n++;
+   }
+   /* sendmmsg() stops at the first failed message: skip it and send the rest */
+   for(i=0; i<n; i+=ret)
+      if((ret = sendmmsg(dsock, mm+i, n-i, 0)) < 0 && errno == EINTR)
+     ret = 0;
+      else if(ret <= 0) {
+     bta_log(BTA_LOG_STDERR|BTA_LOG_ERRNO, "sending datagram message to %s",
+         inet_ntoa(((struct sockaddr_in *)mm[i].msg_hdr.msg_name)->sin_addr));
+     ret = 1;
+      }
+}
+
+/* Receiver: ask "remote" ACS host to send us data blocks for SUBS_LEASE s */
+static void subs_request() {
+   struct subs_req *r = (struct subs_req *)buff;
+   int csize;
+   r->magic = SUBS_MAGIC;
+   r->period_ms = (int32_t)(subs_period*1000.+0.5);
+   r->lease = SUBS_LEASE;
+   csize = put_cs(buff, sizeof(*r));
+   if (send_pkt(csock, buff, csize, &cmd) < 0)
+      bta_log(BTA_LOG_STDERR|BTA_LOG_ERRNO, "sending subscription request");
+}
+
+/* add checksum to the end of packet, return new packet length */
+static int put_cs(unsigned char *b, int len) {
+   int i;
+   union {
+      unsigned char b[2];
+      unsigned short w;
+   } cs;
+   for(i=0,cs.w=0; i<len; i++)
+      cs.w += b[i];
+   b[len++] = cs.b[0];
+   b[len++] = cs.b[1];
+   return len;
+}
+
+/* store a full block of len bytes as keyframe number seq */
+static void delta_keyframe(unsigned char *b, int len, uint32_t seq) {
+   if(len > DELTA_WORDS*4) len = DELTA_WORDS*4;
+   memcpy(u_key.ubuf, b, len);
+   key_size = len;
+   key_seq = seq;
+}
+
+/* Make delta packet in u_delta from a block in buff (size bytes).
+ * Returns length of packet or 0 if it's time to send a keyframe
+ * (or delta isn't much shorter than the full block)
  */
-     } else {
-        if(rll>0) { // send TCS data block as a reply to cmd
-           struct BTA_Data *pb = (void *)buff;
-           memcpy(buff, sdat.addr, sdat.size);
-           csize = pb->size = sdat.size;
-           for(i=0,cs.w=0; i<csize; i++)
-                cs.w += buff[i];
-           buff[csize++] = cs.b[0];
-           buff[csize++] = cs.b[1];
-           from.sin_port = htons(dport);
-           if (sendto(dsock, buff, csize, 0, (struct sockaddr *)&from, fromlen) < 0) {
-                perror("sending datagram message");
-                continue;
-           }
-        }
-        timeout = tsec - (last_send-tcurr);
-        if(timeout<0.011) timeout=0.011;
-     }
+static int delta_encode(int size) {
+   static int npkt = 0;
+   struct delta_hdr *dh = (struct delta_hdr *)u_delta.ubuf;
+   uint32_t *map = u_delta.w + sizeof(struct delta_hdr)/4;
+   uint32_t *val = map + DELTA_MAPLEN;
+   int i, n = 0;
+   if(++npkt >= delta_n || key_size != size || size != DELTA_WORDS*4) {
+      npkt = 0;
+      return 0;
+   }
+   memset(map, 0, DELTA_MAPLEN*sizeof(uint32_t));
+   for(i=0; i<DELTA_WORDS; i++) {
+      if(u_buff.w[i] == u_key.w[i]) continue;
+      map[i/32] |= 1U<<(i%32);
+      val[n++] = u_buff.w[i];
+   }
+   if(n > DELTA_WORDS/2) { /* too many changes - keyframe is better */
+      npkt = 0;
+      return 0;
+   }
+   dh->magic = DELTA_MAGIC;
+   dh->size = size;
+   dh->keyseq = key_seq;
+   dh->crc = bta_crc32(buff, size);
+   dh->nwords = n;
+   return put_cs(u_delta.ubuf, (unsigned char *)(val+n) - u_delta.ubuf);
+}
+
+/* Restore full block in buff from a delta or keyframe packet of *len bytes in buff.
+ * Returns 0 if all OK (*len becomes the full block length with checksum,
+ * *seq - keyframe number), 1 if wrong checksum, 2 if there's no suitable
+ * keyframe, 3 if CRC of rebuilt block is wrong
+ */
+static int delta_decode(int *len, uint32_t *seq) {
+   struct delta_hdr *dh = (struct delta_hdr *)u_delta.ubuf;
+   uint32_t *map = u_delta.w + sizeof(struct delta_hdr)/4;
+   uint32_t *val = map + DELTA_MAPLEN;
+   int i, n = 0, l = *len - 2;
+   if(l < (int)sizeof(struct delta_hdr))
+      return 1;
+   memcpy(u_delta.ubuf, buff, *len);
+   put_cs(u_delta.ubuf, l);
+   if(memcmp(u_delta.ubuf+l, buff+l, 2))
+      return 1;
+   if(dh->size != DELTA_WORDS*4)
+      return 2;
+   if(dh->magic == KEY_MAGIC) {
+      if(l != (int)sizeof(struct delta_hdr) + dh->size)
+         return 1;
+      memcpy(buff, u_delta.ubuf+sizeof(struct delta_hdr), dh->size);
+   } else {
+      if(l < (int)(sizeof(struct delta_hdr) + DELTA_MAPLEN*sizeof(uint32_t)) ||
+         dh->nwords > (uint32_t)DELTA_WORDS ||
+         l != (int)((unsigned char *)(val + dh->nwords) - u_delta.ubuf))
+         return 1;
+      if(key_size != dh->size || dh->keyseq != key_seq)
+         return 2;
+      memcpy(buff, u_key.ubuf, key_size);
+      for(i=0; i<DELTA_WORDS && n<(int)dh->nwords; i++)
+         if(map[i/32] & (1U<<(i%32)))
+            u_buff.w[i] = val[n++];
+   }
+   if(bta_crc32(buff, dh->size) != dh->crc)
+      return 3;
+   *seq = dh->keyseq;
+   *len = put_cs(buff, dh->size);
+   return 0;
+}
+
+/* subscriber with address `to` (or NULL) */
+static struct subscriber *find_subs(struct sockaddr_in *to) {
+   int i;
+   for(i=0; i<nsubs; i++)
+      if(subs[i].addr.sin_addr.s_addr == to->sin_addr.s_addr &&
+     subs[i].addr.sin_port == to->sin_port)
+     return &subs[i];
+   return NULL;
+}
+
+/* send packet to given address (with header if use_hdr);
+ * data packets to a subscriber (e.g. replies to its commands) continue
+ * its own sequence, so the receiver sees one sequence per sender */
+static int send_pkt(int sock, unsigned char *pkt, int len, struct sockaddr_in *to) {
+   static uint32_t seq = 0;
+   struct subscriber *s;
+   struct net_hdr h;
+   struct iovec iov[2];
+   struct msghdr mh;
+   if(!use_hdr)
+      return sendto(sock, pkt, len, 0, (struct sockaddr *)to, sizeof(*to));
+   if(sock == dsock && (s = find_subs(to)))   /* subs[] is main thread's only */
+      make_hdr(&h, ++s->seq);
+   else
+      make_hdr(&h, __atomic_add_fetch(&seq, 1, __ATOMIC_RELAXED)); /* also used by command thread */
+   iov[0].iov_base = &h;
+   iov[0].iov_len = sizeof(h);
+   iov[1].iov_base = pkt;
+   iov[1].iov_len = len;
+   memset(&mh, 0, sizeof(mh));
+   mh.msg_name = to;
+   mh.msg_namelen = sizeof(*to);
+   mh.msg_iov = iov;
+   mh.msg_iovlen = 2;
+   return sendmsg(sock, &mh, 0);
+}
+
+/* fill packet header with current time */
+static void make_hdr(struct net_hdr *h, uint32_t seq) {
+   struct timespec ts;
+   clock_gettime(CLOCK_REALTIME, &ts);
+   h->magic = NETHDR_MAGIC;
+   h->version = NETHDR_VER;
+   h->hlen = sizeof(*h);
+   h->seq = seq;
+   h->sec = ts.tv_sec;
+   h->nsec = ts.tv_nsec;
+}
+
+/* account header of packet from `from` host */
+static void peer_account(struct net_hdr *h) {
+   struct peer_stat *p = NULL;
+   struct timespec ts;
+   double lat;
+   uint32_t d;
+   int i;
+   time_t oldest = 0;
+   for(i=0; i<MAX_PEERS; i++) {
+      if(peers[i].npkt && peers[i].ip == from.sin_addr.s_addr) {
+         p = &peers[i];
+         break;
+      }
+      if(!p || peers[i].last_time < oldest) { /* the least recently used slot */
+         p = &peers[i];
+         oldest = p->last_time;
+      }
+   }
+   if(p->npkt == 0 || p->ip != from.sin_addr.s_addr) {
+      memset(p, 0, sizeof(*p));
+      p->ip = from.sin_addr.s_addr;
+   }
+   if(p->npkt == 0 || (h->seq < p->last_seq && p->last_seq - h->seq > 1000)) {
+      if(p->npkt) p->nrestart++;        /* sender restarted? */
+      p->last_seq = h->seq;
+      p->win = 1;
+   } else if(h->seq > p->last_seq) {
+      d = h->seq - p->last_seq;
+      p->nlost += d - 1;
+      p->win = (d < 64)? (p->win << d) | 1 : 1;
+      p->last_seq = h->seq;
+   } else {
+      d = p->last_seq - h->seq;
+      if(d < 64 && (p->win & (1ULL<<d)))
+         p->ndup++;
+      else {                             /* got late, counted as lost before */
+         if(d < 64) p->win |= 1ULL<<d;
+         p->nreord++;
+         if(p->nlost) p->nlost--;
       }
    }
+   clock_gettime(CLOCK_REALTIME, &ts);
+   lat = (ts.tv_sec - (time_t)h->sec)*1e3 + (ts.tv_nsec - (long)h->nsec)/1e6;
+   for(i=0; i<LAT_BINS-1 && lat>=lat_bin[i]; i++);
+   p->lat_hist[i]++;
+   if(p->npkt == 0 || lat < p->lat_min) p->lat_min = lat;
+   if(p->npkt == 0 || lat > p->lat_max) p->lat_max = lat;
+   p->lat_sum += lat;
+   p->npkt++;
+   p->last_time = ts.tv_sec;
 }
 
-/*     */
-static double prog_time() {
-   static double st=-1.;
-   struct timeval ct;
-   struct timezone tz;
-   gettimeofday(&ct, &tz);
-   if(st<0.) {
-      st = ct.tv_sec + ct.tv_usec/1e6;
-      return 0.;
-   } else
-      return (ct.tv_sec + ct.tv_usec/1e6 - st);
+/* remove header from received packet in buff, return payload length */
+static int strip_hdr(int len) {
+   struct net_hdr *h = (struct net_hdr *)buff;
+   if(len < (int)sizeof(struct net_hdr) || h->magic != NETHDR_MAGIC ||
+      h->hlen < sizeof(struct net_hdr) || h->hlen >= len) {
+      nohdr_pkts++;
+      return len;
+   }
+   peer_account(h);
+   len -= h->hlen;
+   memmove(buff, buff + h->hlen, len);
+   return len;
 }
 
-static void my_sleep(double dt)
-{
-  int nfd;
-  struct timeval tv;
-   tv.tv_sec = (int)dt;
-   tv.tv_usec = (int)((dt - tv.tv_sec)*1000000.);
-slipping:
-   nfd = select(0, (fd_set *)NULL,(fd_set *)NULL,(fd_set *)NULL, &tv);
-   if(nfd < 0) {
-      if(errno == EINTR)
-    /*On  Linux,  timeout  is  modified to reflect the amount of
-     time not slept; most other implementations DO NOT do this!*/
-     goto slipping;
-      fprintf(stderr,"Error in mydelay(){ select() }. %s\n",strerror(errno));
-   }
-}
-
-/*   tm    . ( ) M_time */
-static struct tm *get_localtime() {    /*  localtime() */
-    struct tm *tm;
-    time_t t,tt,mt;
+static void print_stats() {
+   int i, j, l;
+   struct in_addr a;
+   char hist[BTA_LOG_TEXTLEN];
+   bta_log(BTA_LOG_STDERR, "Packets statistics (without header: %lu):", nohdr_pkts);
+   for(i=0; i<MAX_PEERS; i++) {
+      struct peer_stat *p = &peers[i];
+      if(p->npkt == 0) continue;
+      a.s_addr = p->ip;
+      bta_log(BTA_LOG_STDERR, "%s: %lu packets, lost %lu, reordered %lu, duplicated %lu, restarts %lu",
+              inet_ntoa(a), p->npkt, p->nlost, p->nreord, p->ndup, p->nrestart);
+      bta_log(BTA_LOG_STDERR, "\tlatency (ms): min %.2f, mean %.2f, max %.2f",
+              p->lat_min, p->lat_sum/p->npkt, p->lat_max);
+      for(j=0, l=0; j<LAT_BINS-1 && l<(int)sizeof(hist); j++)
+         l += snprintf(hist+l, sizeof(hist)-l, "<%g:%lu ", lat_bin[j], p->lat_hist[j]);
+      bta_log(BTA_LOG_STDERR, "\t%s>=%g:%lu", hist, lat_bin[LAT_BINS-2], p->lat_hist[LAT_BINS-1]);
+   }
+}
+
+/*     */
+
+
+/*   tm    tt     . ( ) M_time */
+/* (     ) */
+static void get_localtime(time_t tt, struct tm *tm) {    /*  localtime() */
+    time_t t,mt;
     int dt;
     static int ott=0, omt=0;
 
-    time(&tt);
-    tm = localtime(&tt);
+    localtime_r(&tt, tm);
     tt -= timezone; /*difference between UTC and local standard time (in sec)*/
     mt = (int)M_time;
     if((mt!=omt && omt!=0) || (tt-ott)<10) {  /* M_time   ? */
@@ -627,25 +1264,12 @@ static struct tm *get_localtime() {    /* 
        if(dt>12*3600)  dt -= 24*3600;
        if(dt<-12*3600) dt += 24*3600;
        t=tt-dt+timezone;                 /* -    M_time */
-       tm = localtime(&t);
+       localtime_r(&t, tm);
     }
     if(mt!=omt) {
        if(omt!=0) ott=tt;   /*    M_time */
        omt=mt;
     }
-    return( tm );
-}
-/*    */
-static void log_message(char *text) {
-   static int mday=0, mon=0, year=0;
-   struct tm *tm = get_localtime();
-   if(tm->tm_mday!=mday || tm->tm_mon!=mon || tm->tm_year!=year) {
-      mday = tm->tm_mday;  mon = tm->tm_mon;  year = tm->tm_year;
-      printf("<======================================>\n");
-      printf(": %02d/%02d/%04d\n",mday,mon+1,1900+year);
-   }
-   printf("%02d:%02d:%02d %s\n",tm->tm_hour,tm->tm_min,tm->tm_sec,text);
-   fflush(stdout);
 }
 
 static void myabort(int sig) {
@@ -663,12 +1287,16 @@ static void myabort(int sig) {
     default:  sprintf(ss,"SIG_%d",sig); break;
     }
     switch (sig) {
+    case SIGUSR1:
+         dump_stats = 1;
+         signal(sig, myabort);
+         return;
     default:
     case SIGHUP :
+
     case SIGINT :
     case SIGPIPE:
-         fprintf(stderr,"%s: %s - Ignore .....\n",myname,ss);
-         fflush(stderr);
+         bta_log(BTA_LOG_STDERR, "%s: %s - Ignore .....",myname,ss);
          signal(sig, myabort);
          return;
     case SIGQUIT:
@@ -677,7 +1305,8 @@ static void myabort(int sig) {
     case SIGTERM:
          signal(SIGALRM, SIG_IGN);
          close_shm_block(&sdat);
-         fprintf(stderr,"%s: %s - programm stop!\n",myname,ss);
+         if(hist_len) close_shm_block(&shist);
+         bta_log(BTA_LOG_STDERR, "%s: %s - programm stop!",myname,ss);
          exit(sig);
     }
 }
@@ -0,0 +1,144 @@
+/*
+ * bta_fields.h - descriptor table of plain struct BTA_Data fields
+ *
+ * Common for jsonbta, bta_print, bta_archive and bta_print_header: JSON,
+ * key="value" and FITS exporters and the archive iterate the same table
+ * instead of hand-coding every field, so a field added here appears in all
+ * outputs.
+ * Derived values (modes, PA, J2000 coordinates, corrections) are still
+ * computed by exporters themselves.
+ *
+ * Include after bta_shdata.h.
+ */
+#pragma once
+#ifndef __BTA_FIELDS_H__
+#define __BTA_FIELDS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// how field value should be shown
+enum{
+     BTA_F_TIME = 0  // time in seconds: hh:mm:ss.ss
+    ,BTA_F_ANGLE     // angle in arcseconds: fmt for angle_fmt() or NULL for angle_asc()
+    ,BTA_F_VALUE     // double printed by printf-like fmt
+    ,BTA_F_CODE      // uint32_t printed by printf-like fmt
+};
+
+// output groups (same as jsonbta request parameters)
+enum{
+     BTA_G_MTIME = 0
+    ,BTA_G_SIDTIME
+    ,BTA_G_TELMODE
+    ,BTA_G_TELFOCUS
+    ,BTA_G_TARGET
+    ,BTA_G_P2MODE
+    ,BTA_G_EQCOOR
+    ,BTA_G_HORCOOR
+    ,BTA_G_VALSENS
+    ,BTA_G_DIFF
+    ,BTA_G_VEL
+    ,BTA_G_CORR
+    ,BTA_G_METEO
+    ,BTA_G_AMOUNT
+};
+#define BTA_GMASK(g)    (1U << (g))
+
+/*
+ * X(name, member, kind, unit, fmt, group, FITS key, FITS fmt, FITS comment)
+ *   name   - key for JSON and key="value" output
+ *   member - struct BTA_Data member
+ *   FITS key == NULL - don't write this field into FITS header;
+ *   FITS values of time/angle fields are degrees ("%.10f"), comment gets
+ *   sexagesimal representation appended
+ */
+#define BTA_FIELDS(X) \
+    X("code_KOST", kost,     BTA_F_CODE,  "",     "0x%04X",              BTA_G_P2MODE,   NULL,      NULL,    NULL) \
+    X("CurAlpha",  c_alpha,  BTA_F_TIME,  "s",    NULL,                  BTA_G_EQCOOR,   "RA_OBJ",  NULL,    "Current object R.A. (degr)") \
+    X("CurDelta",  c_delta,  BTA_F_ANGLE, "\"",   NULL,                  BTA_G_EQCOOR,   "DEC_OBJ", NULL,    "Current object Decl (degr)") \
+    X("SrcAlpha",  s_alpha,  BTA_F_TIME,  "s",    NULL,                  BTA_G_EQCOOR,   "RA_SRC",  NULL,    "Source R.A. (degr)") \
+    X("SrcDelta",  s_delta,  BTA_F_ANGLE, "\"",   NULL,                  BTA_G_EQCOOR,   "DEC_SRC", NULL,    "Source Decl (degr)") \
+    X("InpAlpha",  i_alpha,  BTA_F_TIME,  "s",    NULL,                  BTA_G_EQCOOR,   "RA_INP",  NULL,    "Input R.A. (degr)") \
+    X("InpDelta",  i_delta,  BTA_F_ANGLE, "\"",   NULL,                  BTA_G_EQCOOR,   "DEC_INP", NULL,    "Input Decl (degr)") \
+    X("TelAlpha",  val_alp,  BTA_F_TIME,  "s",    NULL,                  BTA_G_EQCOOR,   "RA",      NULL,    "Telescope R.A. (degr)") \
+    X("TelDelta",  val_del,  BTA_F_ANGLE, "\"",   NULL,                  BTA_G_EQCOOR,   "DEC",     NULL,    "Telescope Decl (degr)") \
+    X("InpAzim",   i_azim,   BTA_F_ANGLE, "\"",   "%c%03d:%02d:%04.1f",  BTA_G_HORCOOR,  "A_INP",   NULL,    "Input Az (degr)") \
+    X("InpZenD",   i_zdist,  BTA_F_ANGLE, "\"",   "%02d:%02d:%04.1f",    BTA_G_HORCOOR,  "Z_INP",   NULL,    "Input ZD (degr)") \
+    X("CurAzim",   tag_a,    BTA_F_ANGLE, "\"",   "%c%03d:%02d:%04.1f",  BTA_G_HORCOOR,  "A_OBJ",   NULL,    "Current object Az (degr)") \
+    X("CurZenD",   tag_z,    BTA_F_ANGLE, "\"",   "%02d:%02d:%04.1f",    BTA_G_HORCOOR,  "Z_OBJ",   NULL,    "Current object ZD (degr)") \
+    X("CurPA",     tag_p,    BTA_F_ANGLE, "\"",   "%03d:%02d:%04.1f",    BTA_G_HORCOOR,  "TAGANGLE", NULL,   "Target par. angle (degr)") \
+    X("ValAzim",   val_a,    BTA_F_ANGLE, "\"",   "%c%03d:%02d:%04.1f",  BTA_G_VALSENS,  "A",       NULL,    "Telescope Az (degr)") \
+    X("ValZenD",   val_z,    BTA_F_ANGLE, "\"",   "%02d:%02d:%04.1f",    BTA_G_VALSENS,  "Z",       NULL,    "Telescope ZD (degr)") \
+    X("ValP2",     val_p,    BTA_F_ANGLE, "\"",   "%03d:%02d:%04.1f",    BTA_G_VALSENS,  "ROTANGLE", NULL,   "Current P2 rot. angle (degr)") \
+    X("ValDome",   val_d,    BTA_F_ANGLE, "\"",   "%c%03d:%02d:%04.1f",  BTA_G_VALSENS,  "DOME_A",  NULL,    "Dome Az (degr)") \
+    X("DiffAzim",  diff_a,   BTA_F_ANGLE, "\"",   "%c%03d:%02d:%04.1f",  BTA_G_DIFF,     NULL,      NULL,    NULL) \
+    X("DiffZenD",  diff_z,   BTA_F_ANGLE, "\"",   "%c%02d:%02d:%04.1f",  BTA_G_DIFF,     NULL,      NULL,    NULL) \
+    X("DiffP2",    diff_p,   BTA_F_ANGLE, "\"",   "%c%03d:%02d:%04.1f",  BTA_G_DIFF,     NULL,      NULL,    NULL) \
+    X("VelAzim",   vel_a,    BTA_F_ANGLE, "\"/s", "%c%02d:%02d:%04.1f",  BTA_G_VEL,      NULL,      NULL,    NULL) \
+    X("VelZenD",   vel_z,    BTA_F_ANGLE, "\"/s", "%c%02d:%02d:%04.1f",  BTA_G_VEL,      NULL,      NULL,    NULL) \
+    X("VelP2",     vel_p,    BTA_F_ANGLE, "\"/s", "%c%02d:%02d:%04.1f",  BTA_G_VEL,      NULL,      NULL,    NULL) \
+    X("VelPA",     vbasep,   BTA_F_ANGLE, "\"/s", "%c%02d:%02d:%04.1f",  BTA_G_VEL,      NULL,      NULL,    NULL) \
+    X("VelDome",   vel_d,    BTA_F_ANGLE, "\"/s", "%c%02d:%02d:%04.1f",  BTA_G_VEL,      NULL,      NULL,    NULL) \
+    X("ValFoc",    val_f,    BTA_F_VALUE, "mm",   "%0.2f",               BTA_G_TELFOCUS, "VAL_F",   "%.2f",  "Focus value of telescope (mm)") \
+    X("ValTout",   val_t1,   BTA_F_VALUE, "degC", "%+05.1f",             BTA_G_METEO,    "OUTTEMP", "%.1f",  "Outern temperature (degC)") \
+    X("ValTind",   val_t2,   BTA_F_VALUE, "degC", "%+05.1f",             BTA_G_METEO,    "DOMETEMP", "%.1f", "In-dome temperature (degC)") \
+    X("ValTmir",   val_t3,   BTA_F_VALUE, "degC", "%+05.1f",             BTA_G_METEO,    "MIRRTEMP", "%.1f", "Mirror temperature (degC)") \
+    X("ValPres",   val_b,    BTA_F_VALUE, "mmHg", "%05.1f",              BTA_G_METEO,    "PRESSURE", "%.1f", "Atm. pressure (mmHg)") \
+    X("ValWind",   val_wnd,  BTA_F_VALUE, "m/s",  "%04.1f",              BTA_G_METEO,    "WIND",    "%.1f",  "Wind speed (m/s)") \
+    X("ValHumd",   val_hmd,  BTA_F_VALUE, "%",    "%04.1f",              BTA_G_METEO,    "HUMIDITY", "%.1f", "Relative humidity (%)") \
+    X("DUT1",      dut1,     BTA_F_VALUE, "s",    "%.4f",                BTA_G_MTIME,    "DUT1",    "%.10f", "DUT1 = UT1 - UTC")
+
+typedef struct{
+    const char *name;   // JSON/key=value name
+    size_t offset;      // offset in struct BTA_Data
+    size_t size;        // member size
+    int kind;           // BTA_F_xx
+    const char *unit;   // physical unit
+    const char *fmt;    // display format
+    int group;          // BTA_G_xx
+    const char *fkey;   // FITS keyword or NULL
+    const char *ffmt;   // FITS value format (NULL for degrees)
+    const char *fcmnt;  // FITS comment
+} BTA_Field;
+
+#define BTA_FIELD_DESCR(nm, memb, knd, un, fm, grp, fk, ffm, fc) \
+    {nm, offsetof(struct BTA_Data, memb), sizeof(((struct BTA_Data*)0)->memb), knd, un, fm, grp, fk, ffm, fc},
+static const BTA_Field bta_fields[] = {
+    BTA_FIELDS(BTA_FIELD_DESCR)
+};
+#undef BTA_FIELD_DESCR
+#define BTA_FIELDS_AMOUNT   (sizeof(bta_fields)/sizeof(bta_fields[0]))
+
+// iterate over all fields of group `g`
+#define FOREACH_BTA_FIELD(f, g) \
+    for(const BTA_Field *f = bta_fields; f < bta_fields + BTA_FIELDS_AMOUNT; ++f) \
+        if(f->group == (g))
+
+/**
+ * @brief bta_field_val - get numeric value of field
+ * @param f - field descriptor
+ * @param d - data block
+ * @return value (uint32_t codes are converted to double)
+ */
+static inline double bta_field_val(const BTA_Field *f, const volatile struct BTA_Data *d){
+    const volatile char *p = (const volatile char*)d + f->offset;
+    if(f->kind == BTA_F_CODE) return (double)*(const volatile uint32_t*)p;
+    return *(const volatile double*)p;
+}
+
+/**
+ * @brief bta_field_changed - check if field value differs in two data blocks
+ * @param f - field descriptor
+ * @param o - old data
+ * @param n - new data
+ * @return 1 if changed
+ */
+static inline int bta_field_changed(const BTA_Field *f, const volatile struct BTA_Data *o,
+                                    const volatile struct BTA_Data *n){
+    const volatile char *po = (const volatile char*)o + f->offset, *pn = (const volatile char*)n + f->offset;
+    for(size_t i = 0; i < f->size; ++i)
+        if(po[i] != pn[i]) return 1;
+    return 0;
+}
+
+#endif // __BTA_FIELDS_H__
@@ -0,0 +1,317 @@
+/*
+ * bta_log.c - asynchronous logger for realtime processes
+ *
+ * Each producer thread gets its own lock-free single-producer/single-consumer
+ * ring of fixed-size records (rings are statically allocated and touched in
+ * bta_log_init(), so call it before mlockall()); the ring is given back when
+ * its thread exits, so short-lived threads don't exhaust the pool. Producer
+ * just takes the timestamp and formats text with vsnprintf(); writer thread
+ * (SCHED_OTHER) polls rings every LOG_POLL seconds, converts time and writes
+ * messages.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <pthread.h>
+#include "bta_log.h"
+
+#define LOG_POLL 0.02           /* writer thread polling period, s */
+#define FLUSH_TMOUT 2.          /* max time to wait for writer in bta_log_flush() */
+
+struct bta_logrec {
+   struct timespec t;           /* time of message */
+   int32_t flags;               /* BTA_LOG_xx */
+   int32_t err;                 /* errno at the moment of call */
+   char text[BTA_LOG_TEXTLEN];
+};
+
+struct bta_logring {
+   uint32_t head;               /* next record to write (producer) */
+   uint32_t busy;               /* producer is inside bta_vlog() */
+   uint32_t owned;              /* ring is taken by some thread */
+   unsigned long lost;          /* messages dropped */
+   char pad1[64 - 3*sizeof(uint32_t) - sizeof(unsigned long)];
+   uint32_t tail;               /* next record to read (writer) */
+   char pad2[64 - sizeof(uint32_t)];
+   struct bta_logrec rec[BTA_LOG_RINGLEN];
+} __attribute__((aligned(64)));
+
+static struct bta_logring rings[BTA_LOG_RINGS];
+static unsigned long lost_noring = 0;   /* messages of threads without ring */
+static __thread struct bta_logring *myring = NULL;
+static pthread_key_t ringkey;           /* gives ring back on thread exit */
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_t writer;
+static volatile int running = 0;
+static char logpath[256] = "";
+static void (*time_fn)(time_t, struct tm *) = NULL;
+/* writer is the only consumer, mutex serializes flushes without it */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void drain();
+
+static void sleep_sec(double t) {
+   struct timespec ts;
+   ts.tv_sec = (time_t)t;
+   ts.tv_nsec = (long)((t - ts.tv_sec)*1e9);
+   nanosleep(&ts, NULL);
+}
+
+static void *writer_thread(void *arg) {
+   sigset_t ss;
+   (void)arg;
+   sigfillset(&ss);              /* signals are handled by other threads */
+   pthread_sigmask(SIG_BLOCK, &ss, NULL);
+   while (1) {
+      drain();
+      sleep_sec(LOG_POLL);
+   }
+   return NULL;
+}
+
+static void start_writer() {
+   pthread_attr_t attr;
+   struct sched_param sp;
+   /* don't inherit realtime policy of creating thread */
+   pthread_attr_init(&attr);
+   pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+   pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+   memset(&sp, 0, sizeof(sp));
+   pthread_attr_setschedparam(&attr, &sp);
+   running = (pthread_create(&writer, &attr, writer_thread, NULL) == 0);
+   pthread_attr_destroy(&attr);
+}
+
+/* messages logged before fork() are written by parent only */
+static void fork_prepare() {
+   bta_log_flush();
+   pthread_mutex_lock(&mutex);
+}
+
+static void fork_parent() {
+   pthread_mutex_unlock(&mutex);
+}
+
+/* there's no writer thread in child: discard alien records and start it again */
+static void fork_child() {
+   int i;
+   for(i=0; i<BTA_LOG_RINGS; i++) {
+      rings[i].tail = rings[i].head;
+      if(&rings[i] != myring)   /* other threads don't exist in child */
+         rings[i].owned = 0;
+   }
+   pthread_mutex_init(&mutex, NULL);
+   running = 0;
+   start_writer();
+}
+
+static void release_ring(void *arg) {
+   struct bta_logring *r = arg;
+   /* records left are still written by writer; next owner continues from head */
+   __atomic_store_n(&r->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void log_setup() {
+   memset(rings, 0, sizeof(rings));     /* prefault pages before mlockall() */
+   pthread_key_create(&ringkey, release_ring);
+   start_writer();
+   atexit(bta_log_flush);
+   pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+/*
+ * Start writer thread (if not yet) and set log file name (if not NULL)
+ * return 0 if OK or -1 if writer can't be started (messages are written
+ * synchronously then)
+ */
+int bta_log_init(const char *logfile) {
+   pthread_once(&once, log_setup);
+   if(logfile) {
+      if(strlen(logfile) >= sizeof(logpath))
+         return -1;
+      strcpy(logpath, logfile);
+   }
+   return running? 0 : -1;
+}
+
+/* set function converting message time for stdout & file (localtime_r() by default) */
+void bta_log_settime(void (*fn)(time_t t, struct tm *tm)) {
+   time_fn = fn;
+}
+
+/* take free ring (if any); thread without ring tries again on next message */
+static struct bta_logring *get_ring() {
+   uint32_t f;
+   int i;
+   if(myring)
+      return myring;
+   for(i=0; i<BTA_LOG_RINGS; i++) {
+      f = 0;
+      if(__atomic_compare_exchange_n(&rings[i].owned, &f, 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+         myring = &rings[i];
+         pthread_setspecific(ringkey, myring);
+         return myring;
+      }
+   }
+   return NULL;
+}
+
+void bta_vlog(int flags, const char *fmt, va_list ap) {
+   struct bta_logring *r;
+   struct bta_logrec *rec;
+   uint32_t head;
+   int err = errno;
+   pthread_once(&once, log_setup);
+   if(!(r = get_ring())) {
+      __atomic_add_fetch(&lost_noring, 1, __ATOMIC_RELAXED);
+      return;
+   }
+   if(r->busy) {        /* called by signal handler, record is being filled */
+      __atomic_add_fetch(&r->lost, 1, __ATOMIC_RELAXED);
+      return;
+   }
+   r->busy = 1;
+   __atomic_signal_fence(__ATOMIC_SEQ_CST);
+   head = r->head;
+   if(head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= BTA_LOG_RINGLEN) {
+      __atomic_add_fetch(&r->lost, 1, __ATOMIC_RELAXED);
+   } else {
+      rec = &r->rec[head & (BTA_LOG_RINGLEN-1)];
+      clock_gettime(CLOCK_REALTIME, &rec->t);
+      rec->flags = flags;
+      rec->err = err;
+      vsnprintf(rec->text, BTA_LOG_TEXTLEN, fmt, ap);
+      __atomic_store_n(&r->head, head+1, __ATOMIC_RELEASE);
+   }
+   __atomic_signal_fence(__ATOMIC_SEQ_CST);
+   r->busy = 0;
+   if(!running)
+      drain();
+   errno = err;
+}
+
+void bta_log(int flags, const char *fmt, ...) {
+   va_list ap;
+   va_start(ap, fmt);
+   bta_vlog(flags, fmt, ap);
+   va_end(ap);
+}
+
+/*
+ * Rate limiting of repeated messages: call it on every event of class `cls`
+ * (e.g. type of error, 0 - no error); returns 1 if message about it should
+ * be printed: class changed or `period` seconds passed since last report.
+ * State is common, so use it from one thread only.
+ */
+int bta_log_ratelimit(int cls, double period) {
+   static double last = 0.;
+   static int last_cls = 0;
+   struct timespec ts;
+   double now;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   now = ts.tv_sec + ts.tv_nsec/1e9;
+   if(cls != last_cls || now - last > period) {
+      last = now;
+      last_cls = cls;
+      return 1;
+   }
+   return 0;
+}
+
+/* total number of dropped messages */
+unsigned long bta_log_lost() {
+   unsigned long n = __atomic_load_n(&lost_noring, __ATOMIC_RELAXED);
+   int i;
+   for(i=0; i<BTA_LOG_RINGS; i++)
+      n += __atomic_load_n(&rings[i].lost, __ATOMIC_RELAXED);
+   return n;
+}
+
+static void put_rec(struct bta_logrec *r, FILE **lf) {
+   static int mday = 0, mon = 0, year = 0;
+   char tbuf[32], ebuf[160] = "";
+   struct tm tm;
+   size_t l = strlen(r->text);
+   if(l && r->text[l-1] == '\n')      /* we add newline by ourselves */
+      r->text[l-1] = 0;
+   memset(&tm, 0, sizeof(tm));
+   if(r->flags & BTA_LOG_ERRNO)
+      snprintf(ebuf, sizeof(ebuf), ": %s", strerror(r->err));
+   if(r->flags & (BTA_LOG_STDOUT|BTA_LOG_FILE)) {
+      if(time_fn) time_fn(r->t.tv_sec, &tm);
+      else localtime_r(&r->t.tv_sec, &tm);
+   }
+   if(r->flags & BTA_LOG_STDERR) {
+      if((r->flags & BTA_LOG_RED) && isatty(STDERR_FILENO))
+         fprintf(stderr, "\033[1;31m%s%s\033[0m\n", r->text, ebuf);
+      else
+         fprintf(stderr, "%s%s\n", r->text, ebuf);
+   }
+   if(r->flags & BTA_LOG_STDOUT) {
+      if(tm.tm_mday!=mday || tm.tm_mon!=mon || tm.tm_year!=year) {
+         mday = tm.tm_mday;  mon = tm.tm_mon;  year = tm.tm_year;
+         printf("<======================================>\n");
+         printf("Date: %02d/%02d/%04d\n", mday, mon+1, 1900+year);
+      }
+      printf("%02d:%02d:%02d %s%s\n", tm.tm_hour, tm.tm_min, tm.tm_sec, r->text, ebuf);
+   }
+   if((r->flags & BTA_LOG_FILE) && *logpath) {
+      if(!*lf && !(*lf = fopen(logpath, "a")))
+         return;
+      strftime(tbuf, sizeof(tbuf), "%Y/%m/%d-%H:%M:%S", &tm);
+      fprintf(*lf, "%s\t%s%s\n", tbuf, r->text, ebuf);
+   }
+}
+
+/* write out all records from rings */
+static void drain() {
+   static unsigned long reported = 0;
+   FILE *lf = NULL;
+   unsigned long lost;
+   uint32_t i, tail;
+   pthread_mutex_lock(&mutex);
+   for(i=0; i<BTA_LOG_RINGS; i++) {
+      struct bta_logring *r = &rings[i];
+      for(tail = r->tail; tail != __atomic_load_n(&r->head, __ATOMIC_ACQUIRE); tail++) {
+         put_rec(&r->rec[tail & (BTA_LOG_RINGLEN-1)], &lf);
+         __atomic_store_n(&r->tail, tail+1, __ATOMIC_RELEASE);
+      }
+   }
+   if((lost = bta_log_lost()) != reported) {
+      fprintf(stderr, "bta_log: %lu messages lost\n", lost - reported);
+      reported = lost;
+   }
+   if(lf) fclose(lf);
+   fflush(stdout);
+   fflush(stderr);
+   pthread_mutex_unlock(&mutex);
+}
+
+static int rings_empty() {
+   int i;
+   for(i=0; i<BTA_LOG_RINGS; i++)
+      if(__atomic_load_n(&rings[i].tail, __ATOMIC_ACQUIRE) !=
+         __atomic_load_n(&rings[i].head, __ATOMIC_ACQUIRE))
+         return 0;
+   return 1;
+}
+
+/* wait until all messages are written (or write them by itself) */
+void bta_log_flush() {
+   double t;
+   if(!running || pthread_equal(pthread_self(), writer)) {
+      drain();
+      return;
+   }
+   for(t = 0.; t < FLUSH_TMOUT && !rings_empty(); t += 0.001)
+      sleep_sec(0.001);
+   fflush(stdout);
+   fflush(stderr);
+}
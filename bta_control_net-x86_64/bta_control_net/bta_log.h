@@ -0,0 +1,38 @@
+/*
+ * bta_log.h - asynchronous logger for realtime processes
+ *
+ * Producers (any thread, even SCHED_FIFO one) only format the message into
+ * a preallocated record of their own single-producer ring; time conversion
+ * and all I/O (stdout, stderr, log file) are done by a low-priority writer
+ * thread. When a ring is full, the message is dropped and counted, the
+ * writer reports the number of lost messages later. A ring is released when
+ * its thread exits; messages of a thread that can't get one are dropped too.
+ */
+#ifndef __BTA_LOG_H__
+#define __BTA_LOG_H__
+
+#include <stdarg.h>
+#include <time.h>
+
+#define BTA_LOG_RINGS   4       /* max number of threads logging simultaneously */
+#define BTA_LOG_RINGLEN 256     /* records in each ring (power of 2) */
+#define BTA_LOG_TEXTLEN 232     /* max message length (with trailing zero) */
+
+/* message destinations and format flags */
+enum {
+   BTA_LOG_STDERR = 1,          /* plain message to stderr */
+   BTA_LOG_STDOUT = 2,          /* "HH:MM:SS message" to stdout (date line once a day) */
+   BTA_LOG_FILE   = 4,          /* "YYYY/MM/DD-HH:MM:SS\tmessage" to log file */
+   BTA_LOG_ERRNO  = 8,          /* append ": strerror(errno)" as perror() does */
+   BTA_LOG_RED    = 0x10        /* red text on stderr if it is a terminal */
+};
+
+int  bta_log_init(const char *logfile);
+void bta_log_settime(void (*fn)(time_t t, struct tm *tm));
+void bta_log(int flags, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void bta_vlog(int flags, const char *fmt, va_list ap);
+int  bta_log_ratelimit(int cls, double period);
+void bta_log_flush();
+unsigned long bta_log_lost();
+
+#endif // __BTA_LOG_H__
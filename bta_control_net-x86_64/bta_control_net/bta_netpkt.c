@@ -0,0 +1,20 @@
+/*
+ * bta_netpkt.c - helpers for bta_control_net data packets (see bta_netpkt.h)
+ */
+#include "bta_netpkt.h"
+
+/* CRC-32 (IEEE 802.3) of len bytes */
+uint32_t bta_crc32(const unsigned char *b, int len) {
+   static uint32_t tab[256];
+   uint32_t c;
+   int i, k;
+   if(!tab[1])
+      for(i=0; i<256; i++) {
+         for(c=i, k=0; k<8; k++)
+            c = (c&1)? 0xEDB88320U^(c>>1) : c>>1;
+         tab[i] = c;
+      }
+   for(c=0xFFFFFFFFU, i=0; i<len; i++)
+      c = tab[(c^b[i])&0xFF]^(c>>8);
+   return c^0xFFFFFFFFU;
+}
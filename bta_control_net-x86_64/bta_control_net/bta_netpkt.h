@@ -0,0 +1,54 @@
+/*
+ * bta_netpkt.h - formats of bta_control_net data packets
+ * (common for bta_control_net and programs reading its stream, e.g. bta_replay)
+ */
+#ifndef __BTA_NETPKT_H__
+#define __BTA_NETPKT_H__
+
+#include <stdint.h>
+#include "bta_shdata.h"
+
+/* Optional versioned header before data or command packet payload
+ * (payload itself and its checksum are the same as without header).
+ * Receivers understand packets both with and without header.
+ */
+#define NETHDR_MAGIC (0x68415442)       /* "BTAh" */
+#define NETHDR_VER   1
+struct net_hdr {
+    int32_t magic;
+    uint16_t version;   /* NETHDR_VER */
+    uint16_t hlen;      /* header length (payload starts after it) */
+    uint32_t seq;       /* sequence number of packet */
+    uint32_t sec;       /* send time (CLOCK_REALTIME) */
+    uint32_t nsec;
+};
+
+/* Delta packets: the sender transmits a full BTA_Data block (keyframe) every
+ * delta_n packets and only the words changed since the last keyframe in between.
+ * Packet layout (native byte order, as the full block):
+ *    struct delta_hdr
+ *    keyframe: BTA_Data block
+ *    delta:    uint32_t map[(size/4+31)/32]  - bitmap of changed words
+ *              uint32_t val[nwords]          - new values of these words
+ *    2 bytes of additive checksum (as for full packets)
+ * Deltas are relative to the keyframe with the same keyseq, so a lost delta
+ * packet doesn't break the following ones; a receiver without the right keyframe
+ * just waits for the next. Only keyframe packets become receiver's keyframe:
+ * plain full blocks (e.g. replies to commands) don't change sender's keyframe.
+ * crc is CRC-32 of the full block, receiver checks it after rebuilding.
+ */
+#define DELTA_MAGIC  (0x746c6453)       /* "Sdlt" */
+#define KEY_MAGIC    (0x79656b53)       /* "Skey" */
+#define DELTA_WORDS  ((int)(sizeof(struct BTA_Data)/4))
+#define DELTA_MAPLEN ((DELTA_WORDS+31)/32)
+struct delta_hdr {
+    int32_t magic;      /* DELTA_MAGIC or KEY_MAGIC */
+    int32_t size;       /* size of BTA_Data (the same as in keyframe) */
+    uint32_t keyseq;    /* sequence number of keyframe (this one or delta base) */
+    uint32_t crc;       /* CRC-32 of full block */
+    uint32_t nwords;    /* amount of changed words (0 for keyframe) */
+};
+
+uint32_t bta_crc32(const unsigned char *b, int len);
+
+#endif // __BTA_NETPKT_H__
@@ -1,5 +1,11 @@
 // (C) V.S. Shergin, SAO RAS
 #include <err.h>
+#include <sched.h>
+#include <time.h>
+#include <limits.h>
+#include <float.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 #include "bta_shdata.h"
 
 #pragma pack(push, 4)
@@ -28,6 +34,23 @@ static char msg[MSGLEN];
 #ifndef BTA_MODULE
 volatile struct BTA_Data *sdt;
 volatile struct BTA_Local *sdtl;
+volatile struct BTA_Sync *sdts;
+volatile struct BTA_History *sdth;
+
+static void bta_hist_init();
+static int bta_hist_check();
+
+// history ring: clients attach only header, real size is set by creator
+volatile struct SHM_Block shist = {
+    {"Shis"},
+    sizeof(struct BTA_History),
+    sizeof(struct BTA_History),0444,
+    SHM_RDONLY,
+    bta_hist_init,
+    bta_hist_check,
+    NULL,
+    ClientSide,-1,NULL
+};
 
 volatile struct SHM_Block sdat = {
     {"Sdat"},
@@ -50,6 +73,7 @@ uint32_t cmd_src_ip = 0;// next command source IP
 void bta_data_init() {
     sdt = (struct BTA_Data *)sdat.addr;
     sdtl = (struct BTA_Local *)(sdat.addr+sizeof(struct BTA_Data));
+    sdts = (struct BTA_Sync *)(sdat.addr+sizeof(struct BTA_Data)+sizeof(struct BTA_Local));
     if(sdat.side == ClientSide) {
         if(sdt->magic != sdat.key.code) {
             WARN("Wrong shared data (maybe server turned off)");
@@ -107,6 +131,38 @@ void bta_data_close() {
     }
 }
 
+static void bta_hist_init() {
+    int len = (shist.maxsize - (int)sizeof(struct BTA_History)) / (int)sizeof(struct BTA_HistRec);
+    sdth = (struct BTA_History *)shist.addr;
+    if(shist.side == ClientSide) {
+        if(!bta_hist_check())
+            WARN("Wrong history ring (maybe server turned off)");
+        return;
+    }
+    /* ServerSide: continue existing ring if it's the same */
+    if(bta_hist_check() && sdth->len == len) return;
+    memset(shist.addr, 0, sizeof(struct BTA_History));
+    sdth->len = len;
+    sdth->recsize = sizeof(struct BTA_HistRec);
+    sdth->magic = shist.key.code;
+}
+
+static int bta_hist_check() {
+    return (sdth && sdth->magic == shist.key.code && sdth->len > 0 &&
+        sdth->recsize == sizeof(struct BTA_HistRec));
+}
+
+/**
+ * Create (or attach existing) history ring for `len` records
+ */
+int bta_hist_create(int len) {
+    if(len < 2) len = BTA_HIST_LEN;
+    shist.size = shist.maxsize = sizeof(struct BTA_History) + len * sizeof(struct BTA_HistRec);
+    shist.mode |= 0200;
+    shist.atflag = 0;
+    return get_shm_block(&shist, ServerSide);
+}
+
 /**
  * Allocate shared memory segment
  */
@@ -197,6 +253,287 @@ int check_shm_block(volatile struct SHM_Block *sb) {
     else return(0);
 }
 
+/**
+ * Seqlock for BTA_Data: writer makes counter odd before update and even after it;
+ * readers copy data and retry if counter was odd or changed during copying.
+ * (old servers don't touch counter, so it stays zero and snapshot is a plain copy)
+ */
+void bta_write_begin() {
+    if(!sdts) return;
+    __atomic_store_n(&sdts->seq, sdts->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void bta_write_end() {
+    if(!sdts) return;
+    __atomic_store_n(&sdts->seq, sdts->seq + 1, __ATOMIC_RELEASE);
+    // publish new generation & wake up all waiting clients
+    __atomic_store_n(&sdts->gen, sdts->gen + 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &sdts->gen, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/**
+ * Make consistent copy of BTA_Data (from segment itself, so `sdt` may point to
+ * the copy: then all data macros will use it)
+ * @param dst - destination
+ * @return 0 if all OK or -1 if writer holds data too long (copy may be inconsistent)
+ */
+int bta_snapshot(struct BTA_Data *dst) {
+    uint32_t s1, s2;
+    int i;
+    if(!sdts) {
+        memcpy(dst, sdat.addr, sizeof(struct BTA_Data));
+        return 0;
+    }
+    for(i = 0; i < 1000; ++i) {
+        s1 = __atomic_load_n(&sdts->seq, __ATOMIC_ACQUIRE);
+        if(s1 & 1) { // writer is working
+            sched_yield();
+            continue;
+        }
+        memcpy(dst, sdat.addr, sizeof(struct BTA_Data));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(&sdts->seq, __ATOMIC_RELAXED);
+        if(s1 == s2) return 0;
+    }
+    memcpy(dst, sdat.addr, sizeof(struct BTA_Data));
+    return -1;
+}
+
+/**
+ * Current update generation (to wait for the next update)
+ */
+uint32_t bta_update_gen() {
+    if(!sdts) return 0;
+    return __atomic_load_n(&sdts->gen, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Wait for data update (generation change) no longer than timeout
+ * @param gen (io) - last known generation, will be changed to current
+ * @param timeout  - max waiting time, seconds
+ * @return 1 if data was updated, 0 if timed out (e.g. server doesn't publish generations)
+ */
+int bta_wait_update(uint32_t *gen, double timeout) {
+    struct timespec ts, t0, t;
+    uint32_t g;
+    double rest;
+    if(!sdts) {
+        usleep(timeout * 1e6);
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while(1) {
+        g = __atomic_load_n(&sdts->gen, __ATOMIC_ACQUIRE);
+        if(g != *gen) {
+            *gen = g;
+            return 1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        rest = timeout - (t.tv_sec - t0.tv_sec) - (t.tv_nsec - t0.tv_nsec)/1e9;
+        if(rest <= 0.) return 0;
+        ts.tv_sec = (time_t)rest;
+        ts.tv_nsec = (long)((rest - ts.tv_sec) * 1e9);
+        // shared (not private) futex: waiters and writer are different processes
+        syscall(SYS_futex, &sdts->gen, FUTEX_WAIT, g, &ts, NULL, 0);
+    }
+}
+
+/**
+ * Append data block `d` with time `t` to history ring (only one writer allowed)
+ */
+void bta_hist_append(struct BTA_Data *d, double t) {
+    volatile struct BTA_HistRec *r;
+    uint64_t idx;
+    if(!sdth || shist.side != ServerSide) return;
+    idx = sdth->head;
+    r = &sdth->rec[idx % sdth->len];
+    __atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    r->idx = idx;
+    r->time = t;
+    memcpy((void*)&r->data, d, sizeof(struct BTA_Data));
+    __atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&sdth->head, idx + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Number of records written (the next record will have this index)
+ */
+uint64_t bta_hist_head() {
+    if(!sdth || !bta_hist_check()) return 0;
+    return __atomic_load_n(&sdth->head, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Index of the oldest record in ring (it could be overwritten soon!)
+ */
+uint64_t bta_hist_oldest() {
+    uint64_t head = bta_hist_head();
+    if(!head || head < (uint64_t)sdth->len) return 0;
+    return head - sdth->len + 1; // last one may be written just now
+}
+
+/**
+ * Zero-copy access to record `idx`
+ * @param seq (o) - record's seqlock counter: check data with bta_hist_valid() after using
+ * @return pointer to record or NULL if there's no such record
+ */
+volatile struct BTA_HistRec *bta_hist_rec(uint64_t idx, uint32_t *seq) {
+    volatile struct BTA_HistRec *r;
+    if(idx >= bta_hist_head() || idx < bta_hist_oldest()) return NULL;
+    r = &sdth->rec[idx % sdth->len];
+    *seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+    if(*seq & 1) return NULL;
+    return r;
+}
+
+/**
+ * Check that record got by bta_hist_rec() wasn't overwritten while used
+ */
+int bta_hist_valid(volatile struct BTA_HistRec *r, uint64_t idx, uint32_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (r->idx == idx && __atomic_load_n(&r->seq, __ATOMIC_RELAXED) == seq);
+}
+
+/**
+ * Consistent copy of record `idx`
+ * @return 0 if OK, -1 if there's no such record (or it was overwritten)
+ */
+int bta_hist_copy(uint64_t idx, struct BTA_HistRec *dst) {
+    volatile struct BTA_HistRec *r;
+    uint32_t seq;
+    if(!(r = bta_hist_rec(idx, &seq))) return -1;
+    memcpy(dst, (void*)r, sizeof(struct BTA_HistRec));
+    if(!bta_hist_valid(r, idx, seq)) return -1;
+    return 0;
+}
+
+/**
+ * Read next record after cursor (at first call *cursor may be got by bta_hist_find()
+ * or bta_hist_head()); too old records are skipped
+ * @return 1 if got record, 0 if there's no new data
+ */
+int bta_hist_next(uint64_t *cursor, struct BTA_HistRec *dst) {
+    while(*cursor < bta_hist_head()) {
+        if(*cursor < bta_hist_oldest()) *cursor = bta_hist_oldest();
+        if(bta_hist_copy(*cursor, dst) == 0) {
+            ++*cursor;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Find index of the first record with time >= t (or head if there's no such)
+ */
+// time of record idx read under its seqlock; record overwritten by writer is older than any time
+static double hist_time(uint64_t idx) {
+    volatile struct BTA_HistRec *r;
+    uint32_t seq;
+    double t;
+    if(!(r = bta_hist_rec(idx, &seq))) return -DBL_MAX;
+    t = r->time;
+    if(!bta_hist_valid(r, idx, seq)) return -DBL_MAX;
+    return t;
+}
+uint64_t bta_hist_find(double t) {
+    uint64_t lo = bta_hist_oldest(), hi = bta_hist_head(), mid;
+    while(lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if(hist_time(mid) < t) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// pending command tickets (process-local, not thread-safe)
+static struct {
+    int state;          // BTA_TK_xx
+    bta_pred_t pred;    // completion predicate
+    void *arg;          // its argument
+    double deadline;    // CLOCK_MONOTONIC time of timeout
+} tickets[BTA_TICKETS];
+
+static double mono_time() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/**
+ * Register expectation of command effect; call it before sending command
+ * @param pred    - predicate: returns nonzero when data show that command took effect
+ * @param arg     - predicate argument (should live until ticket is closed)
+ * @param timeout - max time to wait, seconds
+ * @return ticket number or -1 if all tickets are in use
+ */
+int bta_ticket_open(bta_pred_t pred, void *arg, double timeout) {
+    int i;
+    if(!pred) return -1;
+    for(i = 0; i < BTA_TICKETS; ++i) {
+        if(tickets[i].state != BTA_TK_FREE) continue;
+        tickets[i].state = BTA_TK_WAIT;
+        tickets[i].pred = pred;
+        tickets[i].arg = arg;
+        tickets[i].deadline = mono_time() + timeout;
+        return i;
+    }
+    return -1;
+}
+
+int bta_ticket_state(int tk) {
+    if(tk < 0 || tk >= BTA_TICKETS) return BTA_TK_FREE;
+    return tickets[tk].state;
+}
+
+void bta_ticket_close(int tk) {
+    if(tk < 0 || tk >= BTA_TICKETS) return;
+    tickets[tk].state = BTA_TK_FREE;
+}
+
+/**
+ * Check all waiting tickets against data block `d` (e.g. fresh snapshot)
+ * @return amount of tickets still waiting
+ */
+int bta_tickets_check(const struct BTA_Data *d) {
+    int i, n = 0;
+    double t = mono_time();
+    for(i = 0; i < BTA_TICKETS; ++i) {
+        if(tickets[i].state != BTA_TK_WAIT) continue;
+        if(tickets[i].pred(d, tickets[i].arg)) tickets[i].state = BTA_TK_DONE;
+        else if(t >= tickets[i].deadline) tickets[i].state = BTA_TK_TIMEOUT;
+        else ++n;
+    }
+    return n;
+}
+
+/**
+ * Wait until all tickets are completed or timed out: tickets are checked on each data update
+ * @param timeout - max waiting time, seconds
+ * @return amount of tickets still waiting
+ */
+int bta_tickets_wait(double timeout) {
+    static struct BTA_Data snap;
+    uint32_t gen = bta_update_gen();
+    double t, next, end = mono_time() + timeout;
+    int i, n;
+    while(1) {
+        // inconsistent copy will be checked on next update
+        if(bta_snapshot(&snap) == 0 && bta_tickets_check(&snap) == 0) return 0;
+        next = end; // nearest ticket deadline
+        for(i = 0, n = 0; i < BTA_TICKETS; ++i) {
+            if(tickets[i].state != BTA_TK_WAIT) continue;
+            ++n;
+            if(tickets[i].deadline < next) next = tickets[i].deadline;
+        }
+        t = mono_time();
+        if(t >= end) return n;
+        bta_wait_update(&gen, next - t);
+    }
+}
+
 /**
  * Set access key in current channel
  */
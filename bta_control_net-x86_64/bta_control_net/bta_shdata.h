@@ -820,7 +820,40 @@ struct my_msgbuf {
     char mtext[100];  // message itself
 };
 
+/**
+ * Synchronization data (placed in Sdat segment after local data)
+ */
+struct BTA_Sync {
+    uint32_t seq;                // seqlock counter: odd while writer updates BTA_Data
+    uint32_t gen;                // update generation (futex word for waiting of updates)
+    uint32_t reserve[14];
+};
+
+/**
+ * History ring of last BTA_Data blocks (segment "Shis")
+ */
+#define BTA_HIST_LEN  12000        // default length: 10 minutes at 20Hz
+struct BTA_HistRec {
+    uint32_t seq;                // seqlock counter of record: odd while writing
+    uint32_t reserve;
+    uint64_t idx;                // record number (to check that it wasn't overwritten)
+    double   time;               // UNIX time of record
+    struct BTA_Data data;
+};
+struct BTA_History {
+    int32_t  magic;              // == shist.key.code
+    int32_t  len;                // amount of records in ring
+    int32_t  recsize;            // sizeof(struct BTA_HistRec)
+    int32_t  reserve;
+    uint64_t head;               // total number of records written (next is rec[head % len])
+    uint64_t reserve1[5];
+    struct BTA_HistRec rec[];
+};
+
 extern volatile struct BTA_Local *sdtl;
+extern volatile struct BTA_Sync *sdts;
+extern volatile struct SHM_Block shist;
+extern volatile struct BTA_History *sdth;
 extern int snd_id;
 extern int cmd_src_pid;
 extern uint32_t cmd_src_ip;
@@ -839,6 +872,37 @@ void get_cmd_queue(struct CMD_Queue *cq, int server);
 
 int check_shm_block(volatile struct SHM_Block *sb);
 
+void bta_write_begin();
+void bta_write_end();
+int bta_snapshot(struct BTA_Data *dst);
+uint32_t bta_update_gen();
+int bta_wait_update(uint32_t *gen, double timeout);
+
+int bta_hist_create(int len);
+void bta_hist_append(struct BTA_Data *d, double t);
+uint64_t bta_hist_head();
+uint64_t bta_hist_oldest();
+volatile struct BTA_HistRec *bta_hist_rec(uint64_t idx, uint32_t *seq);
+int bta_hist_valid(volatile struct BTA_HistRec *r, uint64_t idx, uint32_t seq);
+int bta_hist_copy(uint64_t idx, struct BTA_HistRec *dst);
+int bta_hist_next(uint64_t *cursor, struct BTA_HistRec *dst);
+uint64_t bta_hist_find(double t);
+
+// asynchronous commands: ticket is completed when predicate becomes true on fresh data
+typedef int (*bta_pred_t)(const struct BTA_Data *d, void *arg);
+#define BTA_TICKETS 16
+enum{
+     BTA_TK_FREE = 0 // unused ticket
+    ,BTA_TK_WAIT     // waiting for predicate
+    ,BTA_TK_DONE     // command took effect
+    ,BTA_TK_TIMEOUT  // no effect in given time
+};
+int bta_ticket_open(bta_pred_t pred, void *arg, double timeout);
+int bta_ticket_state(int tk);
+void bta_ticket_close(int tk);
+int bta_tickets_check(const struct BTA_Data *d);
+int bta_tickets_wait(double timeout);
+
 void encode_lev_passwd(char *passwd, int nlev, uint32_t *keylev, uint32_t *codlev);
 int find_lev_passwd(char *passwd, uint32_t *keylev, uint32_t *codlev);
 int check_lev_passwd(char *passwd);
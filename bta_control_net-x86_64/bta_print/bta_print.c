@@ -1,12 +1,22 @@
 
-/* Print some BTA NewACS data (or write  to file)
+/* Print some BTA NewACS data (or write  to files, FIFOs, sockets)
  * Usage:
- *         bta_print [time_step] [file_name]
+ *         bta_print [time_step] [sink ...]
  * Where:
  *         time_step - writing period in sec., >=1.0
  *                      <1.0 - once and exit (default)
- *         file_name - name of file to write to,
- *                      "-" - stdout (default)
+ *         sink      - [format:][type:]name, where
+ *                      format: kv - key="value" lines (default),
+ *                              json - object in one line,
+ *                              csv - row of values (header is written to
+ *                                    new files, FIFO readers & socket clients);
+ *                      type:   file - file rewritten with atomic rename (default),
+ *                              append - records are added to the end of file,
+ *                              fifo - named pipe (record is dropped if reader is absent or slow),
+ *                              unix - Unix socket server sending records to all clients;
+ *                      name:   "-" - stdout (default)
+ *         e.g. "bta_print 1 - json:/var/www/bta.json csv:append:/data/bta.csv"
+ * Data are taken from one snapshot per tick, each format is made once for all sinks.
  */
 #include <ctype.h>
 #include <stdio.h>
@@ -20,16 +30,20 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/times.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <stdarg.h>
 
 #include <crypt.h>
 
 //#define SHM_OLD_SIZE
 #include "bta_shdata.h"
+#include "bta_fields.h"
 
 static double time_step=0.0;
 
-static char *file_name = "-";
-
 char *time_asc(double t, char *lin)
 {
     int h, min;
@@ -91,6 +105,53 @@ char *angle_fmt(double a, char *format, char *lin)
     return lin;
 }
 
+/* text representation of table field */
+static char *field_asc(const BTA_Field *f, char *lin)
+{
+    double v = bta_field_val(f, sdt);
+    switch(f->kind) {
+       case BTA_F_TIME:
+      return time_asc(v, lin);
+       case BTA_F_ANGLE:
+      return f->fmt ? angle_fmt(v, (char*)f->fmt, lin) : angle_asc(v, lin);
+       case BTA_F_CODE:
+      sprintf(lin, f->fmt, (uint32_t)v);
+      return lin;
+       default:
+      sprintf(lin, f->fmt, v);
+      return lin;
+    }
+}
+
+/* pairs "key=value" of current snapshot: values are made once per tick */
+#define MAXPAIRS 128
+static struct {
+    const char *key;
+    char val[32];
+    int num;            /* value is a number (not quoted in JSON) */
+} pairs[MAXPAIRS];
+static int npairs = 0;
+
+static void add_pair(const char *key, int num, const char *val)
+{
+    size_t L = strlen(val);
+    if(npairs >= MAXPAIRS) return;
+    pairs[npairs].key = key;
+    if(L >= sizeof(pairs[0].val)) L = sizeof(pairs[0].val) - 1;
+    memcpy(pairs[npairs].val, val, L);
+    pairs[npairs].val[L] = 0;
+    pairs[npairs].num = num;
+    ++npairs;
+}
+
+/* add all table fields of given group */
+static void add_fields(int group)
+{
+    char lin[80];
+    FOREACH_BTA_FIELD(f, group)
+       add_pair(f->name, f->kind == BTA_F_VALUE, field_asc(f, lin));
+}
+
 #ifndef PI
 #define PI 3.14159265358979323846      /* pi */
 #endif
@@ -201,176 +262,413 @@ slipping:
    }
 }
 
-int main (int argc, char *argv[])
+/* collect all pairs of current snapshot */
+static void collect(int acs_bta)
 {
-    FILE *fd;
-    double last;
-    int i,acs_bta;
     char tmp[80], *value;
+    npairs = 0;
+    add_pair("ACS_BTA", 0, (acs_bta)? "On" : "Off");
+    /* Mean Solar Time */
+    add_pair("M_time", 0, time_asc(M_time+DUT1,tmp));
+    add_fields(BTA_G_MTIME);
+    /* Mean Sidereal Time */
+#ifdef EE_time
+    add_pair("S_time", 0, time_asc(S_time-EE_time,tmp));
+    sprintf(tmp,"%g",JDate);
+    add_pair("JDate", 1, tmp);
+#else
+    add_pair("S_time", 0, time_asc(S_time,tmp));
+#endif
+    if(!acs_bta || Tel_Hardware == Hard_Off) value = "Off";
+    else if(Tel_Mode != Automatic)   value = "Manual";
+    else {
+       switch (Sys_Mode) {
+          default:
+          case SysStop    :  value = "Stopping";  break;
+          case SysWait    :  value = "Waiting";   break;
+          case SysPointAZ :
+          case SysPointAD :  value = "Pointing";  break;
+          case SysTrkStop :
+          case SysTrkStart:
+          case SysTrkMove :
+          case SysTrkSeek :  value = "Seeking";   break;
+          case SysTrkOk   :  value = "Tracking";  break;
+          case SysTrkCorr :  value = "Correction";break;
+          case SysTest    :  value = "Testing";   break;
+       }
+    }
+    add_pair("Tel_Mode", 0, value);
+
+    switch (Tel_Focus) {
+       default:
+       case Prime    :  value = "Prime";     break;
+       case Nasmyth1 :  value = "Nasmyth1";  break;
+       case Nasmyth2 :  value = "Nasmyth2";  break;
+    }
+    add_pair("Tel_Focus", 0, value);
+
+    switch (Sys_Target) {
+       default:
+       case TagObject   :  value = "Object";   break;
+       case TagPosition :  value = "A/Z-Pos."; break;
+       case TagNest     :  value = "Nest";     break;
+       case TagZenith   :  value = "Zenith";   break;
+       case TagHorizon  :  value = "Horizon";  break;
+    }
+    add_pair("Tel_Taget", 0, value);
+
+    if(acs_bta && Tel_Hardware == Hard_On)
+       switch (P2_State) {
+          default:
+          case P2_Off   :  value = "Stop";    break;
+          case P2_On    :  value = "Track";   break;
+          case P2_Plus  :  value = "Move+";   break;
+          case P2_Minus :  value = "Move-";   break;
+       }
+    else value = "Off";
+    add_pair("P2_Mode", 0, value);
+    add_fields(BTA_G_P2MODE);
+
+    add_fields(BTA_G_EQCOOR);
+
+    add_fields(BTA_G_HORCOOR);
+    add_pair("SrcPA", 0, angle_fmt(calc_PA(SrcAlpha,SrcDelta,S_time),"%03d:%02d:%04.1f",tmp));
+    add_pair("InpPA", 0, angle_fmt(calc_PA(InpAlpha,InpDelta,S_time),"%03d:%02d:%04.1f",tmp));
+    add_pair("TelPA", 0, angle_fmt(calc_PA(val_Alp, val_Del, S_time),"%03d:%02d:%04.1f",tmp));
+
+    add_fields(BTA_G_VALSENS);
+
+    add_fields(BTA_G_DIFF);
+    add_pair("DiffDome", 0, angle_fmt(val_A-val_D,"%c%03d:%02d:%04.1f",tmp));
+
+    add_fields(BTA_G_VEL);
+
+    if(Sys_Mode==SysTrkSeek||Sys_Mode==SysTrkOk||Sys_Mode==SysTrkCorr) {
+       double curA,curZ,srcA,srcZ;
+       double corAlp,corDel,corA,corZ;
+       corAlp = CurAlpha-SrcAlpha;
+       corDel = CurDelta-SrcDelta;
+       if(corAlp >  23*3600.) corAlp -= 24*3600.;
+       if(corAlp < -23*3600.) corAlp += 24*3600.;
+       calc_AZ(SrcAlpha, SrcDelta, S_time, &srcA, &srcZ);
+       calc_AZ(CurAlpha, CurDelta, S_time, &curA, &curZ);
+       corA=curA-srcA;
+       corZ=curZ-srcZ;
+       add_pair("CorrAlpha", 0, angle_fmt(corAlp,"%c%01d:%02d:%05.2f",tmp));
+       add_pair("CorrDelta", 0, angle_fmt(corDel,"%c%01d:%02d:%04.1f",tmp));
+       add_pair("CorrAzim", 0, angle_fmt(corA,"%c%01d:%02d:%04.1f",tmp));
+       add_pair("CorrZenD", 0, angle_fmt(corZ,"%c%01d:%02d:%04.1f",tmp));
+    } else {
+       add_pair("CorrAlpha", 0, "+0:00:00.00");
+       add_pair("CorrDelta", 0, "+0:00:00.0");
+       add_pair("CorrAzim", 0, "+0:00:00.0");
+       add_pair("CorrZenD", 0, "+0:00:00.0");
+    }
+    add_fields(BTA_G_TELFOCUS);
+    add_fields(BTA_G_METEO);
+    if(Wnd10_time>0.1 && Wnd10_time<=M_time /*&& M_time-Wnd10_time<24*3600.*/) {
+       sprintf(tmp,"%.1f",(M_time-Wnd10_time)/60);
+       add_pair("Blast10", 1, tmp);
+       sprintf(tmp,"%.1f",(M_time-Wnd15_time)/60);
+       add_pair("Blast15", 1, tmp);
+    } else {
+       add_pair("Blast10", 0, " ");
+       add_pair("Blast15", 0, " ");
+    }
+    if(Precip_time>0.1 && Precip_time<=M_time /*&& M_time-Precip_time<24*3600.*/) {
+       sprintf(tmp,"%.1f",(M_time-Precip_time)/60);
+       add_pair("Precipt", 1, tmp);
+    } else
+       add_pair("Precipt", 0, " ");
+}
+
+/* output formats: each one is made once per tick if any sink uses it */
+enum { FMT_KV = 0, FMT_JSON, FMT_CSV, FMT_AMOUNT };
+static const char *fmt_names[FMT_AMOUNT] = { "kv", "json", "csv" };
+
+#define OUTBUFSZ 16384
+typedef struct {
+    char buf[OUTBUFSZ];
+    size_t len;
+} outbuf;
+static outbuf out[FMT_AMOUNT];
+static outbuf csv_hdr;              /* header line of CSV */
+static int fmt_used[FMT_AMOUNT];
+
+static void ob_printf(outbuf *ob, const char *fmt, ...)
+{
+    va_list ap;
+    int L;
+    if(ob->len >= OUTBUFSZ - 1) return;
+    va_start(ap, fmt);
+    L = vsnprintf(ob->buf + ob->len, OUTBUFSZ - ob->len, fmt, ap);
+    va_end(ap);
+    if(L < 0) return;
+    ob->len += L;
+    if(ob->len > OUTBUFSZ - 1) ob->len = OUTBUFSZ - 1; /* truncated */
+}
+
+/* CSV field: quoted if it has special symbols */
+static void csv_field(outbuf *ob, const char *v, int first)
+{
+    const char *p;
+    if(!first) ob_printf(ob, ",");
+    if(!*v || strpbrk(v, ",\" \n") == NULL) {
+       ob_printf(ob, "%s", v);
+       return;
+    }
+    ob_printf(ob, "\"");
+    for(p = v; *p; ++p)
+       ob_printf(ob, (*p == '"') ? "\"\"" : "%c", *p);
+    ob_printf(ob, "\"");
+}
 
-    if(argc>1) {
-       if(isdigit(argv[1][0])||argv[1][0]=='.') time_step=atof(argv[1]);
-       else file_name = argv[1];
-       if(argc>2) {
-      if(isdigit(argv[2][0])||argv[2][0]=='.') time_step=atof(argv[2]);
-      else file_name = argv[2];
+/* make records of all formats used */
+static void render()
+{
+    int i;
+    if(fmt_used[FMT_KV]) {
+       out[FMT_KV].len = 0;
+       for(i = 0; i < npairs; ++i)
+          ob_printf(&out[FMT_KV], "%s=\"%s\"\n", pairs[i].key, pairs[i].val);
+    }
+    if(fmt_used[FMT_JSON]) {
+       outbuf *ob = &out[FMT_JSON];
+       ob->len = 0;
+       ob_printf(ob, "{");
+       for(i = 0; i < npairs; ++i) {
+          const char *v = pairs[i].val;
+          char *e;
+          if(pairs[i].num && *v && (strtod(v, &e), *e == 0)) {
+             /* JSON numbers can't have leading '+' or zeros: "+05.0" -> "5.0" */
+             const char *sign = (*v == '-') ? "-" : "";
+             if(*v == '-' || *v == '+') ++v;
+             while(v[0] == '0' && isdigit(v[1])) ++v;
+             ob_printf(ob, "%s\"%s\": %s%s", i ? ", " : "", pairs[i].key, sign, v);
+          } else
+             ob_printf(ob, "%s\"%s\": \"%s\"", i ? ", " : "", pairs[i].key, v);
+       }
+       ob_printf(ob, "}\n");
+    }
+    if(fmt_used[FMT_CSV]) {
+       out[FMT_CSV].len = csv_hdr.len = 0;
+       for(i = 0; i < npairs; ++i) {
+          csv_field(&csv_hdr, pairs[i].key, !i);
+          csv_field(&out[FMT_CSV], pairs[i].val, !i);
        }
+       ob_printf(&csv_hdr, "\n");
+       ob_printf(&out[FMT_CSV], "\n");
     }
-    if(strcmp(file_name,"-")==0) {
-    fd = stdout;
-    } else if((fd=fopen(file_name,"w"))==NULL) {
-    fprintf(stderr,"Can't write BTA data to file: %s\n",file_name);
-    exit(1);
+}
+
+/* sinks */
+enum { SINK_STDOUT = 0, SINK_FILE, SINK_APPEND, SINK_FIFO, SINK_UNIX, SINK_AMOUNT };
+static const char *sink_names[SINK_AMOUNT] = { "-", "file", "append", "fifo", "unix" };
+
+#define MAXSINKS   16
+#define MAXCLIENTS 32
+typedef struct {
+    int fmt;                /* FMT_xx */
+    int type;               /* SINK_xx */
+    const char *name;
+    char tmpname[4096];     /* SINK_FILE: temporary file to rename */
+    int fd;                 /* SINK_APPEND, SINK_FIFO: file; SINK_UNIX: listening socket */
+    int need_hdr;           /* CSV header should be written before next record */
+    int cl[MAXCLIENTS];     /* SINK_UNIX: clients */
+    int cl_hdr[MAXCLIENTS]; /* CSV header should be sent to client */
+    int ncl;
+} sink_t;
+static sink_t sinks[MAXSINKS];
+static int nsinks = 0;
+
+/* write all data to non-blocking descriptor; -1 if it can't be done at once */
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while(len) {
+       ssize_t n = send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+       if(n < 0 && errno == ENOTSOCK) n = write(fd, buf, len);
+       if(n < 0) {
+          if(errno == EINTR) continue;
+          return -1;
+       }
+       buf += n;
+       len -= n;
     }
+    return 0;
+}
+
+/* parse sink description "[format:][type:]name" */
+static int add_sink(char *descr)
+{
+    sink_t *s;
+    char *p;
+    int i, found, fd, err = 0;
+    if(nsinks == MAXSINKS) {
+       fprintf(stderr,"Too many sinks (max %d)\n", MAXSINKS);
+       return -1;
+    }
+    s = &sinks[nsinks];
+    memset(s, 0, sizeof(sink_t));
+    s->fmt = FMT_KV;
+    s->type = SINK_FILE;
+    s->fd = -1;
+    do { /* prefixes */
+       found = 0;
+       if((p = strchr(descr, ':')) == NULL) break;
+       for(i = 0; i < FMT_AMOUNT; ++i)
+          if(strlen(fmt_names[i]) == (size_t)(p - descr) && strncmp(descr, fmt_names[i], p - descr) == 0) {
+             s->fmt = i;
+             found = 1;
+          }
+       for(i = SINK_FILE; i < SINK_AMOUNT; ++i)
+          if(strlen(sink_names[i]) == (size_t)(p - descr) && strncmp(descr, sink_names[i], p - descr) == 0) {
+             s->type = i;
+             found = 1;
+          }
+       if(found) descr = p + 1;
+    } while(found);
+    s->name = descr;
+    if(strcmp(descr, "-") == 0) s->type = SINK_STDOUT;
+    switch(s->type) {
+       case SINK_FILE: /* check that we can write there */
+          snprintf(s->tmpname, sizeof(s->tmpname), "%s.tmp", descr);
+          if((fd = open(s->tmpname, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) err = 1;
+          else {
+             close(fd);
+             unlink(s->tmpname);
+          }
+       break;
+       case SINK_APPEND: {
+          struct stat st;
+          if((s->fd = open(descr, O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644)) < 0) err = 1;
+          else s->need_hdr = (fstat(s->fd, &st) == 0 && st.st_size == 0);
+       }
+       break;
+       case SINK_FIFO: /* opened later, when reader appears */
+          if(mkfifo(descr, 0644) && errno != EEXIST) err = 1;
+       break;
+       case SINK_UNIX: {
+          struct sockaddr_un addr;
+          memset(&addr, 0, sizeof(addr));
+          addr.sun_family = AF_UNIX;
+          if(strlen(descr) >= sizeof(addr.sun_path)) {
+             errno = ENAMETOOLONG;
+             err = 1;
+             break;
+          }
+          strcpy(addr.sun_path, descr);
+          unlink(descr);
+          if((s->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 ||
+             bind(s->fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(s->fd, MAXCLIENTS))
+             err = 1;
+       }
+       break;
+    }
+    if(err) {
+       fprintf(stderr,"Can't write BTA data to %s: %s\n", descr, strerror(errno));
+       return -1;
+    }
+    fmt_used[s->fmt] = 1;
+    ++nsinks;
+    return 0;
+}
+
+/* send current records to sink */
+static void sink_write(sink_t *s)
+{
+    outbuf *ob = &out[s->fmt];
+    int csv = (s->fmt == FMT_CSV), i;
+    switch(s->type) {
+       case SINK_STDOUT:
+          if(csv && !s->need_hdr) fwrite(csv_hdr.buf, 1, csv_hdr.len, stdout);
+          s->need_hdr = 1; /* means "header is written" for stdout */
+          fwrite(ob->buf, 1, ob->len, stdout);
+          fflush(stdout);
+       break;
+       case SINK_FILE: /* readers see either old or new file */
+          if((s->fd = open(s->tmpname, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644)) < 0) {
+             fprintf(stderr,"Can't write BTA data to file: %s\n", s->tmpname);
+             break;
+          }
+          if((csv && write_all(s->fd, csv_hdr.buf, csv_hdr.len)) || write_all(s->fd, ob->buf, ob->len)) {
+             fprintf(stderr,"Can't write BTA data to file: %s\n", s->tmpname);
+             close(s->fd);
+             unlink(s->tmpname);
+          } else {
+             close(s->fd);
+             if(rename(s->tmpname, s->name))
+                fprintf(stderr,"Can't rename %s to %s\n", s->tmpname, s->name);
+          }
+          s->fd = -1;
+       break;
+       case SINK_APPEND:
+          if(csv && s->need_hdr && write_all(s->fd, csv_hdr.buf, csv_hdr.len) == 0) s->need_hdr = 0;
+          if(write_all(s->fd, ob->buf, ob->len))
+             fprintf(stderr,"Can't write BTA data to file: %s\n", s->name);
+       break;
+       case SINK_FIFO: /* records (< PIPE_BUF) are written atomically or dropped */
+          if(s->fd < 0) {
+             if((s->fd = open(s->name, O_WRONLY|O_NONBLOCK|O_CLOEXEC)) < 0) break; /* no readers */
+             s->need_hdr = csv;
+          }
+          if(s->need_hdr && write_all(s->fd, csv_hdr.buf, csv_hdr.len) == 0) s->need_hdr = 0;
+          if(s->need_hdr || write_all(s->fd, ob->buf, ob->len)) {
+             if(errno == EAGAIN) break; /* reader is slow: skip this record */
+             close(s->fd); /* reader closed FIFO */
+             s->fd = -1;
+          }
+       break;
+       case SINK_UNIX: {
+          int fd;
+          while(s->ncl < MAXCLIENTS && (fd = accept4(s->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+             s->cl_hdr[s->ncl] = csv;
+             s->cl[s->ncl++] = fd;
+          }
+          for(i = 0; i < s->ncl; ) {
+             /* client which can't get the whole record at once is disconnected */
+             if((s->cl_hdr[i] && write_all(s->cl[i], csv_hdr.buf, csv_hdr.len)) ||
+                write_all(s->cl[i], ob->buf, ob->len)) {
+                close(s->cl[i]);
+                s->cl[i] = s->cl[--s->ncl];
+                s->cl_hdr[i] = s->cl_hdr[s->ncl];
+                continue;
+             }
+             s->cl_hdr[i++] = 0;
+          }
+       }
+       break;
+    }
+}
+
+int main (int argc, char *argv[])
+{
+    double last;
+    int i,acs_bta;
+    static struct BTA_Data snap;
+    uint32_t gen;
+
+    for(i = 1; i < argc; ++i) {
+       if(isdigit(argv[i][0])||argv[i][0]=='.') time_step=atof(argv[i]);
+       else if(add_sink(argv[i])) exit(1);
+    }
+    if(!nsinks) add_sink("-");
+    signal(SIGPIPE, SIG_IGN);
     if(!get_shm_block( &sdat, ClientSide)) return 1;
+    bta_snapshot(&snap);
+    sdt = &snap;        /* all data below are read from consistent snapshot */
     last = M_time;
-    for(i=0;i<50 && fabs(M_time-last)<0.01; i++)
-       my_sleep(0.02);
+    gen = bta_update_gen();
+    for(i=0;i<10 && fabs(M_time-last)<0.01; i++) {  /* wait for data update (1s max) */
+       bta_wait_update(&gen, 0.1);
+       bta_snapshot(&snap);
+    }
 
     do {
-      if(fd != stdout)
-     if((fd=freopen(file_name,"w",fd))==NULL) {
-        fprintf(stderr,"Can't write BTA data to file: %s\n",file_name);
-        exit(1);
-     }
-
+      bta_snapshot(&snap);
       acs_bta = ( check_shm_block(&sdat) && fabs(M_time-last)>0.01);
-      value = (acs_bta)? "On" : "Off";
-      fprintf(fd,"ACS_BTA=\"%s\"\n",value);
-      /* Mean Solar Time */
-      fprintf(fd,"M_time=\"%s\"\n",time_asc(M_time+DUT1,tmp));
-      /* Mean Sidereal Time */
-#ifdef EE_time
-      fprintf(fd,"S_time=\"%s\"\n",time_asc(S_time-EE_time,tmp));
-      //fprintf(fd,"JDate=\"%13.5f\"\n",JDate);
-      fprintf(fd,"JDate=\"%g\"\n",JDate);
-#else
-      fprintf(fd,"S_time=\"%s\"\n",time_asc(S_time,tmp));
-#endif
-      if(!acs_bta || Tel_Hardware == Hard_Off) value = "Off";
-      else if(Tel_Mode != Automatic)   value = "Manual";
-      else {
-    switch (Sys_Mode) {
-      default:
-      case SysStop    :  value = "Stopping";  break;
-      case SysWait    :  value = "Waiting";   break;
-      case SysPointAZ :
-      case SysPointAD :  value = "Pointing";  break;
-      case SysTrkStop :
-      case SysTrkStart:
-      case SysTrkMove :
-      case SysTrkSeek :  value = "Seeking";   break;
-      case SysTrkOk   :  value = "Tracking";  break;
-      case SysTrkCorr :  value = "Correction";break;
-      case SysTest    :  value = "Testing";   break;
-    }
-      }
-      fprintf(fd,"Tel_Mode=\"%s\"\n",value);
-
-      switch (Tel_Focus) {
-    default:
-    case Prime    :  value = "Prime";     break;
-    case Nasmyth1 :  value = "Nasmyth1";  break;
-    case Nasmyth2 :  value = "Nasmyth2";  break;
-      }
-      fprintf(fd,"Tel_Focus=\"%s\"\n",value);
-
-      switch (Sys_Target) {
-    default:
-    case TagObject   :  value = "Object";   break;
-    case TagPosition :  value = "A/Z-Pos."; break;
-    case TagNest     :  value = "Nest";     break;
-    case TagZenith   :  value = "Zenith";   break;
-    case TagHorizon  :  value = "Horizon";  break;
-      }
-      fprintf(fd,"Tel_Taget=\"%s\"\n",value);
-
-      if(acs_bta && Tel_Hardware == Hard_On)
-    switch (P2_State) {
-      default:
-      case P2_Off   :  value = "Stop";    break;
-      case P2_On    :  value = "Track";   break;
-      case P2_Plus  :  value = "Move+";   break;
-      case P2_Minus :  value = "Move-";   break;
-    }
-      else value = "Off";
-      fprintf(fd,"P2_Mode=\"%s\"\n",value);
-      fprintf(fd,"code_KOST=\"0x%04X\"\n",code_KOST);
-
-      fprintf(fd,"CurAlpha=\"%s\"\n", time_asc(CurAlpha,tmp));
-      fprintf(fd,"CurDelta=\"%s\"\n",angle_asc(CurDelta,tmp));
-      fprintf(fd,"SrcAlpha=\"%s\"\n", time_asc(SrcAlpha,tmp));
-      fprintf(fd,"SrcDelta=\"%s\"\n",angle_asc(SrcDelta,tmp));
-      fprintf(fd,"InpAlpha=\"%s\"\n", time_asc(InpAlpha,tmp));
-      fprintf(fd,"InpDelta=\"%s\"\n",angle_asc(InpDelta,tmp));
-      fprintf(fd,"TelAlpha=\"%s\"\n", time_asc(val_Alp,tmp));
-      fprintf(fd,"TelDelta=\"%s\"\n",angle_asc(val_Del,tmp));
-
-      fprintf(fd,"InpAzim=\"%s\"\n",angle_fmt(InpAzim,"%c%03d:%02d:%04.1f",tmp));
-      fprintf(fd,"InpZenD=\"%s\"\n",angle_fmt(InpZdist,"%02d:%02d:%04.1f",tmp));
-      fprintf(fd,"CurAzim=\"%s\"\n",angle_fmt(tag_A,"%c%03d:%02d:%04.1f",tmp));
-      fprintf(fd,"CurZenD=\"%s\"\n",angle_fmt(tag_Z,"%02d:%02d:%04.1f",tmp));
-      fprintf(fd,"CurPA=\"%s\"\n",angle_fmt(tag_P,"%03d:%02d:%04.1f",tmp));
-      fprintf(fd,"SrcPA=\"%s\"\n",angle_fmt(calc_PA(SrcAlpha,SrcDelta,S_time),"%03d:%02d:%04.1f",tmp));
-      fprintf(fd,"InpPA=\"%s\"\n",angle_fmt(calc_PA(InpAlpha,InpDelta,S_time),"%03d:%02d:%04.1f",tmp));
-      fprintf(fd,"TelPA=\"%s\"\n",angle_fmt(calc_PA(val_Alp, val_Del, S_time),"%03d:%02d:%04.1f",tmp));
-
-      fprintf(fd,"ValAzim=\"%s\"\n",angle_fmt(val_A,"%c%03d:%02d:%04.1f",tmp));
-      fprintf(fd,"ValZenD=\"%s\"\n",angle_fmt(val_Z,"%02d:%02d:%04.1f",tmp));
-      fprintf(fd,"ValP2=\"%s\"\n",angle_fmt(val_P,"%03d:%02d:%04.1f",tmp));
-      fprintf(fd,"ValDome=\"%s\"\n", angle_fmt(val_D,"%c%03d:%02d:%04.1f",tmp));
-
-      fprintf(fd,"DiffAzim=\"%s\"\n",angle_fmt(Diff_A,"%c%03d:%02d:%04.1f",tmp));
-      fprintf(fd,"DiffZenD=\"%s\"\n",angle_fmt(Diff_Z,"%c%02d:%02d:%04.1f",tmp));
-      fprintf(fd,"DiffP2=\"%s\"\n",angle_fmt(Diff_P,"%c%03d:%02d:%04.1f",tmp));
-      fprintf(fd,"DiffDome=\"%s\"\n",angle_fmt(val_A-val_D,"%c%03d:%02d:%04.1f",tmp));
-
-      fprintf(fd,"VelAzim=\"%s\"\n",angle_fmt(vel_A,"%c%02d:%02d:%04.1f",tmp));
-      fprintf(fd,"VelZenD=\"%s\"\n",angle_fmt(vel_Z,"%c%02d:%02d:%04.1f",tmp));
-      fprintf(fd,"VelP2=\"%s\"\n",angle_fmt(vel_P,"%c%02d:%02d:%04.1f",tmp));
-      fprintf(fd,"VelPA=\"%s\"\n",angle_fmt(vel_objP,"%c%02d:%02d:%04.1f",tmp));
-      fprintf(fd,"VelDome=\"%s\"\n",angle_fmt(vel_D,"%c%02d:%02d:%04.1f",tmp));
-
-      if(Sys_Mode==SysTrkSeek||Sys_Mode==SysTrkOk||Sys_Mode==SysTrkCorr) {
-    double curA,curZ,srcA,srcZ;
-    double corAlp,corDel,corA,corZ;
-    corAlp = CurAlpha-SrcAlpha;
-    corDel = CurDelta-SrcDelta;
-    if(corAlp >  23*3600.) corAlp -= 24*3600.;
-    if(corAlp < -23*3600.) corAlp += 24*3600.;
-    calc_AZ(SrcAlpha, SrcDelta, S_time, &srcA, &srcZ);
-    calc_AZ(CurAlpha, CurDelta, S_time, &curA, &curZ);
-    corA=curA-srcA;
-    corZ=curZ-srcZ;
-    fprintf(fd,"CorrAlpha=\"%s\"\n",angle_fmt(corAlp,"%c%01d:%02d:%05.2f",tmp));
-    fprintf(fd,"CorrDelta=\"%s\"\n",angle_fmt(corDel,"%c%01d:%02d:%04.1f",tmp));
-    fprintf(fd,"CorrAzim=\"%s\"\n",angle_fmt(corA,"%c%01d:%02d:%04.1f",tmp));
-    fprintf(fd,"CorrZenD=\"%s\"\n",angle_fmt(corZ,"%c%01d:%02d:%04.1f",tmp));
-      } else {
-    fprintf(fd,"CorrAlpha=\"+0:00:00.00\"\n");
-    fprintf(fd,"CorrDelta=\"+0:00:00.0\"\n");
-    fprintf(fd,"CorrAzim=\"+0:00:00.0\"\n");
-    fprintf(fd,"CorrZenD=\"+0:00:00.0\"\n");
-      }
-      fprintf(fd,"ValFoc=\"%0.2f\"\n",val_F);
-      fprintf(fd,"ValTout=\"%+05.1f\"\n",val_T1);
-      fprintf(fd,"ValTind=\"%+05.1f\"\n",val_T2);
-      fprintf(fd,"ValTmir=\"%+05.1f\"\n",val_T3);
-      fprintf(fd,"ValPres=\"%05.1f\"\n",val_B);
-      fprintf(fd,"ValWind=\"%04.1f\"\n",val_Wnd);
-      if(Wnd10_time>0.1 && Wnd10_time<=M_time /*&& M_time-Wnd10_time<24*3600.*/) {
-    fprintf(fd,"Blast10=\"%.1f\"\n",(M_time-Wnd10_time)/60);
-    fprintf(fd,"Blast15=\"%.1f\"\n",(M_time-Wnd15_time)/60);
-      } else {
-    fprintf(fd,"Blast10=\" \"\n");
-    fprintf(fd,"Blast15=\" \"\n");
-      }
-      fprintf(fd,"ValHumd=\"%04.1f\"\n",val_Hmd);
-      if(Precip_time>0.1 && Precip_time<=M_time /*&& M_time-Precip_time<24*3600.*/)
-    fprintf(fd,"Precipt=\"%.1f\"\n",(M_time-Precip_time)/60);
-      else
-    fprintf(fd,"Precipt=\" \"\n");
-      fflush(fd);
+      collect(acs_bta);
+      render();
+      for(i = 0; i < nsinks; ++i) sink_write(&sinks[i]);
 
       last = M_time;
       if(time_step>0.9) my_sleep(time_step);
@@ -0,0 +1,381 @@
+/* Capture and replay of ACS data stream (bta_control_net data packets)
+ * Usage:
+ *    bta_replay rec file [ACS_host[:mcast_addr]]
+ *          - append all datagrams got on data port to file
+ *    bta_replay play file [speed=N|max] [loop] [shm|local|mcast[:mcast_addr][/ttl]|host]
+ *          - re-emit recorded datagrams to local network (default - "local"
+ *            broadcast) or write them into local "Sdat" segment ("shm")
+ *
+ * File: struct rec_fhdr, then records (struct rec_hdr + datagram, padded to 8 bytes);
+ * records are only appended, so the file can be read (mmap'ed) during recording.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "bta_shdata.h"
+#include "bta_netpkt.h"
+
+#define REC_MAGIC   (0x63655242)        /* "BRec" */
+#define REC_VER     1
+#define REC_ALIGN(l) (((l)+7) & ~7)
+#define MAXPKT      4100
+
+struct rec_fhdr {
+    uint32_t magic;
+    uint32_t version;   /* REC_VER */
+    uint32_t hlen;      /* this header length (first record offset) */
+    uint16_t dport;     /* data port of recorded stream */
+    uint16_t reserve;
+    double start;       /* recording start time (CLOCK_REALTIME) */
+    uint32_t reserve1[10];
+};
+
+struct rec_hdr {
+    double t;           /* receive time (CLOCK_REALTIME) */
+    uint32_t src_ip;    /* sender address (network order) */
+    uint16_t src_port;
+    uint16_t len;       /* datagram length */
+};
+
+static int dport = 7655;
+const char *mask_sao = "255.255.224.0";
+const char *mcast_base = "239.0.0.0";
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int sig) {
+   (void)sig;
+   stop = 1;
+}
+
+static double real_time() {
+   struct timespec ts;
+   clock_gettime(CLOCK_REALTIME, &ts);
+   return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static void usage(char *name) {
+   fprintf(stderr, "Usage:\n");
+   fprintf(stderr, "\t%s rec file [ACS_host[:mcast_addr]]\n", name);
+   fprintf(stderr, "\t%s play file [speed=N|max] [loop] [shm|local|mcast[:mcast_addr][/ttl]|host]\n", name);
+   fprintf(stderr, "\"rec\" - append all datagrams from data port %d to file (host gives multicast group to join);\n", dport);
+   fprintf(stderr, "\"play\" - send recorded datagrams with original timing (N times faster or without delays);\n");
+   fprintf(stderr, "\"shm\" - don't send, but write data blocks into local shared memory (as bta_control_net does)\n");
+   exit(1);
+}
+
+/* multicast group of ACS host `host` ("host[:group]"), as bta_control_net chooses it */
+static int mcast_group(char *host, struct in_addr *grp) {
+   struct hostent *h;
+   struct in_addr maskSAO;
+   in_addr_t ip;
+   char *mga = strchr(host, ':');
+   if(mga) {
+      *mga++ = '\0';
+      if(inet_aton(mga, grp) && atoi(mga) >= 224 && atoi(mga) <= 239)
+         return 0;
+      fprintf(stderr, "Trying wrong multicast group address:%s?!\n", mga);
+   }
+   if((ip = inet_addr(host)) == INADDR_NONE) {
+      if(!(h = gethostbyname(host))) {
+         fprintf(stderr, "%s: unknown host\n", host);
+         return -1;
+      }
+      ip = *(in_addr_t *)h->h_addr;
+   }
+   inet_aton(mcast_base, grp);
+   inet_aton(mask_sao, &maskSAO);
+   grp->s_addr = (grp->s_addr & maskSAO.s_addr) | (ip & ~maskSAO.s_addr);
+   return 0;
+}
+
+static int record(char *fname, char *host) {
+   static unsigned char pkt[MAXPKT];
+   static const unsigned char pad[8];
+   struct sockaddr_in addr, from;
+   socklen_t fromlen;
+   struct rec_fhdr fh;
+   struct rec_hdr rh;
+   struct iovec iov[3];
+   struct stat st;
+   unsigned long npkt = 0;
+   int sock, fd, len, on = 1;
+
+   if((fd = open(fname, O_WRONLY|O_CREAT|O_APPEND, 0644)) < 0 || fstat(fd, &st) < 0) {
+      perror(fname);
+      return 1;
+   }
+   if(st.st_size == 0) {
+      memset(&fh, 0, sizeof(fh));
+      fh.magic = REC_MAGIC;
+      fh.version = REC_VER;
+      fh.hlen = sizeof(fh);
+      fh.dport = dport;
+      fh.start = real_time();
+      if(write(fd, &fh, sizeof(fh)) != sizeof(fh)) {
+         perror("writing file header");
+         return 1;
+      }
+   }
+   if((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+      perror("opening data socket");
+      return 1;
+   }
+   /* may be run on the same host with bta_control_net */
+   setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(dport);
+   addr.sin_addr.s_addr = INADDR_ANY;
+   if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      perror("binding data socket");
+      return 1;
+   }
+   if(host) {
+      struct ip_mreq mr;
+      if(mcast_group(host, &mr.imr_multiaddr))
+         return 1;
+      mr.imr_interface.s_addr = htonl(INADDR_ANY);
+      if(setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mr, sizeof(mr)) < 0)
+         perror("Joining multicast group");
+      else
+         fprintf(stderr, "Join multicast group %s\n", inet_ntoa(mr.imr_multiaddr));
+   }
+   iov[0].iov_base = &rh;
+   iov[0].iov_len = sizeof(rh);
+   iov[1].iov_base = pkt;
+   iov[2].iov_base = (void *)pad;
+   while(!stop) {
+      fromlen = sizeof(from);
+      if((len = recvfrom(sock, pkt, sizeof(pkt), 0, (struct sockaddr *)&from, &fromlen)) < 0) {
+         if(errno != EINTR)
+            perror("receiving UDP packet");
+         continue;
+      }
+      rh.t = real_time();
+      rh.src_ip = from.sin_addr.s_addr;
+      rh.src_port = ntohs(from.sin_port);
+      rh.len = len;
+      iov[1].iov_len = len;
+      iov[2].iov_len = REC_ALIGN(len) - len;
+      if(writev(fd, iov, 3) != (ssize_t)(sizeof(rh) + REC_ALIGN(len))) {
+         perror("writing record");
+         break;
+      }
+      npkt++;
+   }
+   fprintf(stderr, "%lu packets recorded\n", npkt);
+   close(fd);
+   return 0;
+}
+
+/* Decode data packet into full BTA_Data block (like bta_control_net receiver does):
+ * only keyframe packets (KEY_MAGIC) become the keyframe, deltas are applied to the
+ * keyframe with the same keyseq and the rebuilt block is checked by its CRC
+ * return block size or 0 if packet isn't good (or it's delta without keyframe) */
+static int decode_pkt(unsigned char *pkt, int len, unsigned char *out) {
+   static union {
+      unsigned char b[MAXPKT];
+      uint32_t w[MAXPKT/4];
+   } key, d;
+   static int key_size = 0;
+   static uint32_t key_seq = 0;
+   struct net_hdr *nh = (struct net_hdr *)pkt;
+   struct delta_hdr *dh = (struct delta_hdr *)d.b;
+   struct BTA_Data *pb = (struct BTA_Data *)out;
+   uint16_t cs;
+   int i, n;
+
+   if(len >= (int)sizeof(*nh) && nh->magic == NETHDR_MAGIC && nh->hlen >= sizeof(*nh) && nh->hlen < len) {
+      pkt += nh->hlen;
+      len -= nh->hlen;
+   }
+   if(len <= 2 || len > MAXPKT)
+      return 0;
+   memcpy(d.b, pkt, len);
+   len -= 2;
+   for(i = 0, cs = 0; i < len; i++)
+      cs += d.b[i];
+   if(memcmp(&cs, d.b+len, 2))
+      return 0;
+   if(len >= (int)sizeof(*dh) && (dh->magic == KEY_MAGIC || dh->magic == DELTA_MAGIC)) {
+      if(dh->size != DELTA_WORDS*4)
+         return 0;
+      if(dh->magic == KEY_MAGIC) {
+         if(len != (int)sizeof(*dh) + dh->size)
+            return 0;
+         memcpy(out, d.b+sizeof(*dh), dh->size);
+      } else {
+         uint32_t *map = d.w + sizeof(*dh)/4, *val = map + DELTA_MAPLEN;
+         if(len < (int)(sizeof(*dh) + DELTA_MAPLEN*sizeof(uint32_t)) ||
+            dh->nwords > (uint32_t)DELTA_WORDS ||
+            len != (int)((unsigned char *)(val + dh->nwords) - d.b))
+            return 0;
+         if(key_size != dh->size || dh->keyseq != key_seq)
+            return 0;
+         memcpy(out, key.b, key_size);
+         for(i = 0, n = 0; i < DELTA_WORDS && n < (int)dh->nwords; i++)
+            if(map[i/32] & (1U<<(i%32)))
+               ((uint32_t *)out)[i] = val[n++];
+      }
+      if(bta_crc32(out, dh->size) != dh->crc)
+         return 0;
+      if(dh->magic == KEY_MAGIC) {
+         memcpy(key.b, out, dh->size);
+         key_size = dh->size;
+         key_seq = dh->keyseq;
+      }
+      return dh->size;
+   }
+   /* plain full block (e.g. stream without deltas or reply to command) */
+   memcpy(out, d.b, len);
+   if(pb->magic != sdat.key.code || pb->version != BTA_Data_Ver || pb->size != (int)sizeof(struct BTA_Data))
+      return 0;
+   return pb->size;
+}
+
+static int play(char *fname, double speed, int loop, char *dest) {
+   static unsigned char blk[MAXPKT];
+   struct sockaddr_in to;
+   struct rec_fhdr *fh;
+   struct rec_hdr *rh;
+   struct stat st;
+   struct timespec t0, tn;
+   unsigned char *map;
+   double tfirst = 0.;
+   unsigned long npkt = 0, nbad = 0;
+   size_t off;
+   int fd, sock = -1, to_shm = 0, on = 1;
+
+   if((fd = open(fname, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+      perror(fname);
+      return 1;
+   }
+   if(st.st_size < (off_t)sizeof(*fh) ||
+      (map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+      fprintf(stderr, "%s: empty or can't be mapped\n", fname);
+      return 1;
+   }
+   fh = (struct rec_fhdr *)map;
+   if(fh->magic != REC_MAGIC || fh->version != REC_VER || fh->hlen < sizeof(*fh)) {
+      fprintf(stderr, "%s: not a bta_replay record\n", fname);
+      return 1;
+   }
+   memset(&to, 0, sizeof(to));
+   to.sin_family = AF_INET;
+   to.sin_port = htons(fh->dport ? fh->dport : dport);
+   if(strcmp(dest, "shm") == 0) {
+      to_shm = 1;
+      sdat.mode |= 0200;
+      sdat.atflag = 0;
+      if(!get_shm_block(&sdat, ServerSide))
+         return 1;
+      ServPID = getpid();
+   } else {
+      if((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+         perror("opening data socket");
+         return 1;
+      }
+      if(strcmp(dest, "local") == 0) {
+         setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+         to.sin_addr.s_addr = htonl(INADDR_LOOPBACK | 0xff); /* 127.0.0.255 */
+      } else if(strncmp(dest, "mcast", 5) == 0) {
+         unsigned char ttl = 1;
+         char *p;
+         if((p = strchr(dest, '/'))) {
+            ttl = atoi(p+1);
+            *p = '\0';
+         }
+         if(!(p = strchr(dest, ':')) || !inet_aton(p+1, &to.sin_addr))
+            inet_aton("239.0.0.1", &to.sin_addr);   /* joined by receivers of 127.0.0.1 */
+         setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+         setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &on, sizeof(on));
+      } else if(!inet_aton(dest, &to.sin_addr)) {
+         fprintf(stderr, "%s: wrong destination\n", dest);
+         return 1;
+      }
+      fprintf(stderr, "Replay to %s:%d\n", inet_ntoa(to.sin_addr), ntohs(to.sin_port));
+   }
+   do {
+      clock_gettime(CLOCK_MONOTONIC, &t0);
+      for(off = fh->hlen; !stop && off + sizeof(*rh) <= (size_t)st.st_size; off += sizeof(*rh) + REC_ALIGN(rh->len)) {
+         rh = (struct rec_hdr *)(map + off);
+         if(off + sizeof(*rh) + rh->len > (size_t)st.st_size)
+            break;              /* record is being written now */
+         if(off == fh->hlen)
+            tfirst = rh->t;
+         if(speed > 0.) {        /* wait for the moment of this packet */
+            double dt = (rh->t - tfirst) / speed;
+            tn.tv_sec = t0.tv_sec + (time_t)dt;
+            tn.tv_nsec = t0.tv_nsec + (long)((dt - (time_t)dt)*1e9);
+            if(tn.tv_nsec >= 1000000000L) {
+               tn.tv_sec++;
+               tn.tv_nsec -= 1000000000L;
+            }
+            while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tn, NULL) == EINTR && !stop);
+         }
+         if(to_shm) {
+            int size = decode_pkt(map + off + sizeof(*rh), rh->len, blk);
+            if(size > 0) {
+               bta_write_begin();
+               memcpy(sdat.addr, blk, size);
+               bta_write_end();
+            } else
+               nbad++;
+         } else if(sendto(sock, map + off + sizeof(*rh), rh->len, 0, (struct sockaddr *)&to, sizeof(to)) < 0)
+            perror("sending UDP packet");
+         npkt++;
+      }
+   } while(loop && !stop);
+   fprintf(stderr, "%lu packets replayed", npkt);
+   if(to_shm)
+      fprintf(stderr, " (%lu not written: bad or delta without keyframe)", nbad);
+   fprintf(stderr, "\n");
+   if(to_shm)
+      close_shm_block(&sdat);
+   munmap(map, st.st_size);
+   close(fd);
+   return 0;
+}
+
+int main(int argc, char *argv[]) {
+   struct sigaction sa;
+   double speed = 1.;
+   int i, loop = 0;
+   char *dest = "local";
+
+   if(argc < 3)
+      usage(argv[0]);
+   memset(&sa, 0, sizeof(sa));
+   sa.sa_handler = on_signal;    /* without SA_RESTART: break blocking recvfrom() */
+   sigaction(SIGINT, &sa, NULL);
+   sigaction(SIGTERM, &sa, NULL);
+   sigaction(SIGHUP, &sa, NULL);
+   if(strcmp(argv[1], "rec") == 0)
+      return record(argv[2], argc > 3 ? argv[3] : NULL);
+   if(strcmp(argv[1], "play"))
+      usage(argv[0]);
+   for(i = 3; i < argc; i++) {
+      if(strncmp(argv[i], "speed=", 6) == 0) {
+         speed = (strcmp(argv[i]+6, "max") == 0) ? 0. : atof(argv[i]+6);
+         if(speed < 0.) speed = 0.;
+      } else if(strcmp(argv[i], "loop") == 0)
+         loop = 1;
+      else
+         dest = argv[i];
+   }
+   return play(argv[2], speed, loop, dest);
+}
@@ -0,0 +1,560 @@
+/* Simulator of BTA ACS: creates "Sdat" segment and command queues as the real
+ * control system does, and updates data block by simple telescope model:
+ * pointing/tracking of object by RA/Decl or going to A/Z position (with velocity
+ * and acceleration limits of axes), P2 rotator, focus, dome and slowly drifting
+ * meteo values. Commands got from Mcmd/Ocmd/Ucmd queues change model state.
+ * Usage:
+ *    bta_sim [rate=Hz] [cycle=sec] [seed=N] [hist[=N]] [stop] [verbose]
+ *       rate    - data update rate (default 20Hz, up to some kHz)
+ *       cycle   - repoint to new random object every `cycle` seconds
+ *       seed    - seed of random generator (the same seed gives the same meteo & objects)
+ *       hist    - keep last N data blocks in shared history ring
+ *       stop    - don't point to first object at start
+ *       verbose - print got commands
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+
+#include "bta_shdata.h"
+
+#ifndef PI
+#define PI 3.14159265358979323846      /* pi */
+#endif
+
+#define S2R PI/648000.  /* sec. to rad. */
+#define R2S 648000./PI  /* rad. to sec  */
+#define S360 1296000.   /* sec in 360degr */
+#define S180  648000.   /* sec in 180degr */
+
+static const double longitude = 149189.175;   /* SAO longitude 41 26 29.175 (-2:45:45.945)*/
+static const double cos_fi = 0.7235272793;    /* Cos of SAO latitude     */
+static const double sin_fi = 0.6902957888;    /* Sin  ---  ""  -----     */
+
+/* axes limits: max velocity (''/s) & acceleration (''/s^2) */
+#define VMAX_A   3600.
+#define VMAX_Z   1800.
+#define VMAX_P   1800.
+#define VMAX_D   1800.
+#define AMAX_A   600.
+#define AMAX_Z   300.
+#define AMAX_P   300.
+#define AMAX_D   200.
+#define ZLIM     (85.*3600.)  /* max zenith distance */
+#define ZMIN     (5.*3600.)   /* min zenith distance for random objects */
+#define PNT_OK   10.          /* pointing is over when coordinates difference less than this */
+
+static volatile sig_atomic_t stop = 0;
+static struct BTA_Data model;  /* model state (sdt points here, segment is updated by copying) */
+static int verbose = 0;
+static uint64_t rnd_state = 88172645463325252ULL;
+static double foc_end = 0., dome_end = 0.;  /* time of focus/dome moving end */
+static double corr_A = 0., corr_Z = 0.;     /* user A/Z corrections */
+static double prev_A = 0., prev_Z = 0., prev_P = 0.; /* previous target position (for its velocity) */
+static int have_prev = 0;
+
+static void on_signal(int sig) {
+   (void)sig;
+   stop = 1;
+}
+
+static double real_time() {
+   struct timespec ts;
+   clock_gettime(CLOCK_REALTIME, &ts);
+   return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/* xorshift64*: reproducible on every host (unlike random()) */
+static double rnd_uniform() {
+   rnd_state ^= rnd_state >> 12;
+   rnd_state ^= rnd_state << 25;
+   rnd_state ^= rnd_state >> 27;
+   return ((rnd_state * 2685821657736338717ULL) >> 11) / 9007199254740992.;
+}
+
+static double rnd_gauss() {
+   double u = rnd_uniform();
+   if(u < 1e-300) u = 1e-300;
+   return sqrt(-2.*log(u)) * cos(2.*PI*rnd_uniform());
+}
+
+static double wrap(double a, double range) {
+   a = fmod(a, range);
+   if(a < 0.) a += range;
+   return a;
+}
+
+/* alpha/delta (time seconds/arcseconds) -> A/Z & parallactic angle (arcseconds) */
+static void calc_AZP(double alpha, double delta, double stime, double *az, double *zd, double *pa) {
+   double t = wrap((stime - alpha) * 15., S360) * S2R, d = delta * S2R;
+   double sin_t = sin(t), cos_t = cos(t), sin_d = sin(d), cos_d = cos(d);
+   double cos_z = cos_fi * cos_d * cos_t + sin_fi * sin_d;
+   if(cos_z > 1.) cos_z = 1.;
+   *zd = acos(cos_z) * R2S;
+   *az = atan2(cos_d * sin_t, cos_d * sin_fi * cos_t - cos_fi * sin_d) * R2S;
+   *pa = wrap(atan2(sin_t * cos_fi, sin_fi * cos_d - sin_d * cos_fi * cos_t) * R2S, S360);
+}
+
+/* A/Z -> alpha/delta */
+static void calc_AD(double az, double zd, double stime, double *alpha, double *delta) {
+   double a = az * S2R, z = zd * S2R;
+   double sin_z = sin(z), cos_z = cos(z), sin_a = sin(a), cos_a = cos(a);
+   double t = atan2(sin_z * sin_a, cos_a * sin_fi * sin_z + cos_fi * cos_z);
+   *delta = asin(sin_fi * cos_z - cos_fi * cos_a * sin_z) * R2S;
+   *alpha = wrap(stime - t * R2S / 15., S360/15.);
+}
+
+/**
+ * Move axis to target with limited velocity & acceleration
+ * @param pos  (io) - position
+ * @param vel  (io) - velocity
+ * @param tag  - target position
+ * @param vtag - target velocity
+ * @param range - period of coordinate (0 if no wrapping; caller normalizes position)
+ * @return distance to target
+ */
+static double drive(double *pos, double *vel, double tag, double vtag, double vmax, double amax,
+                    double range, double dt) {
+   double err = tag - *pos, vd, lim, k = (dt > 0.25) ? 0.5/dt : 2.;
+   if(range > 0.)
+      err = wrap(err + range/2., range) - range/2.;
+   lim = sqrt(2. * amax * fabs(err));   /* braking curve */
+   if(lim > vmax) lim = vmax;
+   vd = err * k;
+   if(vd > lim) vd = lim;
+   else if(vd < -lim) vd = -lim;
+   vd += vtag;
+   if(vd - *vel > amax*dt) vd = *vel + amax*dt;
+   else if(vd - *vel < -amax*dt) vd = *vel - amax*dt;
+   *vel = vd;
+   *pos += vd * dt;
+   return fabs(err);
+}
+
+static void stop_axis(double *pos, double *vel, double amax, double dt) {
+   double dv = amax * dt;
+   if(fabs(*vel) <= dv) *vel = 0.;
+   else *vel -= (*vel > 0.) ? dv : -dv;
+   *pos += *vel * dt;
+}
+
+/* Ornstein-Uhlenbeck random process: relaxation to `mean` with time `tau` */
+static double drift(double val, double mean, double sigma, double tau, double dt) {
+   return val + (mean - val) * dt / tau + sigma * sqrt(2. * dt / tau) * rnd_gauss();
+}
+
+static void sys_message(int type, const char *text) {
+   static int seq = 0;
+   int i;
+   for(i = MesgNum-1; i > 0; i--)
+      Sys_Mesg(i) = Sys_Mesg(i-1);
+   Sys_Mesg(0).seq_num = ++seq;
+   Sys_Mesg(0).type = type;
+   strncpy((char *)Sys_Mesg(0).text, text, MesgLen-1);
+   Sys_Mesg(0).text[MesgLen-1] = 0;
+   if(verbose)
+      fprintf(stderr, "Message: %s\n", text);
+}
+
+/* start pointing to target (Sys_Target) */
+static void start_pointing() {
+   if(Sys_Target == TagObject) {
+      CurAlpha = SrcAlpha = InpAlpha;
+      CurDelta = SrcDelta = InpDelta;
+      Sys_Mode = SysPointAD;
+   } else
+      Sys_Mode = SysPointAZ;
+   corr_A = corr_Z = 0.;
+   have_prev = 0;
+   Tel_State = Req_State = Pointing;
+}
+
+/* choose random object above horizon */
+static void random_object() {
+   double a, z, p;
+   do {
+      InpAlpha = rnd_uniform() * 86400.;
+      InpDelta = (asin(2.*rnd_uniform() - 1.) * R2S);
+      calc_AZP(InpAlpha, InpDelta, S_time, &a, &z, &p);
+   } while(z < ZMIN || z > ZLIM - 10.*3600.);
+   Sys_Target = TagObject;
+   start_pointing();
+}
+
+#define ARG(type, off) ({type _v; memcpy(&_v, m->mtext + (off), sizeof(type)); _v;})
+/* apply command from queue */
+static void do_command(struct my_msgbuf *m, int len, const char *qname) {
+   char buf[MesgLen];
+   if(verbose)
+      fprintf(stderr, "%s: command %d (%d bytes) from pid %u\n", qname, m->mtype, len, m->src_pid);
+   switch(m->mtype) {
+      case StopTel:
+         Tel_State = Req_State = Stopping;
+         Sys_Mode = SysStop;
+      break;
+      case StartTel:
+      case GoToAD:
+      case MoveToAD:
+         Sys_Target = TagObject;
+         start_pointing();
+      break;
+      case GoToAZ:
+         Sys_Target = TagPosition;
+         start_pointing();
+      break;
+      case SetTmr:     ClockType = ARG(int32_t, 0);  break;
+      case SetModMod:  UseModel = ARG(int32_t, 0);   break;
+      case SetAD:
+         InpAlpha = ARG(double, 0);
+         InpDelta = ARG(double, 8);
+      break;
+      case SetAZ:
+         InpAzim = ARG(double, 0);
+         InpZdist = ARG(double, 8);
+      break;
+      case SetModP:
+         P2_Mode = ARG(int32_t, 0);
+         P2_State = (P2_Mode == P2_On) ? P2_On : P2_Off;
+      break;
+      case P2Move:
+         P2_State = ARG(int32_t, 0);
+         if(P2_State > P2_Plus) P2_State = P2_Plus;
+         if(P2_State < P2_Minus) P2_State = P2_Minus;
+      break;
+      case FocMove:
+         Foc_State = ARG(int32_t, 0);
+         if(Foc_State > Foc_Hplus || Foc_State < Foc_Hminus) Foc_State = Foc_Off;
+         foc_end = M_time + ARG(double, 4);
+      break;
+      case UsePCorr:   Pos_Corr = ARG(int32_t, 0);   break;
+      case SetTrkFlags: TrkOk_Mode = ARG(int32_t, 0); break;
+      case SetTFoc:    Tel_Focus = ARG(int32_t, 0);  break;
+      case SetVAD:
+         VelAlpha = ARG(double, 0);
+         VelDelta = ARG(double, 8);
+      break;
+      case SetRevA:    Az_Mode = ARG(int32_t, 0);    break;
+      case SetTarg:    Sys_Target = ARG(int32_t, 0); break;
+      case SendMsg:
+         snprintf(buf, sizeof(buf), "%.*s", len > 0 ? len : 0, m->mtext);
+         sys_message(MesgInfor, buf);
+      break;
+      case CorrAD:
+         CurAlpha += ARG(double, 0);
+         CurDelta += ARG(double, 8);
+      break;
+      case CorrAZ:
+         corr_A += ARG(double, 0);
+         corr_Z += ARG(double, 8);
+      break;
+      case SetTMod:    Tel_Mode = ARG(int32_t, 0);   break;
+      case TelOn:      Tel_Hardware = Hard_On;       break;
+      case SetModD:
+         Dome_State = ARG(int32_t, 0);
+         dome_end = 0.;
+      break;
+      case DomeMove:
+         Dome_State = ARG(int32_t, 0);
+         if(Dome_State > D_Hplus || Dome_State < D_Hminus) Dome_State = D_Off;
+         dome_end = M_time + ARG(double, 4);
+      break;
+      case SetMet: {
+         int32_t id = ARG(int32_t, 0);
+         double v = ARG(double, 4);
+         switch(id) {
+            case INPUT_B:   inp_B = v;   break;
+            case INPUT_T1:  inp_T1 = v;  break;
+            case INPUT_T2:  inp_T2 = v;  break;
+            case INPUT_T3:  inp_T3 = v;  break;
+            case INPUT_WND: inp_Wnd = v; break;
+            case INPUT_HMD: sdt->inp_hmd = v; break;
+            default: id = 0;
+         }
+         MeteoMode |= id;
+      }
+      break;
+      case TurnMetOff: MeteoMode &= ~ARG(int32_t, 0); break;
+      case SetDUT1:    DUT1 = ARG(double, 0);        break;
+      case SetPM:
+         polarX = ARG(double, 0);
+         polarY = ARG(double, 8);
+      break;
+      case SetLocks:   LockFlags |= ARG(uint32_t, 0);  break;
+      case ClearLocks: LockFlags &= ~ARG(uint32_t, 0); break;
+      case NullCom:
+      break;
+      default:
+         if(verbose)
+            fprintf(stderr, "\tcommand %d isn't simulated\n", m->mtype);
+   }
+}
+#undef ARG
+
+static void read_commands() {
+   static struct CMD_Queue *q[3] = {&mcmd, &ocmd, &ucmd};
+   struct my_msgbuf mbuf;
+   int i, len;
+   for(i = 0; i < 3; i++) {
+      if(q[i]->id < 0) continue;
+      while((len = msgrcv(q[i]->id, (struct msgbuf *)&mbuf, 112, 0, IPC_NOWAIT)) > 0)
+         do_command(&mbuf, len - 12, q[i]->key.name);
+   }
+}
+
+/* set times for UNIX time `t` */
+static void model_time(double t) {
+   double jd = t / 86400. + 2440587.5, gmst;
+   JDate = jd;
+   M_time = wrap(t, 86400.);
+   L_time = wrap(t + 3.*3600., 86400.);        /* Moscow time */
+   gmst = 67310.54841 + (876600.*3600. + 8640184.812866) * (jd + DUT1/86400. - 2451545.) / 36525.;
+   S_time = wrap(gmst + longitude/15. + EE_time, 86400.);
+}
+
+static void model_meteo(double dt) {
+   double tday = -2. + 5. * sin(2.*PI*(M_time - 9.*3600.)/86400.); /* max at 15h */
+   val_T1 = drift(val_T1, tday, 0.3, 600., dt);
+   val_T2 = drift(val_T2, val_T1 + 2., 0.05, 3600., dt);
+   val_T3 = drift(val_T3, val_T2, 0.02, 3.*3600., dt);
+   val_B = drift(val_B, 595., 3., 86400., dt);
+   val_Wnd = fabs(drift(val_Wnd, 4., 2., 60., dt));
+   val_Hmd = drift(val_Hmd, 50., 15., 1800., dt);
+   if(val_Hmd < 5.) val_Hmd = 5.;
+   if(val_Hmd > 100.) val_Hmd = 100.;
+   if(val_Wnd > 10.) Wnd10_time = M_time;
+   if(val_Wnd > 15.) Wnd15_time = M_time;
+   /* hand input replaces sensors */
+   if(MeteoMode & INPUT_B)   val_B = inp_B;
+   if(MeteoMode & INPUT_T1)  val_T1 = inp_T1;
+   if(MeteoMode & INPUT_T2)  val_T2 = inp_T2;
+   if(MeteoMode & INPUT_T3)  val_T3 = inp_T3;
+   if(MeteoMode & INPUT_WND) val_Wnd = inp_Wnd;
+   if(MeteoMode & INPUT_HMD) val_Hmd = sdt->inp_hmd;
+   Temper = val_T1;
+   Pressure = val_B;
+}
+
+static void model_step(double t, double dt) {
+   double tA, tZ, tP, vA = 0., vZ = 0., vP = 0., d;
+   model_time(t);
+   model_meteo(dt);
+   /* target position */
+   if(Sys_Target == TagObject) {
+      CurAlpha = wrap(CurAlpha + VelAlpha*dt, 86400.);
+      CurDelta += VelDelta*dt;
+      calc_AZP(CurAlpha, CurDelta, S_time, &tA, &tZ, &tP);
+   } else {
+      tA = InpAzim;
+      tZ = InpZdist;
+      tP = tag_P;
+   }
+   tA += corr_A;
+   tZ += corr_Z;
+   if(have_prev && dt > 0.) {
+      vA = (wrap(tA - prev_A + S180, S360) - S180) / dt;
+      vZ = (tZ - prev_Z) / dt;
+      vP = (wrap(tP - prev_P + S180, S360) - S180) / dt;
+   }
+   prev_A = tA; prev_Z = tZ; prev_P = tP;
+   have_prev = 1;
+   tag_A = tA; tag_Z = tZ; tag_P = tP;
+   refract_Z = 58.3 * tan((tZ < ZLIM ? tZ : ZLIM) * S2R) * (Pressure/760.) * (283./(273. + Temper));
+   /* telescope */
+   if(Tel_State != Stopping && tZ > ZLIM) {
+      Tel_State = Req_State = Stopping;
+      Sys_Mode = SysStop;
+      sys_message(MesgWarn, "Target is below horizon limit");
+   }
+   if(Tel_State == Stopping || A_Locked || Z_Locked) {
+      stop_axis((double *)&val_A, (double *)&vel_A, AMAX_A, dt);
+      stop_axis((double *)&val_Z, (double *)&vel_Z, AMAX_Z, dt);
+   } else {
+      d = drive((double *)&val_A, (double *)&vel_A, tA, vA, VMAX_A, AMAX_A, S360, dt);
+      d += drive((double *)&val_Z, (double *)&vel_Z, tZ, vZ, VMAX_Z, AMAX_Z, 0., dt);
+      if(Tel_State == Pointing && d < PNT_OK) {
+         if(Sys_Target == TagObject) {
+            Tel_State = Req_State = Tracking;
+            Sys_Mode = SysTrkOk;
+         } else {
+            Tel_State = Req_State = Stopping;
+            Sys_Mode = SysStop;
+         }
+      }
+      if(Tel_State == Tracking) {   /* tracking errors */
+         val_A += 0.05 * rnd_gauss();
+         val_Z += 0.05 * rnd_gauss();
+      }
+   }
+   val_A = wrap(val_A + S180, S360) - S180;
+   /* P2 rotator */
+   if(P2_State == P2_On && Tel_State == Tracking && !P_Locked)
+      drive((double *)&val_P, (double *)&vel_P, tP, vP, VMAX_P, AMAX_P, S360, dt);
+   else if((P2_State == P2_Plus || P2_State == P2_Minus) && !P_Locked) {
+      vel_P = P2_State * VMAX_P / 4.;
+      val_P += vel_P*dt;
+   } else
+      stop_axis((double *)&val_P, (double *)&vel_P, AMAX_P, dt);
+   val_P = wrap(val_P, S360);
+   /* focus: slow 0.01mm/s, fast 0.1mm/s */
+   if(Foc_State != Foc_Off && (M_time > foc_end || F_Locked))
+      Foc_State = Foc_Off;
+   vel_F = Foc_State * ((Foc_State == Foc_Lplus || Foc_State == Foc_Lminus) ? 0.01 : 0.05);
+   val_F += vel_F * dt;
+   if(val_F < 0.) val_F = 0.;
+   if(val_F > 150.) val_F = 150.;
+   /* dome: follows telescope in automatic mode */
+   if(dome_end > 0. && M_time > dome_end) {
+      Dome_State = D_Off;
+      dome_end = 0.;
+   }
+   if(D_Locked || Dome_State == D_Off)
+      stop_axis((double *)&val_D, (double *)&vel_D, AMAX_D, dt);
+   else if(Dome_State == D_On)
+      drive((double *)&val_D, (double *)&vel_D, val_A, 0., VMAX_D, AMAX_D, S360, dt);
+   else {
+      vel_D = Dome_State * VMAX_D / 3.;
+      val_D += vel_D*dt;
+   }
+   val_D = wrap(val_D + S180, S360) - S180;
+   /* derived values */
+   Diff_A = val_A - tA;
+   Diff_Z = val_Z - tZ;
+   Diff_P = (P2_State == P2_On) ? val_P - tP : 0.;
+   vel_objA = vA; vel_objZ = vZ; vel_objP = vP;
+   req_speedA = vel_A; req_speedZ = vel_Z; req_speedP = vel_P;
+   A_time = Z_time = P_time = M_time;
+   calc_AD(val_A, val_Z, S_time, (double *)&val_Alp, (double *)&val_Del);
+   code_KOST = (val_A > 0. ? 0x8000 : 0) | (Tel_State != Stopping ? 0x4000 : 0) |
+               (Tel_State == Tracking ? 0x2000 : 0) | (P2_State == P2_On ? 0x1000 : 0);
+}
+
+static void usage(char *name) {
+   fprintf(stderr, "Usage:\n\t%s [rate=Hz] [cycle=sec] [seed=N] [hist[=N]] [stop] [verbose]\n", name);
+   fprintf(stderr, "\"rate\" - data update rate (default 20Hz);\n");
+   fprintf(stderr, "\"cycle\" - point to new random object every `cycle` seconds;\n");
+   fprintf(stderr, "\"seed\" - random generator seed (for reproducible meteo and objects);\n");
+   fprintf(stderr, "\"hist\" - keep last N (default %d) data blocks in shared history ring;\n", BTA_HIST_LEN);
+   fprintf(stderr, "\"stop\" - don't point to object at start;\n\"verbose\" - show commands got\n");
+   exit(1);
+}
+
+int main(int argc, char *argv[]) {
+   struct sigaction sa;
+   struct timespec tn, now;
+   double rate = 20., cycle = 0., t, tlast, tcycle, late, maxlate = 0.;
+   unsigned long nticks = 0, nlate = 0;
+   long period;
+   int i, hist_len = 0, stopped = 0;
+   char *p;
+
+   for(i = 1; i < argc; i++) {
+      if(strncmp(argv[i], "rate=", 5) == 0) {
+         rate = atof(argv[i]+5);
+         if(rate <= 0. || rate > 100000.) usage(argv[0]);
+      } else if(strncmp(argv[i], "cycle=", 6) == 0)
+         cycle = atof(argv[i]+6);
+      else if(strncmp(argv[i], "seed=", 5) == 0)
+         rnd_state ^= strtoull(argv[i]+5, NULL, 0) * 0x9E3779B97F4A7C15ULL;
+      else if(strncmp(argv[i], "hist", 4) == 0) {
+         p = strchr(argv[i], '=');
+         hist_len = (p != NULL) ? atoi(p+1) : BTA_HIST_LEN;
+         if(hist_len < 2) hist_len = BTA_HIST_LEN;
+      } else if(strcmp(argv[i], "stop") == 0)
+         stopped = 1;
+      else if(strcmp(argv[i], "verbose") == 0)
+         verbose = 1;
+      else
+         usage(argv[0]);
+   }
+   if(!rnd_state) rnd_state = 1;
+   sdat.mode |= 0200;
+   sdat.atflag = 0;
+   if(!get_shm_block(&sdat, ServerSide))
+      return 1;
+   mcmd.mode = ocmd.mode = ucmd.mode = 0622;
+   get_cmd_queue(&mcmd, ServerSide);
+   get_cmd_queue(&ocmd, ServerSide);
+   get_cmd_queue(&ucmd, ServerSide);
+   if(ServPID > 0 && ServPID != getpid() && kill(ServPID, 0) >= 0) {
+      fprintf(stderr, "bta_control or bta_control_net server process already running! (PID=%d)\n", ServPID);
+      return 1;
+   }
+   if(hist_len && !bta_hist_create(hist_len)) {
+      fprintf(stderr, "Can't create history ring, work without it\n");
+      hist_len = 0;
+   }
+   memset(&sa, 0, sizeof(sa));
+   sa.sa_handler = on_signal;
+   sigaction(SIGINT, &sa, NULL);
+   sigaction(SIGTERM, &sa, NULL);
+   sigaction(SIGHUP, &sa, NULL);
+
+   /* model works with local copy of data, segment is updated by whole block */
+   memcpy(&model, (void *)sdat.addr, sizeof(model));
+   sdt = &model;
+   ServPID = getpid();
+   UseModel = FullModel;
+   ClockType = SysTimer;
+   Tel_Focus = Prime;
+   P2_Mode = P2_State = P2_On;
+   Dome_State = D_On;
+   Az_Mode = Rev_Off;
+   val_T1 = inp_T1 = -2.;
+   val_T2 = inp_T2 = 0.;
+   val_T3 = inp_T3 = 0.;
+   val_B = 595.;
+   val_Wnd = 3.;
+   val_Hmd = 50.;
+   val_F = 75.;
+   t = tlast = tcycle = real_time();
+   model_time(t);
+   val_Z = InpZdist = 45.*3600.;
+   if(stopped) {
+      Tel_State = Req_State = Stopping;
+      Sys_Mode = SysStop;
+   } else
+      random_object();
+   sys_message(MesgInfor, "BTA simulator started");
+
+   period = (long)(1e9 / rate);
+   clock_gettime(CLOCK_MONOTONIC, &tn);
+   while(!stop) {
+      tn.tv_nsec += period;
+      while(tn.tv_nsec >= 1000000000L) {
+         tn.tv_sec++;
+         tn.tv_nsec -= 1000000000L;
+      }
+      while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tn, NULL) == EINTR && !stop);
+      if(stop) break;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      late = (now.tv_sec - tn.tv_sec) + (now.tv_nsec - tn.tv_nsec)/1e9;
+      if(late > maxlate) maxlate = late;
+      if(late > period/1e9) nlate++;
+      if(late > 1.) tn = now;   /* don't try to catch up after long stops */
+      read_commands();
+      t = real_time();
+      if(cycle > 0. && t - tcycle > cycle) {
+         tcycle = t;
+         random_object();
+      }
+      model_step(t, t - tlast);
+      tlast = t;
+      bta_write_begin();
+      memcpy((void *)sdat.addr, &model, sizeof(model));
+      bta_write_end();
+      if(hist_len)
+         bta_hist_append(&model, t);
+      nticks++;
+   }
+   fprintf(stderr, "%lu updates, %lu late for more than period, max lateness %.3fms\n",
+           nticks, nlate, maxlate*1e3);
+   sdt = (struct BTA_Data *)sdat.addr;
+   close_shm_block(&sdat);
+   if(hist_len) close_shm_block(&shist);
+   return 0;
+}
@@ -38,12 +38,9 @@ double dtime(){
 /******************************************************************************\
  *                          Coloured terminal
 \******************************************************************************/
-int globErr = 0; // errno for WARN/ERR
-
 // pointers to coloured output printf
 int (*red)(const char *fmt, ...);
 int (*green)(const char *fmt, ...);
-int (*_WARN)(const char *fmt, ...);
 
 /*
  * format red / green messages
@@ -70,47 +67,11 @@ int g_pr_(const char *fmt, ...){
     return i;
 }
 /*
- * print red error/warning messages (if output is a tty)
+ * notty variant of coloured printf
+ * name: r_pr_notty
  * @param fmt ... - printf-like format
  * @return number of printed symbols
  */
-int r_WARN(const char *fmt, ...){
-    va_list ar; int i = 1;
-    fprintf(stderr, RED);
-    va_start(ar, fmt);
-    if(globErr){
-        errno = globErr;
-        vwarn(fmt, ar);
-        errno = 0;
-        globErr = 0;
-    }else
-        i = vfprintf(stderr, fmt, ar);
-    va_end(ar);
-    i++;
-    fprintf(stderr, OLDCOLOR "\n");
-    return i;
-}
-
-/*
- * notty variants of coloured printf
- * name: s_WARN, r_pr_notty
- * @param fmt ... - printf-like format
- * @return number of printed symbols
- */
-int s_WARN(const char *fmt, ...){
-    va_list ar; int i = 0;
-    va_start(ar, fmt);
-    if(globErr){
-        errno = globErr;
-        vwarn(fmt, ar);
-        errno = 0;
-        globErr = 0;
-    }else
-        i = +vfprintf(stderr, fmt, ar);
-    va_end(ar);
-    i += fprintf(stderr, "\n");
-    return i;
-}
 int r_pr_notty(const char *fmt, ...){
     va_list ar; int i = 0;
     va_start(ar, fmt);
@@ -130,8 +91,6 @@ void initial_setup(){
     }else{ // no colors in case of pipe
         red = r_pr_notty; green = printf;
     }
-    if(isatty(STDERR_FILENO)) _WARN = r_WARN;
-    else _WARN = s_WARN;
     // Setup locale
     setlocale(LC_ALL, "");
     setlocale(LC_NUMERIC, "C");
@@ -139,6 +98,8 @@ void initial_setup(){
     bindtextdomain(GETTEXT_PACKAGE, LOCALEDIR);
     textdomain(GETTEXT_PACKAGE);
 #endif
+    // start logger thread
+    bta_log_init(NULL);
 }
 
 /******************************************************************************\
@@ -250,62 +211,36 @@ int mygetchar(){ // getchar() without need of pressing ENTER
 }
 
 // logging
-
-
-static Cl_log log = {0};
 /**
- * @brief Cl_createlog - create log file: init mutex, test file open ability
- * @param log - log structure
+ * @brief Cl_createlog - test file open ability and pass it to logger
+ * @param logname - full path to log file
  * @return 0 if all OK
  */
 int Cl_createlog(char *logname){
-    if(log.logpath){
-        FREE(log.logpath);
-        pthread_mutex_destroy(&log.mutex);
-    }
     FILE *logfd = fopen(logname, "a");
     if(!logfd){
         WARN("Can't open log file");
         return 2;
     }
-    log.logpath = strdup(logname);
     fclose(logfd);
-    if(pthread_mutex_init(&log.mutex, NULL)){
-        WARN("Can't init log mutes");
+    if(bta_log_init(logname)){
+        WARNX("Can't start logger thread");
         return 3;
     }
     return 0;
 }
 
 /**
- * @brief Cl_putlog - put message to log file with/without timestamp
- * @param timest - ==1 to put timestamp
- * @param log - pointer to log structure
- * @param lvl - message loglevel (if lvl > loglevel, message won't be printed)
+ * @brief Cl_putlogt - put message with timestamp to log file
+ * (it is written later by logger thread)
  * @param fmt - format and the rest part of message
- * @return amount of symbols saved in file
+ * @return 0
  */
 int Cl_putlogt(const char *fmt, ...){
-    if(pthread_mutex_lock(&log.mutex)){
-        WARN("Can't lock log mutex");
-        return 0;
-    }
-    int i = 0;
-    FILE *logfd = fopen(log.logpath, "a");
-    if(!logfd) goto rtn;
-    char strtm[128];
-    time_t t = time(NULL);
-    struct tm *curtm = localtime(&t);
-    strftime(strtm, 128, "%Y/%m/%d-%H:%M:%S", curtm);
-    i = fprintf(logfd, "%s\t", strtm);
     va_list ar;
     va_start(ar, fmt);
-    i += vfprintf(logfd, fmt, ar);
+    bta_vlog(BTA_LOG_FILE, fmt, ar);
     va_end(ar);
-    i += fprintf(logfd, "\n");
-    fclose(logfd);
-rtn:
-    pthread_mutex_unlock(&log.mutex);
-    return i;
+    return 0;
 }
 
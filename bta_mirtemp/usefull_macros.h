@@ -52,6 +52,8 @@
 #include <sys/types.h>
 #include <stdint.h>
 
+#include "bta_log.h"
+
 
 // unused arguments with -Wall -Werror
 #define _U_    __attribute__((__unused__))
@@ -66,12 +68,12 @@
 /*
  * ERROR/WARNING messages
  */
-extern int globErr;
 extern void signals(int sig);
-#define ERR(...) do{globErr=errno; _WARN(__VA_ARGS__); signals(0);}while(0)
-#define ERRX(...) do{globErr=0; _WARN(__VA_ARGS__); signals(0);}while(0)
-#define WARN(...) do{globErr=errno; _WARN(__VA_ARGS__);}while(0)
-#define WARNX(...) do{globErr=0; _WARN(__VA_ARGS__);}while(0)
+// messages are written by asynchronous logger (see bta_log.h)
+#define ERR(...) do{bta_log(BTA_LOG_STDERR|BTA_LOG_RED|BTA_LOG_ERRNO, __VA_ARGS__); bta_log_flush(); signals(0);}while(0)
+#define ERRX(...) do{bta_log(BTA_LOG_STDERR|BTA_LOG_RED, __VA_ARGS__); bta_log_flush(); signals(0);}while(0)
+#define WARN(...) do{bta_log(BTA_LOG_STDERR|BTA_LOG_RED|BTA_LOG_ERRNO, __VA_ARGS__);}while(0)
+#define WARNX(...) do{bta_log(BTA_LOG_STDERR|BTA_LOG_RED, __VA_ARGS__);}while(0)
 
 /*
  * print function name, debug messages
@@ -93,13 +95,12 @@ extern void signals(int sig);
 #define ALLOC(type, var, size)  type * var = ((type *)my_alloc(size, sizeof(type)))
 #define MALLOC(type, size) ((type *)my_alloc(size, sizeof(type)))
 #define FREE(ptr)			do{free(ptr); ptr = NULL;}while(0)
-#define LOG(...)    do{Cl_putlogt(__VA_ARGS__); WARNX(__VA_ARGS__);}while(0)
+#define LOG(...)    do{bta_log(BTA_LOG_FILE|BTA_LOG_STDERR|BTA_LOG_RED, __VA_ARGS__);}while(0)
 
 double dtime();
 
 // functions for color output in tty & no-color in pipes
 extern int (*red)(const char *fmt, ...);
-extern int (*_WARN)(const char *fmt, ...);
 extern int (*green)(const char *fmt, ...);
 void * my_alloc(size_t N, size_t S);
 void initial_setup();
@@ -117,11 +118,6 @@ void setup_con();
 int read_console();
 int mygetchar();
 
-typedef struct{
-    char *logpath;          // full path to logfile
-    pthread_mutex_t mutex;  // log mutex
-} Cl_log;
-
 int Cl_createlog(char *logname);
 int Cl_putlogt(const char *fmt, ...);
 
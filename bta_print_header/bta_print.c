@@ -19,14 +19,19 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <time.h>
+#include <unistd.h>
 #include <usefull_macros.h>
 #include <erfa.h>
 #include <erfam.h>
 
 #include "bta_print.h"
 #include "bta_shdata.h"
+#include "bta_fields.h"
 #include "bta_site.h"
 
 // rad to time sec
@@ -110,19 +115,37 @@ char *angle_asc(double a){
     return buf;
 }
 
+#define FITS_CARDSZ     80      // size of FITS header card
+#define FITS_BLOCKSZ    2880    // FITS files consist of blocks of this size
+#define HDR_BLOCKS      4       // size of mmap'ed header in FITS blocks
+#define HDR_SIZE        (HDR_BLOCKS * FITS_BLOCKSZ)
+#define HDR_NCARDS      (HDR_SIZE / FITS_CARDSZ)
+#define HDR_MAXCARDS    (HDR_NCARDS - 2) // without HDRGEN & END
+#define GEN_OFFSET      24      // aligned word with digits of generation & " /" after them
+#define GEN_DIGITS      6       // value ends at column 30 as FITS fixed format requires
+
+// cards of current header: text of each card padded by spaces
+static char cards[HDR_MAXCARDS][FITS_CARDSZ];
+static int cardlen[HDR_MAXCARDS]; // length of text without padding
+static int ncards = 0;
+
 /**
- * @brief printhdr - write FITS record into output file
- * @param fd   - fd to write
+ * @brief printhdr - add FITS record to current header
  * @param key  - key
  * @param val  - value
  * @param cmnt - comment
  * @return 0 if all OK
  */
-static int printhdr(int fd, const char *key, const char *val, const char *cmnt){
+static int printhdr(const char *key, const char *val, const char *cmnt){
     char tmp[81];
     char tk[9];
+    if(ncards == HDR_MAXCARDS){
+        WARNX("Too many cards in header (max: %d)", HDR_MAXCARDS);
+        return 1;
+    }
     if(strlen(key) > 8){
         strncpy(tk, key, 8);
+        tk[8] = 0;
         key = tk;
     }
     if(cmnt){
@@ -130,16 +153,135 @@ static int printhdr(int fd, const char *key, const char *val, const char *cmnt){
     }else{
         snprintf(tmp, 80, "%-8s= %s", key, val);
     }
-    size_t l = strlen(tmp);
-    tmp[l] = '\n';
-    ++l;
-    if(write(fd, tmp, l) != (ssize_t)l){
+    int l = strlen(tmp);
+    memcpy(cards[ncards], tmp, l);
+    memset(cards[ncards] + l, ' ', FITS_CARDSZ - l);
+    cardlen[ncards++] = l;
+    return 0;
+}
+
+/**
+ * @brief write_lines - write header as text file (a card per line)
+ * A new file is renamed over old one, so readers see either old or new header
+ * @param path - file name
+ * @return TRUE if all OK
+ */
+static int write_lines(const char *path){
+    static char buf[HDR_MAXCARDS * (FITS_CARDSZ + 1)];
+    size_t len = 0;
+    int l = strlen(path) + 7;
+    char *aname = MALLOC(char, l);
+    snprintf(aname, l, "%sXXXXXX", path);
+    int fd = mkstemp(aname);
+    if(fd < 0){
+        WARN("Can't write header file, mkstemp()");
+        FREE(aname);
+        return FALSE;
+    }
+    fchmod(fd, 0644);
+    for(int i = 0; i < ncards; ++i){
+        memcpy(buf + len, cards[i], cardlen[i]);
+        len += cardlen[i];
+        buf[len++] = '\n';
+    }
+    int ret = TRUE;
+    if(write(fd, buf, len) != (ssize_t)len){
         WARN("write()");
+        ret = FALSE;
+    }
+    close(fd);
+    rename(aname, path);
+    FREE(aname);
+    return ret;
+}
+
+static char *hdr = NULL;  // mmap'ed header
+static uint64_t hdrgen = 0; // its generation
+
+// change digits of HDRGEN value by one store, so readers never see half of them
+static void set_gen(uint64_t g){
+    char d[sizeof(uint64_t)];
+    uint64_t w;
+    memcpy(d, hdr + GEN_OFFSET, sizeof(d)); // keep " /" after digits
+    for(int i = GEN_DIGITS - 1; i >= 0; --i, g /= 10) d[i] = '0' + g % 10;
+    memcpy(&w, d, sizeof(w));
+    __atomic_store_n((uint64_t*)(hdr + GEN_OFFSET), w, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief open_mmap - open (create) header file of HDR_SIZE bytes and map it
+ * Numbering of generations continues from existing file
+ * @param path - file name
+ * @return 0 if all OK
+ */
+static int open_mmap(const char *path){
+    struct stat st;
+    char gencard[FITS_CARDSZ + 1];
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd < 0){
+        WARN("Can't open header file %s", path);
+        return 1;
+    }
+    if(fstat(fd, &st) || (st.st_size != HDR_SIZE && ftruncate(fd, HDR_SIZE))){
+        WARN("Can't set size of %s", path);
+        close(fd);
         return 1;
     }
+    hdr = mmap(NULL, HDR_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(hdr == MAP_FAILED){
+        WARN("mmap()");
+        hdr = NULL;
+        return 1;
+    }
+    if(st.st_size == HDR_SIZE && strncmp(hdr, "HDRGEN  =", 9) == 0)
+        hdrgen = strtoull(hdr + 10, NULL, 10);
+    hdrgen = (hdrgen + 2) & ~1ULL; // even: header is consistent
+    snprintf(gencard, sizeof(gencard), "HDRGEN  = %*s%0*llu / %-47s", 20 - GEN_DIGITS, "",
+        GEN_DIGITS, (unsigned long long)(hdrgen % 1000000ULL), "Header generation, odd while updating");
+    memcpy(hdr, gencard, FITS_CARDSZ);
     return 0;
 }
 
+/**
+ * @brief write_mmap - update header in mmap'ed file
+ * Only changed cards are rewritten; HDRGEN is odd while they are changed, so
+ * reader has consistent copy if HDRGEN was even & the same before & after copying
+ * @param path - file name
+ * @return TRUE if all OK
+ */
+static int write_mmap(const char *path){
+    static char endcard[FITS_CARDSZ], blank[FITS_CARDSZ];
+    static long pagesz = 0;
+    if(!hdr){
+        if(open_mmap(path)) return FALSE;
+        memset(blank, ' ', FITS_CARDSZ);
+        memcpy(endcard, blank, FITS_CARDSZ);
+        memcpy(endcard, "END", 3);
+        pagesz = sysconf(_SC_PAGESIZE);
+    }
+    int first = 0, last = 0;
+    for(int i = 0; i < HDR_NCARDS - 1; ++i){
+        const char *card = (i < ncards) ? cards[i] : (i == ncards) ? endcard : blank;
+        char *dst = hdr + (i + 1) * FITS_CARDSZ;
+        if(memcmp(dst, card, FITS_CARDSZ) == 0) continue;
+        if(!first){ // header starts changing
+            set_gen(++hdrgen);
+            msync(hdr, pagesz, MS_SYNC);
+            first = i + 1;
+        }
+        memcpy(dst, card, FITS_CARDSZ);
+        last = i + 1;
+    }
+    if(!first) return TRUE; // nothing changed
+    // push cards to file (NFS) before HDRGEN becomes even
+    size_t start = (first * FITS_CARDSZ) / pagesz * pagesz;
+    msync(hdr + start, (last + 1) * FITS_CARDSZ - start, MS_SYNC);
+    set_gen(++hdrgen);
+    msync(hdr, pagesz, MS_SYNC);
+    return TRUE;
+}
+
 static void calc_AZ(double alpha, double delta, double stime, double *az, double *zd){
     double ha = (stime - alpha) * 15.;
     if(ha < 0.) ha += ERFA_TURNAS;
@@ -220,24 +362,21 @@ red("pca=%g, pcz=%g; tel_cor_A=%g, tel_cor_Z=%g\n", pca, pcz, tel_cor_A, tel_cor
 }
 #endif
 
-#define WRHDR(k, v, c)  do{if(printhdr(fd, k, v, c)){goto returning;}}while(0)
-int print_header(_U_ const char *path){
+#define WRHDR(k, v, c)  do{if(printhdr(k, v, c)){goto returning;}}while(0)
+/**
+ * @brief print_header - refresh FITS header file
+ * @param path    - file name
+ * @param mmapped - !=0 to keep header in mmap'ed file of HDR_BLOCKS FITS blocks
+ * @return TRUE if all OK
+ */
+int print_header(const char *path, int mmapped){
     int ret = FALSE;
     char val[23], comment[71];
 #define COMMENT(...) do{snprintf(comment, 70, __VA_ARGS__);}while(0)
 #define VAL(fmt, x) do{snprintf(val, 22, fmt, x);}while(0)
 #define VALD(x) VAL("%.10f", x)
 #define VALS(x) VAL("'%s'", x)
-    int l = strlen(path) + 7;
-    char *aname = MALLOC(char, l);
-    snprintf(aname, l, "%sXXXXXX", path);
-    int fd = mkstemp(aname);
-    if(fd < 0){
-        WARN("Can't write header file, mkstemp()");
-        FREE(aname);
-        return FALSE;
-    }
-    fchmod(fd, 0644);
+    ncards = 0;
     WRHDR("TELESCOP", "'BTA 6m telescope'", "Telescope name");
     WRHDR("ORIGIN", "'SAO RAS, Russia'", "Organization responsible for the data");
     VALD(TELLAT);
@@ -301,8 +440,6 @@ int print_header(_U_ const char *path){
     VALS(telmode);
     WRHDR("TELMODE", val, "Telescope working mode");
 
-    VAL("%.2f", val_F);
-    WRHDR("VAL_F", val, "Focus value of telescope (mm)");
     double a2000, d2000;
     calc_mean(InpAlpha, InpDelta, &a2000, &d2000);
     VALD(a2000 * 15. / 3600.);
@@ -318,19 +455,29 @@ int print_header(_U_ const char *path){
     VALD(d2000 / 3600.);
     COMMENT("Telescope Decl. for J2000 (deg): %s", angle_asc(d2000));
     WRHDR("DEC_0", val, comment);
-#define RA(ra, dec, text, pref) do{VALD(ra*15./3600.); COMMENT(text " R.A. (degr): %s", time_asc(ra)); WRHDR("RA" pref, val, comment); \
-        VALD(dec/3600.); COMMENT(text " Decl (degr): %s", angle_asc(dec)); WRHDR("DEC" pref, val, comment);}while(0)
-    RA(InpAlpha, InpDelta, "Input", "_INP");
-    RA(CurAlpha, CurDelta, "Current object", "_OBJ");
-    RA(SrcAlpha, SrcDelta, "Source", "_SRC");
-    RA(val_Alp, val_Del, "Telescope", "");
-#undef RA
-#define AZ(a, z, text, pref) do{VALD(a/3600.); COMMENT(text " Az (degr): %s", angle_asc(a)); WRHDR("A" pref, val, comment); \
-    VALD(z/3600.); COMMENT(text " ZD (degr): %s", angle_asc(z)); WRHDR("Z" pref, val, comment);}while(0)
-    AZ(InpAzim, InpZdist, "Input", "_INP");
-    AZ(tag_A, tag_Z, "Current object", "_OBJ");
-    AZ(val_A, val_Z, "Telescope", "");
-#undef AZ
+    // plain fields from common table
+    for(const BTA_Field *f = bta_fields; f < bta_fields + BTA_FIELDS_AMOUNT; ++f){
+        if(!f->fkey) continue;
+        double v = bta_field_val(f, sdt);
+        switch(f->kind){
+            case BTA_F_TIME:
+                VALD(v * 15. / 3600.);
+                COMMENT("%s: %s", f->fcmnt, time_asc(v));
+            break;
+            case BTA_F_ANGLE:
+                VALD(v / 3600.);
+                COMMENT("%s: %s", f->fcmnt, angle_asc(v));
+            break;
+            case BTA_F_CODE:
+                VAL(f->ffmt, (uint32_t)v);
+                COMMENT("%s", f->fcmnt);
+            break;
+            default:
+                VAL(f->ffmt, v);
+                COMMENT("%s", f->fcmnt);
+        }
+        WRHDR(f->fkey, val, comment);
+    }
 /*
     VALD(tag_A/3600.);
     COMMENT("Target Az (degr): %s", angle_asc(tag_A));
@@ -352,15 +499,6 @@ int print_header(_U_ const char *path){
     VALD(P);
     COMMENT("Parallactic angle (degr): %s", angle_asc(P*3600.));
     WRHDR("PARANGLE", val, comment);
-    VALD(tag_P/3600.);
-    COMMENT("Target par. angle (degr): %s", angle_asc(tag_P));
-    WRHDR("TAGANGLE", val, comment);
-    VALD(val_P/3600.);
-    COMMENT("Current P2 rot. angle (degr): %s", angle_asc(val_P));
-    WRHDR("ROTANGLE", val, comment);
-    VALD(val_D/3600.);
-    COMMENT("Dome Az (degr): %s", angle_asc(val_D));
-    WRHDR("DOME_A", val, comment);
     if(Sys_Mode==SysTrkSeek||Sys_Mode==SysTrkOk||Sys_Mode==SysTrkCorr||Sys_Mode==SysTrkStart||Sys_Mode==SysTrkMove){
         double curA,curZ,srcA,srcZ;
         double corAlp,corDel,corA,corZ;
@@ -381,8 +519,6 @@ int print_header(_U_ const char *path){
         VALD(corZ);
         WRHDR("ZCORR", val, "Z correction (current - source)");
     }
-    VALD(DUT1);
-    WRHDR("DUT1", val, "DUT1 = UT1 - UTC");
 /*
     double az,zd;//,pa;
     calc_AZ(val_Alp, val_Del, sidtm, &az, &zd);
@@ -445,17 +581,6 @@ int print_header(_U_ const char *path){
     VAL("%.2f", dz);
     WRHDR("REFR_T_E", val, "RREFR_T by ERFA eraRefco()");}
 
-#define T(hdr, t, text) do{VAL("%.1f", t); COMMENT(text " temperature (degC)"); WRHDR(hdr, val, comment);}while(0)
-    T("OUTTEMP", val_T1, "Outern");
-    T("DOMETEMP", val_T2, "In-dome");
-    T("MIRRTEMP", val_T3, "Mirror");
-#undef T
-    VAL("%.1f", val_B);
-    WRHDR("PRESSURE", val, "Atm. pressure (mmHg)");
-    VAL("%.1f", val_Wnd);
-    WRHDR("WIND", val, "Wind speed (m/s)");
-    VAL("%.1f", val_Hmd);
-    WRHDR("HUMIDITY", val, "Relative humidity (%)");
     /*
      * Airmass calculation
      * by Reed D. Meyer
@@ -474,9 +599,9 @@ int print_header(_U_ const char *path){
     VALD(wcd);
     WRHDR("WVDENS", val, "WV column density by Reed D. Meyer (g/cm^2)");}
     ret = TRUE;
-returning:
-    close(fd);
-    rename(aname, path);
-    FREE(aname);
+returning: // write even incomplete header
+    if(mmapped){
+        if(!write_mmap(path)) ret = FALSE;
+    }else if(!write_lines(path)) ret = FALSE;
     return ret;
 }
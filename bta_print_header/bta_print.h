@@ -20,6 +20,6 @@
 #ifndef BTA_PRINT_H__
 #define BTA_PRINT_H__
 
-int print_header(const char *path);
+int print_header(const char *path, int mmapped);
 
 #endif // BTA_PRINT_H__
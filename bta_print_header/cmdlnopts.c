@@ -46,6 +46,7 @@ sl_option_t cmdlnopts[] = {
     {"out",     NEED_ARG,   NULL,   'o', arg_string,    APTR(&G.outfile),   N_("output file name")},
     {"refresh", NEED_ARG,   NULL,   'r', arg_double,    APTR(&G.refresh),   N_("refresh rate (0.1-30s; default: 0.5)")},
     {"pidfile", NEED_ARG,   NULL,   'p', arg_string,    APTR(&G.pidfile),   N_("PID file name")},
+    {"mmap",    NO_ARGS,    NULL,   'm', arg_none,      APTR(&G.mmapped),   N_("keep FITS header in fixed-size mmap'ed file, rewrite only changed cards")},
     end_option
 };
 
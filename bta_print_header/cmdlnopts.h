@@ -29,6 +29,7 @@ typedef struct{
     char *outfile;
     char *pidfile;
     double refresh;
+    int mmapped;
 } glob_pars;
 
 glob_pars *parse_args(int argc, char **argv);
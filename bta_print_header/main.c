@@ -58,9 +58,11 @@ int main(int argc, char **argv){
     if(G->refresh < 0.1 || G->refresh > 30.){
         ERRX("Refresh rate should be from 0.1 to 30 seconds");
     }
-    FILE *f = fopen(G->outfile, "w");
+    // mmap'ed header is updated in place: don't remove it under readers
+    FILE *f = fopen(G->outfile, G->mmapped ? "a" : "w");
     if(!f) ERRX("Can't create file %s", G->outfile);
-    fclose(f); unlink(G->outfile);
+    fclose(f);
+    if(!G->mmapped) unlink(G->outfile);
     sl_check4running(self, G->pidfile);
     signal(SIGINT, signals);
     signal(SIGQUIT, signals);
@@ -89,13 +91,18 @@ int main(int argc, char **argv){
     if(!get_shm_block(&sdat, ClientSide)){
         ERRX("BTA daemon isn't running?");
     }
-    unsigned s = (unsigned)G->refresh;
-    useconds_t us = (G->refresh - s)* 1e6;
+    static struct BTA_Data snap;
+    sdt = &snap; // print header from consistent copy of shared data
     while(1){
+        double t0 = sl_dtime();
+        uint32_t gen = bta_update_gen();
+        bta_snapshot(&snap);
         if(!check_shm_block(&sdat)) return 1;
-        print_header(G->outfile);
-        if(s) sleep(s);
-        usleep(us);
+        print_header(G->outfile, G->mmapped);
+        // wait for the next data update, but refresh header not more often than G->refresh
+        bta_wait_update(&gen, G->refresh);
+        double rest = G->refresh - (sl_dtime() - t0);
+        if(rest > 0.) usleep((useconds_t)(rest * 1e6));
     }
     return 0;
 }
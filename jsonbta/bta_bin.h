@@ -0,0 +1,194 @@
+/*
+ * bta_bin.h - compact binary format of bta_json replies & its decoder
+ *
+ * Client asks for it adding word "binary" to request (e.g. "binary eqcoor
+ * vel" or "subscribe binary delta eqcoor"). Each message is a 16-byte header
+ * followed by payload, all numbers are little-endian:
+ *   header:  "BTA" + type ('T' - table of fields, 'D' - data),
+ *            uint32 payload length, uint64 sequence number of snapshot
+ *   table:   BTA_BIN_TBLSZ-byte entries: uint16 id, uint8 kind (BTA_BIN_xx),
+ *            uint8 group, char name[BTA_BIN_NAMELEN] (zero-padded) - the
+ *            same names as in JSON
+ *   data:    BTA_BIN_RECSZ-byte records: uint16 id, double value
+ * Times are in seconds, angles in arcseconds, values of BTA_BIN_ENUM fields
+ * are indexes in string arrays below. Table comes before the first data
+ * message and again when new fields appear (ids of old ones don't change).
+ * Data message may contain only part of fields (selected groups or delta).
+ * NaN value means there's no data (null in JSON).
+ *
+ * Decoding doesn't allocate memory:
+ *	bta_bin_field tbl[BTA_BIN_MAXID]; double val[BTA_BIN_MAXID];
+ *	bta_bin_msg m; long L;
+ *	while((L = bta_bin_parse(buf, len, &m)) > 0){
+ *		if(m.type == BTA_BIN_TABLE) bta_bin_table(&m, tbl, BTA_BIN_MAXID);
+ *		else bta_bin_values(&m, val, BTA_BIN_MAXID);
+ *		buf += L; len -= L;
+ *	}
+ *	... val[bta_bin_id(tbl, BTA_BIN_MAXID, "CurAlpha")] ...
+ */
+#pragma once
+#ifndef __BTA_BIN_H__
+#define __BTA_BIN_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#define BTA_BIN_HDRSZ   16  // size of message header
+#define BTA_BIN_NAMELEN 12  // max length of field name (with trailing zero)
+#define BTA_BIN_TBLSZ   (4 + BTA_BIN_NAMELEN) // size of table entry
+#define BTA_BIN_RECSZ   10  // size of data record
+#define BTA_BIN_MAXID   96  // max amount of fields
+#define BTA_BIN_MAXMSG  (BTA_BIN_HDRSZ + BTA_BIN_MAXID*BTA_BIN_TBLSZ) // max message size
+
+// message types
+#define BTA_BIN_TABLE   'T'
+#define BTA_BIN_DATA    'D'
+
+// kinds of fields (the same values as BTA_F_xx of bta_fields.h)
+enum{
+	 BTA_BIN_TIME = 0   // time, seconds
+	,BTA_BIN_ANGLE      // angle, arcseconds
+	,BTA_BIN_VALUE      // any other value
+	,BTA_BIN_CODE       // integer code
+	,BTA_BIN_ENUM       // index in array of strings (bta_bin_enumstr())
+};
+
+// string values of JSON fields "Tel_Mode", "Tel_Focus", "Tel_Taget" & "P2_Mode"
+static const char *const bta_bin_telmode[] = {"Off", "Manual", "Stopping", "Waiting",
+	"Pointing", "Seeking", "Tracking", "Correction", "Testing"};
+static const char *const bta_bin_telfocus[] = {"Prime", "Nasmyth1", "Nasmyth2"};
+static const char *const bta_bin_target[] = {"Object", "A/Z-Pos.", "Nest", "Zenith", "Horizon"};
+static const char *const bta_bin_p2mode[] = {"Stop", "Track", "Move+", "Move-", "Off"};
+
+typedef struct{
+	int type;               // BTA_BIN_TABLE or BTA_BIN_DATA
+	uint32_t len;           // payload length
+	uint64_t seq;           // sequence number of snapshot
+	const unsigned char *data; // payload
+} bta_bin_msg;
+
+typedef struct{
+	int kind;               // BTA_BIN_xx, -1 for unused entry
+	int group;              // group (the same order as words of request)
+	char name[BTA_BIN_NAMELEN];
+} bta_bin_field;
+
+static inline uint16_t bta_bin_get16(const unsigned char *p){
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+static inline uint32_t bta_bin_get32(const unsigned char *p){
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+static inline uint64_t bta_bin_get64(const unsigned char *p){
+	return (uint64_t)bta_bin_get32(p) | ((uint64_t)bta_bin_get32(p + 4) << 32);
+}
+static inline void bta_bin_put16(unsigned char *p, uint16_t x){
+	p[0] = x & 0xff; p[1] = x >> 8;
+}
+static inline void bta_bin_put32(unsigned char *p, uint32_t x){
+	bta_bin_put16(p, x & 0xffff); bta_bin_put16(p + 2, x >> 16);
+}
+static inline void bta_bin_put64(unsigned char *p, uint64_t x){
+	bta_bin_put32(p, x & 0xffffffff); bta_bin_put32(p + 4, x >> 32);
+}
+static inline double bta_bin_getd(const unsigned char *p){
+	uint64_t u = bta_bin_get64(p);
+	double d;
+	memcpy(&d, &u, sizeof(d));
+	return d;
+}
+static inline void bta_bin_putd(unsigned char *p, double d){
+	uint64_t u;
+	memcpy(&u, &d, sizeof(u));
+	bta_bin_put64(p, u);
+}
+
+/**
+ * fill message header
+ */
+static inline void bta_bin_header(unsigned char *p, int type, uint32_t len, uint64_t seq){
+	p[0] = 'B'; p[1] = 'T'; p[2] = 'A'; p[3] = (unsigned char)type;
+	bta_bin_put32(p + 4, len);
+	bta_bin_put64(p + 8, seq);
+}
+
+/**
+ * find next message in stream buffer
+ * @param buf, len - received data
+ * @param m (o) - message found (its payload points into `buf`)
+ * @return length of message, 0 if it isn't received yet, -1 if data is bad
+ */
+static inline long bta_bin_parse(const void *buf, size_t len, bta_bin_msg *m){
+	const unsigned char *p = (const unsigned char*)buf;
+	if(len < BTA_BIN_HDRSZ) return 0;
+	if(p[0] != 'B' || p[1] != 'T' || p[2] != 'A' || (p[3] != BTA_BIN_TABLE && p[3] != BTA_BIN_DATA))
+		return -1;
+	m->type = p[3];
+	m->len = bta_bin_get32(p + 4);
+	m->seq = bta_bin_get64(p + 8);
+	m->data = p + BTA_BIN_HDRSZ;
+	if(m->len > BTA_BIN_MAXMSG - BTA_BIN_HDRSZ) return -1;
+	if(len < BTA_BIN_HDRSZ + (size_t)m->len) return 0;
+	return BTA_BIN_HDRSZ + (long)m->len;
+}
+
+/**
+ * store table message into array `tbl` indexed by field id
+ * @return amount of fields in message
+ */
+static inline int bta_bin_table(const bta_bin_msg *m, bta_bin_field *tbl, int maxid){
+	const unsigned char *p = m->data;
+	int i, n = m->len / BTA_BIN_TBLSZ;
+	for(i = 0; i < maxid; ++i) tbl[i].kind = -1;
+	for(i = 0; i < n; ++i, p += BTA_BIN_TBLSZ){
+		int id = bta_bin_get16(p);
+		if(id >= maxid) continue;
+		tbl[id].kind = p[2];
+		tbl[id].group = p[3];
+		memcpy(tbl[id].name, p + 4, BTA_BIN_NAMELEN);
+		tbl[id].name[BTA_BIN_NAMELEN-1] = 0;
+	}
+	return n;
+}
+
+/**
+ * store values of data message into array `val` indexed by field id
+ * (fields absent in message aren't touched)
+ * @return amount of values in message
+ */
+static inline int bta_bin_values(const bta_bin_msg *m, double *val, int maxid){
+	const unsigned char *p = m->data;
+	int i, n = m->len / BTA_BIN_RECSZ;
+	for(i = 0; i < n; ++i, p += BTA_BIN_RECSZ){
+		int id = bta_bin_get16(p);
+		if(id < maxid) val[id] = bta_bin_getd(p + 2);
+	}
+	return n;
+}
+
+/**
+ * @return id of field `name` or -1
+ */
+static inline int bta_bin_id(const bta_bin_field *tbl, int maxid, const char *name){
+	int i;
+	for(i = 0; i < maxid; ++i)
+		if(tbl[i].kind >= 0 && strcmp(tbl[i].name, name) == 0) return i;
+	return -1;
+}
+
+/**
+ * @return string value of BTA_BIN_ENUM field or NULL
+ */
+static inline const char *bta_bin_enumstr(const bta_bin_field *f, double v){
+	#define ENUMSTR(nm, arr) if(strcmp(f->name, nm) == 0){ \
+		return (v >= 0. && v < sizeof(arr)/sizeof(arr[0])) ? arr[(int)v] : NULL;}
+	if(f->kind != BTA_BIN_ENUM) return NULL;
+	ENUMSTR("Tel_Mode", bta_bin_telmode);
+	ENUMSTR("Tel_Focus", bta_bin_telfocus);
+	ENUMSTR("Tel_Taget", bta_bin_target);
+	ENUMSTR("P2_Mode", bta_bin_p2mode);
+	#undef ENUMSTR
+	return NULL;
+}
+
+#endif // __BTA_BIN_H__
@@ -0,0 +1,391 @@
+/*
+ * bta_client.c - streaming client library for bta_json (see bta_client.h)
+ *
+ * Copyright 2013 Edward V. Emelianoff <eddy@sao.ru>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+#include <string.h>
+#include <strings.h>	// strncasecmp
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>		// close
+#include <poll.h>
+#include <netdb.h>		// addrinfo
+#include <sys/socket.h>
+#include "bta_client.h"
+
+// names & offsets of bta_values fields
+static const char *const key_name[BTA_K_AMOUNT] = {
+	#define X(key) #key,
+	BTA_CLIENT_KEYS(X)
+	#undef X
+};
+static const size_t key_off[BTA_K_AMOUNT] = {
+	#define X(key) offsetof(bta_values, key),
+	BTA_CLIENT_KEYS(X)
+	#undef X
+};
+
+// string values of fields (index in array is value)
+#define NSTR(arr) (sizeof(arr)/sizeof(arr[0]))
+static const struct{
+	int key;
+	const char *const *str;
+	int n;
+} enums[] = {
+	{BTA_K_Tel_Mode,  bta_bin_telmode,  NSTR(bta_bin_telmode)},
+	{BTA_K_Tel_Focus, bta_bin_telfocus, NSTR(bta_bin_telfocus)},
+	{BTA_K_Tel_Taget, bta_bin_target,   NSTR(bta_bin_target)},
+	{BTA_K_P2_Mode,   bta_bin_p2mode,   NSTR(bta_bin_p2mode)},
+};
+#undef NSTR
+
+static const double pow10tbl[] = {1., 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+	1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19};
+
+// parser states
+enum{
+	P_OUT = 0,  // waiting for '{'
+	P_KEYWAIT,  // waiting for key or '}'
+	P_KEY,      // inside key
+	P_COLON,    // waiting for ':'
+	P_VALWAIT,  // waiting for value
+	P_STRVAL,   // inside string value
+	P_BAREVAL,  // inside number or true/false
+	P_NEXT      // waiting for ',' or '}'
+};
+
+static double dtime(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void bta_parser_reset(bta_parser *p){
+	memset(p, 0, sizeof(bta_parser));
+	p->key = -1;
+}
+
+static void val_start(bta_parser *p){
+	p->neg = p->hex = p->frac = p->bad = false;
+	p->ndig = p->nfrac = p->slen = 0;
+	p->mant = 0;
+	p->acc = 0.;
+}
+
+/**
+ * next char of value: numbers & sexagesimal values ("-12:34:56.7") are
+ * accumulated at once, other strings are stored in p->str
+ */
+static void val_char(bta_parser *p, char c){
+	if(p->bad) return;
+	if(p->slen){ // not a number
+		if(p->slen < BTA_CLIENT_STRLEN - 1) p->str[p->slen++] = c;
+		else p->bad = true;
+		return;
+	}
+	if(p->hex){
+		int d;
+		if(c >= '0' && c <= '9') d = c - '0';
+		else if(c >= 'a' && c <= 'f') d = c - 'a' + 10;
+		else if(c >= 'A' && c <= 'F') d = c - 'A' + 10;
+		else{
+			p->bad = true;
+			return;
+		}
+		p->mant = (p->mant << 4) | d;
+		++p->ndig;
+		return;
+	}
+	if(c >= '0' && c <= '9'){
+		if(p->ndig < 19){
+			p->mant = p->mant * 10 + (c - '0');
+			if(p->frac) ++p->nfrac;
+		}else if(!p->frac) p->bad = true; // too large
+		++p->ndig;
+	}else if(c == '.' && !p->frac) p->frac = true;
+	else if(c == ':' && p->ndig && !p->frac){ // next sexagesimal component
+		p->acc = p->acc * 60. + (double)p->mant;
+		p->mant = 0;
+		p->ndig = 0;
+	}else if((c == '+' || c == '-') && !p->ndig && p->acc == 0. && !p->frac) p->neg = (c == '-');
+	else if((c == 'x' || c == 'X') && p->ndig == 1 && p->mant == 0 && !p->frac) p->hex = true;
+	else if(!p->ndig && !p->frac && p->acc == 0. && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))){
+		p->str[p->slen++] = c;
+	}else p->bad = true;
+}
+
+// store value parsed into field p->key
+static void val_end(bta_parser *p, bta_values *v){
+	double val;
+	if(p->key < 0 || p->bad) return;
+	if(p->slen){
+		int i, j;
+		p->str[p->slen] = 0;
+		if(strcmp(p->str, "null") == 0){ // no data: value disappeared
+			*(double*)((char*)v + key_off[p->key]) = NAN;
+			v->have &= ~(1ULL << p->key);
+			v->updated |= 1ULL << p->key;
+			return;
+		}
+		if(strcmp(p->str, "true") == 0) val = 1.;
+		else if(strcmp(p->str, "false") == 0) val = 0.;
+		else{
+			for(i = 0; i < (int)(sizeof(enums)/sizeof(enums[0])) && enums[i].key != p->key; ++i);
+			if(i == sizeof(enums)/sizeof(enums[0])) return;
+			for(j = 0; j < enums[i].n && strcmp(enums[i].str[j], p->str); ++j);
+			if(j == enums[i].n) return;
+			val = j;
+		}
+	}else{
+		if(!p->ndig) return;
+		if(p->hex) val = (double)p->mant;
+		else val = p->acc * 60. + (double)p->mant / pow10tbl[p->nfrac];
+		if(p->neg) val = -val;
+	}
+	*(double*)((char*)v + key_off[p->key]) = val;
+	v->have |= 1ULL << p->key;
+	v->updated |= 1ULL << p->key;
+}
+
+// find index of key just parsed
+static void key_end(bta_parser *p){
+	int i;
+	p->key = -1;
+	if(p->klen >= BTA_BIN_NAMELEN) return;
+	p->kname[p->klen] = 0;
+	if(p->hint < BTA_K_AMOUNT && strcmp(key_name[p->hint], p->kname) == 0) p->key = p->hint;
+	else for(i = 0; i < BTA_K_AMOUNT; ++i)
+		if(strcmp(key_name[i], p->kname) == 0){
+			p->key = i;
+			break;
+		}
+	if(p->key >= 0) p->hint = p->key + 1;
+}
+
+static inline bool isspc(char c){
+	return (c == ' ' || c == '\n' || c == '\r' || c == '\t');
+}
+
+/**
+ * parse next portion of data stream
+ * @param p - parser state
+ * @param buf, len - data
+ * @param v (io) - values (only fields found in data are changed)
+ * @param full (o) - true if object is completed
+ * @return amount of bytes used (parsing stops at end of object)
+ */
+long bta_parse(bta_parser *p, const char *buf, size_t len, bta_values *v, bool *full){
+	size_t i;
+	*full = false;
+	for(i = 0; i < len; ++i){
+		char c = buf[i];
+		switch(p->state){
+			case P_OUT:
+				if(c == '{'){
+					p->state = P_KEYWAIT;
+					p->hint = 0;
+					v->updated = 0;
+				}
+			break;
+			case P_KEYWAIT:
+				if(c == '"'){
+					p->state = P_KEY;
+					p->klen = 0;
+				}else if(c == '}'){
+					p->state = P_OUT;
+					*full = true;
+					return i + 1;
+				}else if(!isspc(c)) p->state = P_OUT;
+			break;
+			case P_KEY:
+				if(c == '"'){
+					key_end(p);
+					p->state = P_COLON;
+				}else if(p->klen < BTA_BIN_NAMELEN - 1) p->kname[p->klen++] = c;
+				else p->klen = BTA_BIN_NAMELEN; // too long: unknown key
+			break;
+			case P_COLON:
+				if(c == ':') p->state = P_VALWAIT;
+				else if(!isspc(c)) p->state = P_OUT;
+			break;
+			case P_VALWAIT:
+				if(c == '"'){
+					val_start(p);
+					p->state = P_STRVAL;
+				}else if(!isspc(c)){
+					val_start(p);
+					val_char(p, c);
+					p->state = P_BAREVAL;
+				}
+			break;
+			case P_STRVAL:
+				if(c == '"'){
+					val_end(p, v);
+					p->state = P_NEXT;
+				}else if(c == '\\') p->bad = true;
+				else val_char(p, c);
+			break;
+			case P_BAREVAL:
+				if(c != ',' && c != '}' && !isspc(c)){
+					val_char(p, c);
+					break;
+				}
+				val_end(p, v);
+				p->state = P_NEXT;
+				// FALLTHRU
+			case P_NEXT:
+				if(c == ',') p->state = P_KEYWAIT;
+				else if(c == '}'){
+					p->state = P_OUT;
+					*full = true;
+					return i + 1;
+				}else if(!isspc(c)) p->state = P_OUT;
+			break;
+		}
+	}
+	return len;
+}
+
+/**
+ * prepare client structure (connection will be opened by bta_client_get())
+ * @param host, port - bta_json address
+ * @param request - words of request (see manual)
+ * @return 0 if all OK
+ */
+int bta_client_init(bta_client *c, const char *host, const char *port, const char *request){
+	const char *w;
+	memset(c, 0, sizeof(bta_client));
+	c->fd = -1;
+	if(strlen(host) >= sizeof(c->host) || strlen(port) >= sizeof(c->port) ||
+		strlen(request) >= sizeof(c->request)) return -1;
+	strcpy(c->host, host);
+	strcpy(c->port, port);
+	strcpy(c->request, request);
+	for(w = request; *w; ){ // look for word "subscribe"
+		size_t n = strcspn(w, " &\t\n");
+		if(n == 9 && strncasecmp(w, "subscribe", 9) == 0) c->subscribe = true;
+		w += n;
+		if(*w) ++w;
+	}
+	c->pause = BTA_CLIENT_MINPAUSE;
+	bta_parser_reset(&c->parser);
+	return 0;
+}
+
+void bta_client_close(bta_client *c){
+	if(c->fd > -1) close(c->fd);
+	c->fd = -1;
+	c->pending = false;
+	c->len = c->pos = 0;
+	bta_parser_reset(&c->parser);
+}
+
+// close connection after error & schedule next attempt
+static int client_fail(bta_client *c){
+	bta_client_close(c);
+	c->nexttry = dtime() + c->pause;
+	c->pause *= 2.;
+	if(c->pause > BTA_CLIENT_MAXPAUSE) c->pause = BTA_CLIENT_MAXPAUSE;
+	return -1;
+}
+
+// wait for event on socket not longer than till `tend`
+static int client_poll(bta_client *c, short events, double tend){
+	struct pollfd pfd = {.fd = c->fd, .events = events};
+	int ret;
+	do{
+		double t = tend - dtime();
+		if(t < 0.) t = 0.;
+		ret = poll(&pfd, 1, (int)ceil(t * 1000.));
+	}while(ret < 0 && errno == EINTR);
+	if(ret < 0) return -1;
+	return ret ? pfd.revents : 0;
+}
+
+// open non-blocking connection
+static int client_connect(bta_client *c, double tend){
+	struct addrinfo h, *res, *p;
+	memset(&h, 0, sizeof(h));
+	h.ai_family = AF_INET;
+	h.ai_socktype = SOCK_STREAM;
+	if(getaddrinfo(c->host, c->port, &h, &res)) return -1;
+	for(p = res; p; p = p->ai_next){
+		int err = 0;
+		socklen_t L = sizeof(err);
+		if((c->fd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, p->ai_protocol)) < 0)
+			continue;
+		if(connect(c->fd, p->ai_addr, p->ai_addrlen) == 0) break;
+		if(errno == EINPROGRESS && client_poll(c, POLLOUT, tend) > 0 &&
+			getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &L) == 0 && err == 0) break;
+		close(c->fd);
+		c->fd = -1;
+	}
+	freeaddrinfo(res);
+	return (c->fd < 0) ? -1 : 0;
+}
+
+/**
+ * get next object from server (connect or send request if needed)
+ * @param c - client
+ * @param v (io) - values
+ * @param timeout - max time to wait, s
+ * @return 1 if object got, 0 if timeout, -1 if there's no connection
+ * 		(next attempt will be made after pause growing from
+ * 		BTA_CLIENT_MINPAUSE to BTA_CLIENT_MAXPAUSE; function waits for it
+ * 		not longer than `timeout`)
+ */
+int bta_client_get(bta_client *c, bta_values *v, double timeout){
+	double t = dtime(), tend = t + timeout;
+	if(c->fd < 0){
+		if(t < c->nexttry){ // wait for next attempt (but not longer than timeout)
+			struct timespec ts;
+			t = ((c->nexttry < tend) ? c->nexttry : tend) - t;
+			ts.tv_sec = (time_t)t;
+			ts.tv_nsec = (long)((t - ts.tv_sec) * 1e9);
+			while(nanosleep(&ts, &ts) && errno == EINTR);
+			if(dtime() < c->nexttry) return -1;
+		}
+		if(client_connect(c, tend)) return client_fail(c);
+	}
+	while(1){
+		ssize_t n;
+		int ev;
+		while(c->pos < c->len){ // data left from previous reading
+			bool full;
+			c->pos += bta_parse(&c->parser, c->buf + c->pos, c->len - c->pos, v, &full);
+			if(full){
+				if(!c->subscribe) c->pending = false;
+				c->pause = BTA_CLIENT_MINPAUSE;
+				return 1;
+			}
+		}
+		c->pos = c->len = 0;
+		if(!c->pending){
+			size_t L = strlen(c->request);
+			if(send(c->fd, c->request, L, MSG_NOSIGNAL) != (ssize_t)L) return client_fail(c);
+			c->pending = true;
+		}
+		if((ev = client_poll(c, POLLIN, tend)) == 0) return 0;
+		if(ev < 0) return client_fail(c);
+		do n = recv(c->fd, c->buf, BTA_CLIENT_BUFSZ, 0); while(n < 0 && errno == EINTR);
+		if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+		if(n <= 0) return client_fail(c); // error or server closed connection
+		c->len = n;
+	}
+}
@@ -0,0 +1,114 @@
+/*
+ * bta_client.h - streaming client library for bta_json
+ *
+ * Keeps persistent connection to bta_json (reconnecting with growing pause
+ * after errors) & parses its JSON replies incrementally straight into
+ * caller's structure bta_values: each key has a field of the same name.
+ * Nothing is allocated after bta_client_init(), sexagesimal strings are
+ * converted to numbers char by char. Units are the same as in binary
+ * format (bta_bin.h): times in seconds, angles in arcseconds, "Tel_Mode"
+ * & other string fields are indexes in arrays bta_bin_telmode[] etc.
+ *
+ *	bta_client cl;
+ *	bta_values v;
+ *	memset(&v, 0, sizeof(v));
+ *	bta_client_init(&cl, "tb.sao.ru", "12345", "subscribe period=0.1 eqcoor vel");
+ *	while(1){
+ *		if(bta_client_get(&cl, &v, 1.) != 1) continue; // no data or no connection yet
+ *		if(BTA_HAVE(&v, CurAlpha)) ... v.CurAlpha ...
+ *	}
+ *
+ * Request without word "subscribe" is sent again on each bta_client_get(),
+ * subscriber gets data which server pushes. Fields absent in object
+ * (not requested groups, unchanged values in "delta" mode) keep old values;
+ * null value (no data, e.g. "Blast10") clears field's BTA_HAVE() bit.
+ */
+#pragma once
+#ifndef __BTA_CLIENT_H__
+#define __BTA_CLIENT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "bta_bin.h"
+
+#define BTA_CLIENT_BUFSZ      4096  // size of input buffer
+#define BTA_CLIENT_STRLEN     16    // max length of string value (with trailing zero)
+#define BTA_CLIENT_MINPAUSE   0.1   // first pause before reconnection, s
+#define BTA_CLIENT_MAXPAUSE   10.   // max pause before reconnection, s
+
+// all keys of bta_json object
+#define BTA_CLIENT_KEYS(X) \
+	X(ACS_BTA)   X(M_time)    X(DUT1)      X(JDate)     X(S_time)    X(Tel_Mode) \
+	X(Tel_Focus) X(ValFoc)    X(Tel_Taget) X(P2_Mode)   X(code_KOST) X(CurAlpha) \
+	X(CurDelta)  X(SrcAlpha)  X(SrcDelta)  X(InpAlpha)  X(InpDelta)  X(TelAlpha) \
+	X(TelDelta)  X(InpRA2000) X(InpDec2000) X(CurRA2000) X(CurDec2000) X(InpAzim) \
+	X(InpZenD)   X(CurAzim)   X(CurZenD)   X(CurPA)     X(SrcPA)     X(InpPA) \
+	X(TelPA)     X(ValAzim)   X(ValZenD)   X(ValP2)     X(ValDome)   X(DiffAzim) \
+	X(DiffZenD)  X(DiffP2)    X(DiffDome)  X(VelAzim)   X(VelZenD)   X(VelP2) \
+	X(VelPA)     X(VelDome)   X(CorrAlpha) X(CorrDelta) X(CorrAzim)  X(CorrZenD) \
+	X(ValTout)   X(ValTind)   X(ValTmir)   X(ValPres)   X(ValWind)   X(ValHumd) \
+	X(Blast10)   X(Blast15)   X(Precipt)   X(Seq)
+
+// indexes of keys
+enum{
+	#define X(key) BTA_K_##key,
+	BTA_CLIENT_KEYS(X)
+	#undef X
+	BTA_K_AMOUNT
+};
+_Static_assert(BTA_K_AMOUNT <= 64, "too many keys for bta_values.have");
+
+// values of last objects received
+typedef struct{
+	#define X(key) double key;
+	BTA_CLIENT_KEYS(X)
+	#undef X
+	uint64_t have;      // bit (1 << BTA_K_xx) is set when value was received
+	uint64_t updated;   // the same for last object
+} bta_values;
+
+#define BTA_HAVE(v, key)    (((v)->have >> BTA_K_##key) & 1)
+#define BTA_UPDATED(v, key) (((v)->updated >> BTA_K_##key) & 1)
+
+// state of incremental parser
+typedef struct{
+	int state;          // where we are in object
+	int key;            // index of current key or -1 if it's unknown
+	int hint;           // index of key expected next (keys come in the same order)
+	int klen;
+	char kname[BTA_BIN_NAMELEN];
+	// value being parsed
+	bool neg;           // has leading '-'
+	bool hex;           // hexadecimal number (0x...)
+	bool frac;          // we are after decimal point
+	bool bad;           // value can't be parsed
+	int ndig;           // amount of digits in current number
+	int nfrac;          // amount of digits after decimal point
+	uint64_t mant;      // digits of current number
+	double acc;         // sexagesimal value of previous components
+	int slen;
+	char str[BTA_CLIENT_STRLEN]; // non-numeric string
+} bta_parser;
+
+typedef struct{
+	int fd;             // socket or -1
+	bool subscribe;     // server sends data itself
+	bool pending;       // request is sent, waiting for reply
+	double pause;       // current pause before reconnection
+	double nexttry;     // time of next connection attempt
+	char host[256];
+	char port[16];
+	char request[256];
+	bta_parser parser;
+	size_t len, pos;    // data in buffer & amount of data parsed
+	char buf[BTA_CLIENT_BUFSZ];
+} bta_client;
+
+void bta_parser_reset(bta_parser *p);
+long bta_parse(bta_parser *p, const char *buf, size_t len, bta_values *v, bool *full);
+int bta_client_init(bta_client *c, const char *host, const char *port, const char *request);
+int bta_client_get(bta_client *c, bta_values *v, double timeout);
+void bta_client_close(bta_client *c);
+
+#endif // __BTA_CLIENT_H__
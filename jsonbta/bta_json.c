@@ -19,59 +19,144 @@
  * MA 02110-1301, USA.
  */
 
+#define _GNU_SOURCE // accept4
 #include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/mman.h>
+#include <stddef.h> // offsetof
+#include <math.h>
+#include <time.h>
 #include "bta_json.h"
 
-// wait for child to avoid zombies
-static void wait_for_child(int sig){
-	pid_t child;
-	while((child = waitpid(-1, NULL, WNOHANG)) > 0);
+#define MAXEVENTS 64 // max amount of events for one epoll_wait()
+
+// header of reply to web client subscribed to data (Server-Sent Events)
+#define SSE_HEADER "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n" \
+	"Cache-Control: no-cache\r\nConnection: keep-alive\r\n" \
+	"Access-Control-Allow-Origin: *\r\n\r\n"
+
+// client connection
+typedef struct conn{
+	int fd;
+	bool wantout;       // waiting for EPOLLOUT to send rest of reply (connection is in list `sending`)
+	struct conn *sprev, *snext; // list of connections with unsent data
+	bool closeafter;    // close connection after reply sent
+	outbuf out;         // reply
+	bta_pars sub;       // subscription (if sub.subscribe is true)
+	unsigned long lastgen; // generation of data last sent to subscriber
+	unsigned long lastseq; // sequence number of snapshot last sent to subscriber
+	double nextpush;    // time of next periodic sending
+	struct conn *prev, *next; // list of subscribers
+	double rqtime;      // time when partial request becomes HTTP/0.9 one
+	bool waiting;       // connection is in list of waiting ones
+	struct conn *wprev, *wnext; // list of connections with partial HTTP/0.9 request
+	double tsend;       // time when sending of current reply started (0 if none)
+	size_t inlen;       // amount of data in input buffer
+	char in[INBUFSZ+1]; // requests (with trailing zero)
+} conn;
+
+static int epfd = -1; // epoll descriptor of worker
+static conn *subscribers = NULL;
+static conn *waiting = NULL;
+static conn *sending = NULL;
+static double nextcheck = 0.; // time of next subscribers check
+
+// latency histogram: counts of values <= bins[i] & count of greater ones
+typedef struct{
+	unsigned long cnt[LAT_NBINS+1];
+	double sum;
+} histogram;
+static const double lat_bins[LAT_NBINS] = {1e-5, 3e-5, 1e-4, 3e-4, 1e-3, 3e-3,
+	0.01, 0.03, 0.1, 0.3, 1., 3.};
+
+// groups of data (for counting of requests)
+static const struct{
+	const char *name;
+	size_t off; // offset of flag in bta_pars
+} groups[] = {
+	#define G(val) {#val, offsetof(bta_pars, val)}
+	G(ALL), G(mtime), G(sidtime), G(telmode), G(telfocus), G(target), G(p2mode),
+	G(eqcoor), G(horcoor), G(valsens), G(diff), G(vel), G(corr), G(meteo)
+	#undef G
+};
+#define NGROUPS (sizeof(groups)/sizeof(groups[0]))
+
+// statistics of worker; workers write only their own slots of shared array,
+// so counters are updated without locking
+typedef struct{
+	unsigned long accepted;  // connections accepted
+	unsigned long active;    // connections opened now
+	unsigned long requests[NGROUPS]; // successful requests with given group
+	unsigned long errors;    // wrong requests
+	unsigned long pushes;    // data sent to subscribers
+	unsigned long bytes;     // bytes sent
+	unsigned long slow;      // connections closed as reply wasn't sent in time
+	histogram format;        // time of making reply (make_JSON)
+	histogram send;          // time from reply start till its last byte sent
+} stats;
+static stats *allstats = NULL; // shared between workers (MAXWORKERS slots)
+static stats *st = NULL;       // slot of current worker
+
+static double dtime(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-// search a first word after needle without spaces
-char* stringscan(char *str, char *needle){
-	char *a, *e;
-	char *end = str + strlen(str);
-	a = strstr(str, needle);
-	if(!a) return NULL;
-	a += strlen(needle);
-	while (a < end && (*a == ' ' || *a == '\r' || *a == '\t' || *a == '\r')) a++;
-	if(a >= end) return NULL;
-	e = strchr(a, ' ');
-	if(e) *e = 0;
-	return a;
+static void hist_add(histogram *h, double t){
+	int i;
+	for(i = 0; i < LAT_NBINS && t > lat_bins[i]; ++i);
+	++h->cnt[i];
+	h->sum += t;
+}
+
+// request found in input buffer
+typedef struct{
+	int status;     // HTTP status (200, 400, 404, 405) or -1 for wrong non-HTTP request
+	bool header;    // reply should have HTTP header (HTTP/1.x)
+	int minor;      // minor version of HTTP/1.x
+	bool keepalive; // don't close connection after reply
+	bool head;      // method HEAD: reply without body
+	bool maybe09;   // (if request isn't full) it can be full HTTP/0.9 request
+	bool metrics;   // request of METRICS resource
+	bta_pars par;
+} request;
+
+static inline bool isdelim(char c){
+	return (c == ' ' || c == '&' || c == '\t' || c == '\n' || c == '\r');
 }
 
 /**
- * Parce data received from client
- * In case of http request we send all avaiable data
- * In case of request from client socket, parce it
+ * Parce words of request (without copying)
  * Socket's request have structure like "par1<del>par2<del>..."
  * 		where "pars" are names of bta_pars fields
- * 		<del> is delimeter: one of symbols " &\t\n"
- * @param buf - incoming data
- * @param L - length of buf
- * @param par - returned parameters structure
- */
-void parce_incoming_buf(char *buf, size_t L, bta_pars *par){
-	char *tok, *got;
-	memset(par, 0, sizeof(bta_pars));
-	DBG("got data: %s", buf);
-	// http request - send all if get == "bta_par"
-	// if get == "bta_par?a&b&c...", change buf to pars
-	if((got = stringscan(buf, "GET"))){
-		size_t LR = strlen(RESOURCE);
-		if(strcmp(got, RESOURCE) == 0){
-			par->ALL = true;
-			return;
-		}else if(strncmp(got, RESOURCE, LR) == 0) buf = &got[LR+1];
-		else exit(-1); // wrong request
-	}
-	// request from socket -> check all parameters
-	tok = strtok(buf, " &\t\n");
-	if(!tok) return;
-	do{
-		#define checkpar(val) if(strcasecmp(tok, val) == 0){par->val = true; continue;}
+ * 		<del> is delimeter: one of symbols " &\t\n\r"
+ * Words "subscribe", "onchange" & "period=T" make subscription: data is sent
+ * 		when requested blocks changed and/or every T seconds (all blocks
+ * 		if none given, "onchange" if no period given)
+ * Word "delta" adds sequence number of snapshot "Seq" to object; subscriber
+ * 		gets full object first and then only pairs changed since previous one
+ * Word "binary" turns on binary format (bta_bin.h), it isn't allowed in http
+ * @param buf - words (buffer should be zero-terminated after them)
+ * @param L - length of words
+ * @param par - parameters (only flags found are set)
+ * @return 0 if all OK or -1 for wrong request
+ */
+static int parse_words(const char *buf, size_t L, bta_pars *par){
+	const char *tok, *end = buf + L;
+	char *eptr;
+	size_t n = 0;
+	int nblocks = 0;
+	for(tok = buf; tok < end; tok += n){
+		for(; tok < end && isdelim(*tok); ++tok);
+		for(n = 0; tok + n < end && !isdelim(tok[n]); ++n);
+		if(!n) break;
+		#define WORD(w) (n == strlen(w) && strncasecmp(tok, w, n) == 0)
+		#define checkpar(val) if(WORD(val)){par->val = true; ++nblocks; continue;}
 		checkpar(vel);
 		checkpar(diff);
 		checkpar(corr);
@@ -86,92 +171,799 @@ void parce_incoming_buf(char *buf, size_t L, bta_pars *par){
 		checkpar(valsens);
 		checkpar(telfocus);
 		#undef checkpar
-	}while((tok = strtok(NULL, " &\t\n")));
+		if(WORD("subscribe")) par->subscribe = true;
+		else if(WORD("onchange")) par->onchange = true;
+		else if(WORD("delta")) par->delta = true;
+		else if(WORD("binary")) par->binary = true;
+		else if(n > 7 && strncasecmp(tok, "period=", 7) == 0){
+			par->period = strtod(tok + 7, &eptr);
+			if(eptr != tok + n || !isfinite(par->period)) return -1;
+			if(par->period < SUB_MINPERIOD) par->period = SUB_MINPERIOD;
+		}
+		#undef WORD
+	}
+	if(par->binary && par->http) return -1;
+	if(par->subscribe){
+		if(!nblocks) par->ALL = true;
+		if(par->period <= 0.) par->onchange = true;
+	}
+	return 0;
 }
 
-void handle(int newsock){
-	size_t buflen = 4095;
-	char buffer[buflen + 1];
-	bta_pars par;
-	do{
-		ssize_t readed = recv(newsock, buffer, buflen, 0);
-		if(readed < 1) break; // client closed or error
-		parce_incoming_buf(buffer, readed, &par);
-		#ifdef EBUG
-			#define checkpar(val) if(par.val){ fprintf(stderr, "par: %s\n", val); }
-			if(par.ALL){ fprintf(stderr, "par: ALL\n"); }
-			checkpar(vel);
-			checkpar(diff);
-			checkpar(corr);
-			checkpar(mtime);
-			checkpar(sidtime);
-			checkpar(meteo);
-			checkpar(target);
-			checkpar(p2mode);
-			checkpar(eqcoor);
-			checkpar(telmode);
-			checkpar(horcoor);
-			checkpar(valsens);
-			checkpar(telfocus);
-			#undef checkpar
-		#endif // EBUG
-		make_JSON(newsock, &par);
-	}while(!par.ALL);
-	close(newsock);
+/**
+ * check header line `l` (till `e`): if it is header `name`, return its value
+ * @return pointer to value or NULL
+ */
+static const char *header_val(const char *l, const char *e, const char *name){
+	size_t L = strlen(name);
+	if((size_t)(e - l) <= L || strncasecmp(l, name, L) || l[L] != ':') return NULL;
+	for(l += L + 1; l < e && (*l == ' ' || *l == '\t'); ++l);
+	return l;
 }
 
-int main(int argc, char **argv){
-	int sock;
-	struct sigaction sa;
+/**
+ * check if comma-separated list `v` (till `e`) has token `tok` (case insensitive)
+ */
+static bool has_token(const char *v, const char *e, const char *tok){
+	size_t L = strlen(tok);
+	while(v < e){
+		const char *t;
+		for(; v < e && (*v == ' ' || *v == '\t' || *v == ','); ++v);
+		for(t = v; t < e && *t != ',' && *t != ' ' && *t != '\t' && *t != '\r'; ++t);
+		if((size_t)(t - v) == L && strncasecmp(v, tok, L) == 0) return true;
+		v = t;
+		for(; v < e && *v != ','; ++v);
+	}
+	return false;
+}
+
+/**
+ * Find the first request in connection's input buffer & parse it
+ * Request from client socket is all data received (see parse_words()).
+ * HTTP request is "METHOD /url[ HTTP/1.x]\r\n[headers\r\n\r\n]":
+ * 		"GET /bta_par" gives all data, "GET /bta_par?a&b&c..." (or the old form
+ * 		"GET /bta_par&a&b...") - only given; request without version or
+ * 		without headers (old clients send only request line) gets bare
+ * 		object & connection is closed as before; HTTP/1.x request gets
+ * 		reply with header, connection is kept alive if client allows
+ * Request line without newline & version can be partial or full (old
+ * clients don't send newline), so it's full only when client sends
+ * nothing more during RQ_TMOUT seconds (`final` is true)
+ * @param buf - input buffer (zero-terminated)
+ * @param L - length of data in buf
+ * @param final - no more data will come soon
+ * @param rq (o) - request
+ * @return amount of bytes used, 0 if request isn't full yet
+ */
+static size_t parse_request(const char *buf, size_t L, bool final, request *rq){
+	const char *e = buf + L, *p, *url, *uend, *q, *ver, *nl, *hend;
+	size_t LR = strlen(RESOURCE), used;
+	bool get, head, close = false;
+	memset(rq, 0, sizeof(request));
+	DBG("got data: %s", buf);
+	// wait for the rest of request line if it can be HTTP request
+	if(L < 6 && (strncmp(buf, "GET /", L) == 0 || strncmp(buf, "HEAD /", L) == 0)) return 0;
+	for(p = buf; p < e && *p >= 'A' && *p <= 'Z'; ++p);
+	if(p == buf || p + 1 >= e || *p != ' ' || p[1] != '/'){ // request from socket
+		rq->status = parse_words(buf, L, &rq->par) ? -1 : 200;
+		return L;
+	}
+	get = (p - buf == 3 && strncmp(buf, "GET", 3) == 0);
+	head = (p - buf == 4 && strncmp(buf, "HEAD", 4) == 0);
+	rq->par.http = true;
+	url = p + 1;
+	nl = memchr(url, '\n', e - url);
+	for(uend = url; uend < e && *uend != ' ' && *uend != '\r' && *uend != '\n'; ++uend);
+	for(ver = uend; ver < e && *ver == ' '; ++ver);
+	if(ver == e || *ver == '\r' || *ver == '\n') ver = NULL;
+	if(!nl && (ver || !final)){ // request line isn't full
+		if(L < INBUFSZ){
+			rq->maybe09 = !ver;
+			return 0;
+		}
+		rq->status = 400;
+		return L;
+	}
+	used = nl ? (size_t)(nl + 1 - buf) : L;
+	if(ver && nl + 1 < e){ // HTTP/1.x with headers
+		rq->header = true;
+		if(strncmp(ver, "HTTP/1.", 7) || ver[7] < '0' || ver[7] > '9'){
+			rq->status = 400;
+			return L;
+		}
+		rq->minor = ver[7] - '0';
+		// look through headers till empty line
+		for(q = nl + 1, hend = NULL; q < e; q = nl + 1){
+			const char *v, *le;
+			if(!(nl = memchr(q, '\n', e - q))) break;
+			le = (nl > q && nl[-1] == '\r') ? nl - 1 : nl;
+			if(le == q){
+				hend = nl + 1;
+				break;
+			}
+			if((v = header_val(q, le, "Connection"))){
+				if(has_token(v, le, "close")) close = true;
+				else if(has_token(v, le, "keep-alive")) rq->keepalive = true;
+			}else if(((v = header_val(q, le, "Content-Length")) && atol(v) != 0) ||
+				header_val(q, le, "Transfer-Encoding")){ // we don't accept request body
+				rq->status = 400;
+				return L;
+			}
+		}
+		if(!hend){
+			if(L < INBUFSZ) return 0;
+			rq->status = 400;
+			return L;
+		}
+		used = hend - buf;
+		if(rq->minor > 0 && !close) rq->keepalive = true;
+		if(close) rq->keepalive = false;
+	}
+	if(!get && !head) rq->status = 405;
+	else if(strncmp(url, METRICS, uend - url) == 0 && uend - url == (ssize_t)strlen(METRICS)){
+		rq->metrics = true;
+		rq->status = 200;
+	}else if((size_t)(uend - url) < LR || strncmp(url, RESOURCE, LR) ||
+		(uend - url > (ssize_t)LR && url[LR] != '?' && url[LR] != '&')) rq->status = 404;
+	else if(uend - url == (ssize_t)LR){ // all data
+		rq->par.ALL = true;
+		rq->status = 200;
+	}else rq->status = parse_words(url + LR + 1, uend - url - LR - 1, &rq->par) ? 400 : 200;
+	rq->head = head;
+	return used;
+}
+
+/**
+ * add data to output buffer (enlarge it if needed)
+ * @return 0 if all OK
+ */
+int ob_add(outbuf *ob, const char *data, size_t L){
+	if(ob->len + L > ob->size){
+		size_t newsz = ob->size ? ob->size : OBUFSZ;
+		char *newbuf;
+		while(newsz < ob->len + L) newsz *= 2;
+		if(!(newbuf = realloc(ob->buf, newsz))) return -1;
+		ob->buf = newbuf;
+		ob->size = newsz;
+	}
+	memcpy(ob->buf + ob->len, data, L);
+	ob->len += L;
+	return 0;
+}
+
+/**
+ * printf into output buffer (not more than 255 symbols)
+ * @return 0 if all OK
+ */
+int ob_printf(outbuf *ob, const char *fmt, ...){
+	char buf[256];
+	va_list ap;
+	int L;
+	va_start(ap, fmt);
+	L = vsnprintf(buf, 256, fmt, ap);
+	va_end(ap);
+	if(L < 0) return -1;
+	if(L > 255) L = 255;
+	return ob_add(ob, buf, L);
+}
+
+static void sub_add(conn *c){
+	c->prev = NULL;
+	c->next = subscribers;
+	if(subscribers) subscribers->prev = c;
+	subscribers = c;
+	nextcheck = 0.;
+}
+
+static void sub_del(conn *c){
+	if(c->prev) c->prev->next = c->next;
+	else subscribers = c->next;
+	if(c->next) c->next->prev = c->prev;
+	c->prev = c->next = NULL;
+	c->sub.subscribe = false;
+}
+
+static void wait_add(conn *c){
+	c->wprev = NULL;
+	c->wnext = waiting;
+	if(waiting) waiting->wprev = c;
+	waiting = c;
+	c->waiting = true;
+	c->rqtime = dtime() + RQ_TMOUT;
+}
+
+static void wait_del(conn *c){
+	if(c->wprev) c->wprev->wnext = c->wnext;
+	else waiting = c->wnext;
+	if(c->wnext) c->wnext->wprev = c->wprev;
+	c->wprev = c->wnext = NULL;
+	c->waiting = false;
+}
+
+static void send_add(conn *c){
+	c->sprev = NULL;
+	c->snext = sending;
+	if(sending) sending->sprev = c;
+	sending = c;
+	if(!c->tsend) c->tsend = dtime();
+}
+
+static void send_del(conn *c){
+	if(c->sprev) c->sprev->snext = c->snext;
+	else sending = c->snext;
+	if(c->snext) c->snext->sprev = c->sprev;
+	c->sprev = c->snext = NULL;
+}
+
+static void conn_close(conn *c){
+	DBG("close connection %d", c->fd);
+	if(c->sub.subscribe) sub_del(c);
+	if(c->waiting) wait_del(c);
+	if(c->wantout) send_del(c);
+	--st->active;
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	free(c->out.buf);
+	free(c);
+}
+
+/**
+ * send as much of reply as socket can get now; the rest is sent
+ * when socket is ready (new requests aren't read until reply sent,
+ * subscriber gets only the latest snapshot after that)
+ * @return -1 if connection should be closed
+ */
+static int conn_flush(conn *c){
+	struct epoll_event ev;
+	if(c->out.len - c->out.pos > OBUFMAX){ // queue is full
+		++st->slow;
+		return -1;
+	}
+	while(c->out.pos < c->out.len){
+		ssize_t n = send(c->fd, c->out.buf + c->out.pos, c->out.len - c->out.pos, MSG_NOSIGNAL);
+		if(n < 0){
+			if(errno == EINTR) continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+			return -1;
+		}
+		c->out.pos += n;
+		st->bytes += n;
+	}
+	bool wantout = (c->out.pos < c->out.len);
+	if(!wantout){
+		c->out.len = c->out.pos = 0;
+		if(c->tsend){
+			hist_add(&st->send, dtime() - c->tsend);
+			c->tsend = 0.;
+		}
+		if(c->closeafter) return -1;
+	}
+	if(wantout != c->wantout){
+		ev.events = wantout ? EPOLLOUT : EPOLLIN;
+		ev.data.ptr = c;
+		if(epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev)) return -1;
+		c->wantout = wantout;
+		if(wantout) send_add(c);
+		else{
+			send_del(c);
+			if(c->sub.subscribe) nextcheck = 0.; // send the latest data at once
+		}
+	}
+	return 0;
+}
+
+/**
+ * send reply made of cache pieces with one syscall (if nothing is queued);
+ * unsent part is copied into connection's buffer as cache can change
+ * before socket will be ready
+ * @param hdr, hlen - HTTP header to send before reply (or NULL)
+ * @return -1 if connection should be closed
+ */
+static int conn_reply(conn *c, json_reply *r, const char *hdr, size_t hlen){
+	struct iovec iov[JSON_MAXIOV+1];
+	size_t sent = 0;
+	int i, niov = 0;
+	if(hdr){
+		iov[niov].iov_base = (void*)hdr;
+		iov[niov++].iov_len = hlen;
+	}
+	for(i = 0; i < r->iovcnt; ++i) iov[niov++] = r->iov[i];
+	if(!c->tsend) c->tsend = dtime();
+	if(c->out.len == 0){
+		struct msghdr msg;
+		ssize_t n;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = niov;
+		do n = sendmsg(c->fd, &msg, MSG_NOSIGNAL); while(n < 0 && errno == EINTR);
+		if(n < 0){
+			if(errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+			n = 0;
+		}
+		sent = n;
+		st->bytes += n;
+	}
+	for(i = 0; i < niov; ++i){
+		size_t L = iov[i].iov_len;
+		if(sent >= L){
+			sent -= L;
+			continue;
+		}
+		if(ob_add(&c->out, (char*)iov[i].iov_base + sent, L - sent)) return -1;
+		sent = 0;
+	}
+	return conn_flush(c);
+}
+
+/**
+ * send data to subscriber: as is for socket clients and as SSE event
+ * ("data: " before each line of object, empty line after) for web clients
+ * @return -1 if connection should be closed
+ */
+static int conn_push(conn *c, json_reply *r){
+	bool bol = true;
+	int i;
+	c->lastgen = r->gen;
+	c->lastseq = r->seq;
+	++st->pushes;
+	if(!c->sub.http) return conn_reply(c, r, NULL, 0);
+	if(!c->tsend) c->tsend = dtime();
+	if(c->sub.delta && ob_printf(&c->out, "id: %lu\n", r->seq)) return -1;
+	for(i = 0; i < r->iovcnt; ++i){
+		char *p = r->iov[i].iov_base, *e = p + r->iov[i].iov_len;
+		while(p < e){
+			char *nl = memchr(p, '\n', e - p);
+			size_t L = nl ? (size_t)(nl - p + 1) : (size_t)(e - p);
+			if(bol && ob_add(&c->out, "data: ", 6)) return -1;
+			if(ob_add(&c->out, p, L)) return -1;
+			bol = (nl != NULL);
+			p += L;
+		}
+	}
+	if(ob_add(&c->out, "\n", 1)) return -1;
+	return conn_flush(c);
+}
+
+/**
+ * make_JSON() with measurement of its time
+ */
+static int format_JSON(bta_pars *par, unsigned long since, json_reply *r){
+	double t0 = dtime();
+	int ret = make_JSON(par, since, r);
+	hist_add(&st->format, dtime() - t0);
+	return ret;
+}
+
+/**
+ * send new data to subscribers which period passed or which data changed;
+ * subscribers still sending previous portion are skipped
+ * @return timeout for epoll_wait() (ms), -1 if there's no subscribers
+ */
+static int push_subscribers(){
+	double now = dtime(), tnext = -1.;
+	conn *c, *nxt;
+	if(!subscribers) return -1;
+	if(now < nextcheck) return (int)ceil((nextcheck - now) * 1000.);
+	for(c = subscribers; c; c = nxt){
+		json_reply r;
+		bool due = (c->sub.period > 0. && now >= c->nextpush);
+		nxt = c->next;
+		// previous portion isn't sent yet: intermediate snapshots are skipped,
+		// the latest one will be sent when output buffer is empty
+		if(c->out.len) continue;
+		if(due || c->sub.onchange){
+			int ret = format_JSON(&c->sub, c->lastseq, &r);
+			if(!ret && (due || r.gen != c->lastgen)){
+				if(due){
+					c->nextpush += c->sub.period;
+					if(c->nextpush < now) c->nextpush = now + c->sub.period;
+				}
+				ret = conn_push(c, &r);
+			}
+			if(ret){
+				conn_close(c);
+				continue;
+			}
+		}
+		if(c->sub.onchange && (tnext < 0. || tnext > now + SUB_POLL)) tnext = now + SUB_POLL;
+		if(c->sub.period > 0. && (tnext < 0. || tnext > c->nextpush)) tnext = c->nextpush;
+	}
+	if(tnext < 0.) return -1;
+	nextcheck = tnext;
+	return (int)ceil((tnext - now) * 1000.);
+}
+
+/**
+ * send HTTP reply with error status
+ * @return -1 if connection should be closed
+ */
+static int conn_error(conn *c, request *rq){
+	const char *txt = (rq->status == 400) ? "Bad Request" :
+		(rq->status == 404) ? "Not Found" : "Method Not Allowed";
+	char body[64];
+	int L = snprintf(body, sizeof(body), "%d %s\n", rq->status, txt);
+	if(rq->status == 400) rq->keepalive = false; // we can't find next request
+	if(!c->tsend) c->tsend = dtime();
+	if(ob_printf(&c->out, "HTTP/1.%d %d %s\r\nContent-Type: text/plain\r\n"
+		"Content-Length: %d\r\n%sConnection: %s\r\n\r\n", rq->minor, rq->status, txt, L,
+		(rq->status == 405) ? "Allow: GET, HEAD\r\n" : "",
+		rq->keepalive ? "keep-alive" : "close")) return -1;
+	if(!rq->head && ob_add(&c->out, body, L)) return -1;
+	if(!rq->keepalive) c->closeafter = true;
+	return conn_flush(c);
+}
+
+// print histogram `h` of all workers as metric `name`
+static int print_hist(outbuf *ob, const char *name, const char *help, size_t off, int nw){
+	unsigned long cnt = 0;
+	double sum = 0.;
+	int i, w;
+	if(ob_printf(ob, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name)) return -1;
+	for(i = 0; i <= LAT_NBINS; ++i){
+		for(w = 0; w < nw; ++w) cnt += ((histogram*)((char*)&allstats[w] + off))->cnt[i];
+		if(i < LAT_NBINS){
+			if(ob_printf(ob, "%s_bucket{le=\"%g\"} %lu\n", name, lat_bins[i], cnt)) return -1;
+		}else if(ob_printf(ob, "%s_bucket{le=\"+Inf\"} %lu\n", name, cnt)) return -1;
+	}
+	for(w = 0; w < nw; ++w) sum += ((histogram*)((char*)&allstats[w] + off))->sum;
+	return ob_printf(ob, "%s_sum %.9f\n%s_count %lu\n", name, sum, name, cnt);
+}
+
+/**
+ * send statistics of all workers in text exposition format (Prometheus)
+ * @return -1 if connection should be closed
+ */
+static int conn_metrics(conn *c, request *rq){
+	static outbuf ob;
+	char hdr[256];
+	unsigned long sum;
+	size_t g;
+	int hlen, w, nw = MAXWORKERS;
+	double age = shm_age();
+	ob.len = 0;
+	#define COUNTER(name, type, help, field) do{ \
+		for(sum = 0, w = 0; w < nw; ++w) sum += allstats[w].field; \
+		if(ob_printf(&ob, "# HELP " name " " help "\n# TYPE " name " " type "\n" name " %lu\n", sum)) return -1; \
+	}while(0)
+	COUNTER("bta_json_connections_accepted_total", "counter", "Connections accepted.", accepted);
+	COUNTER("bta_json_connections_active", "gauge", "Connections opened now.", active);
+	if(ob_printf(&ob, "# HELP bta_json_requests_total Successful data requests by group (ALL - all data).\n"
+		"# TYPE bta_json_requests_total counter\n")) return -1;
+	for(g = 0; g < NGROUPS; ++g){
+		for(sum = 0, w = 0; w < nw; ++w) sum += allstats[w].requests[g];
+		if(ob_printf(&ob, "bta_json_requests_total{group=\"%s\"} %lu\n", groups[g].name, sum)) return -1;
+	}
+	COUNTER("bta_json_bad_requests_total", "counter", "Wrong requests.", errors);
+	COUNTER("bta_json_pushes_total", "counter", "Data portions sent to subscribers.", pushes);
+	COUNTER("bta_json_sent_bytes_total", "counter", "Bytes sent to clients.", bytes);
+	COUNTER("bta_json_slow_clients_total", "counter", "Connections closed as reply wasn't sent in time.", slow);
+	#undef COUNTER
+	if(print_hist(&ob, "bta_json_format_seconds", "Time of making reply from snapshot.",
+		offsetof(stats, format), nw)) return -1;
+	if(print_hist(&ob, "bta_json_send_seconds", "Time from reply start till its last byte sent.",
+		offsetof(stats, send), nw)) return -1;
+	if(ob_printf(&ob, "# HELP bta_json_shm_age_seconds Wall clock (UTC) minus M_time of data served.\n"
+		"# TYPE bta_json_shm_age_seconds gauge\nbta_json_shm_age_seconds ")) return -1;
+	if(isnan(age) ? ob_add(&ob, "NaN\n", 4) : ob_printf(&ob, "%.3f\n", age)) return -1;
+	if(!c->tsend) c->tsend = dtime();
+	if(rq->header){
+		hlen = snprintf(hdr, sizeof(hdr), "HTTP/1.%d 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %zu\r\nConnection: %s\r\n\r\n",
+			rq->minor, ob.len, rq->keepalive ? "keep-alive" : "close");
+		if(ob_add(&c->out, hdr, hlen)) return -1;
+	}
+	if(!rq->keepalive) c->closeafter = true;
+	if(!rq->head && ob_add(&c->out, ob.buf, ob.len)) return -1;
+	return conn_flush(c);
+}
+
+/**
+ * make reply to request
+ * @return -1 if connection should be closed
+ */
+static int conn_request(conn *c, request *rq){
+	bta_pars *par = &rq->par;
+	json_reply r;
+	char hdr[256];
+	int hlen;
+	size_t g;
+	#ifdef EBUG
+		#define checkpar(val) if(par->val){ fprintf(stderr, "par: %s\n", val); }
+		fprintf(stderr, "status: %d, header: %d, keepalive: %d\n", rq->status, rq->header, rq->keepalive);
+		if(par->ALL){ fprintf(stderr, "par: ALL\n"); }
+		checkpar(vel);
+		checkpar(diff);
+		checkpar(corr);
+		checkpar(mtime);
+		checkpar(sidtime);
+		checkpar(meteo);
+		checkpar(target);
+		checkpar(p2mode);
+		checkpar(eqcoor);
+		checkpar(telmode);
+		checkpar(horcoor);
+		checkpar(valsens);
+		checkpar(telfocus);
+		#undef checkpar
+		if(par->subscribe) fprintf(stderr, "subscribe: period=%g, onchange=%d, delta=%d\n",
+			par->period, par->onchange, par->delta);
+		if(par->binary) fprintf(stderr, "binary format\n");
+	#endif // EBUG
+	if(rq->status != 200){
+		++st->errors;
+		if(!rq->header) return -1; // old behaviour: close connection
+		return conn_error(c, rq);
+	}
+	if(c->sub.subscribe) sub_del(c); // any new request cancels subscription
+	if(rq->metrics) return conn_metrics(c, rq);
+	for(g = 0; g < NGROUPS; ++g)
+		if(*(bool*)((char*)par + groups[g].off)) ++st->requests[g];
+	if(format_JSON(par, 0, &r)) return -1;
+	if(par->subscribe){
+		c->sub = *par;
+		c->nextpush = dtime() + par->period;
+		sub_add(c);
+		if(par->http && ob_add(&c->out, SSE_HEADER, sizeof(SSE_HEADER)-1)) return -1;
+		return conn_push(c, &r);
+	}
+	if(!rq->header){
+		if(par->http) c->closeafter = true;
+		return conn_reply(c, &r, NULL, 0);
+	}
+	hlen = snprintf(hdr, sizeof(hdr), "HTTP/1.%d 200 OK\r\nContent-Type: application/json\r\n"
+		"Content-Length: %zu\r\nAccess-Control-Allow-Origin: *\r\nConnection: %s\r\n\r\n",
+		rq->minor, r.len, rq->keepalive ? "keep-alive" : "close");
+	if(!rq->keepalive) c->closeafter = true;
+	if(rq->head) r.iovcnt = 0;
+	return conn_reply(c, &r, hdr, hlen);
+}
+
+/**
+ * process all full requests in input buffer; stop if reply can't be sent
+ * at once (the rest is processed when output buffer is empty)
+ * @param final - client sends nothing during RQ_TMOUT
+ * @return -1 if connection should be closed
+ */
+static int conn_process(conn *c, bool final){
+	if(c->waiting) wait_del(c);
+	while(c->inlen && !c->out.len && !c->closeafter){
+		request rq;
+		size_t L = parse_request(c->in, c->inlen, final, &rq);
+		if(!L){
+			if(rq.maybe09) wait_add(c);
+			break;
+		}
+		c->inlen -= L;
+		memmove(c->in, c->in + L, c->inlen + 1);
+		if(conn_request(c, &rq)) return -1;
+	}
+	return 0;
+}
+
+/**
+ * read requests from client & send replies
+ * @return -1 if connection should be closed
+ */
+static int conn_read(conn *c){
+	ssize_t readed = recv(c->fd, c->in + c->inlen, INBUFSZ - c->inlen, 0);
+	if(readed == 0) return -1; // client closed
+	if(readed < 0) return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+	c->inlen += readed;
+	c->in[c->inlen] = 0;
+	return conn_process(c, false);
+}
+
+/**
+ * process partial requests of clients which sent nothing during RQ_TMOUT
+ * @return timeout for epoll_wait() (ms), -1 if there's no such clients
+ */
+static int check_waiting(){
+	double now = dtime(), tnext = -1.;
+	conn *c, *nxt;
+	for(c = waiting; c; c = nxt){
+		nxt = c->wnext;
+		if(now >= c->rqtime){
+			if(conn_process(c, true)) conn_close(c);
+		}else if(tnext < 0. || c->rqtime < tnext) tnext = c->rqtime;
+	}
+	if(tnext < 0.) return -1;
+	return (int)ceil((tnext - now) * 1000.);
+}
+
+/**
+ * close connections which can't get reply during SEND_TMOUT
+ * @return timeout for epoll_wait() (ms), -1 if there's no connections with unsent data
+ */
+static int check_sending(){
+	double now = dtime(), tnext = -1.;
+	conn *c, *nxt;
+	for(c = sending; c; c = nxt){
+		nxt = c->snext;
+		if(now >= c->tsend + SEND_TMOUT){
+			DBG("connection %d is too slow", c->fd);
+			++st->slow;
+			conn_close(c);
+		}else if(tnext < 0. || c->tsend + SEND_TMOUT < tnext) tnext = c->tsend + SEND_TMOUT;
+	}
+	if(tnext < 0.) return -1;
+	return (int)ceil((tnext - now) * 1000.);
+}
+
+static void accept_clients(int sock){
+	struct epoll_event ev;
+	while(1){
+		int newsock = accept4(sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		conn *c;
+		if(newsock == -1){
+			if(errno == EINTR || errno == ECONNABORTED) continue;
+			if(errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+			return;
+		}
+		if(!(c = calloc(1, sizeof(conn)))){
+			close(newsock);
+			continue;
+		}
+		c->fd = newsock;
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		if(epoll_ctl(epfd, EPOLL_CTL_ADD, newsock, &ev)){
+			perror("epoll_ctl");
+			close(newsock);
+			free(c);
+			continue;
+		}
+		++st->accepted;
+		++st->active;
+		DBG("new connection %d", newsock);
+	}
+}
+
+/**
+ * open listening socket; each worker has its own socket bound to the same
+ * port (SO_REUSEPORT), so kernel spreads connections between workers
+ * @return socket fd or -1
+ */
+static int open_socket(bool verbose){
+	int sock = -1;
 	struct addrinfo hints, *res, *p;
 	int reuseaddr = 1;
-	check4running(argv, PIDFILE, NULL);
 	memset(&hints, 0, sizeof(hints));
 	hints.ai_family = AF_INET;
 	hints.ai_socktype = SOCK_STREAM;
 	hints.ai_flags = AI_PASSIVE;
 	if(getaddrinfo(NULL, PORT, &hints, &res) != 0){
 		perror("getaddrinfo");
-		return 1;
+		return -1;
+	}
+	if(verbose){
+		struct sockaddr_in *ia = (struct sockaddr_in*)res->ai_addr;
+		char str[INET_ADDRSTRLEN];
+		inet_ntop(AF_INET, &(ia->sin_addr), str, INET_ADDRSTRLEN);
+		printf("port: %u, addr: %s\n", ntohs(ia->sin_port), str);
 	}
-	struct sockaddr_in *ia = (struct sockaddr_in*)res->ai_addr;
-	char str[INET_ADDRSTRLEN];
-	inet_ntop(AF_INET, &(ia->sin_addr), str, INET_ADDRSTRLEN);
-	printf("port: %u, addr: %s\n", ntohs(ia->sin_port), str);
 	// loop through all the results and bind to the first we can
 	for(p = res; p != NULL; p = p->ai_next){
-		if((sock = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1){
+		if((sock = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, p->ai_protocol)) == -1){
 			perror("socket");
 			continue;
 		}
-		if(setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof(int)) == -1){
+		if(setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof(int)) == -1 ||
+			setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &reuseaddr, sizeof(int)) == -1){
 			perror("setsockopt");
-			return -1;
+			close(sock);
+			sock = -1;
+			break;
 		}
 		if(bind(sock, p->ai_addr, p->ai_addrlen) == -1){
 			close(sock);
+			sock = -1;
 			perror("bind");
 			continue;
 		}
 		break; // if we get here, we must have connected successfully
 	}
-	if(p == NULL){
+	freeaddrinfo(res);
+	if(sock < 0){
 		// looped off the end of the list with no successful bind
 		fprintf(stderr, "failed to bind socket\n");
-		exit(2);
+		return -1;
 	}
 	// Listen
 	if(listen(sock, BACKLOG) == -1) {
 		perror("listen");
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/**
+ * worker process: serve all its clients in one epoll loop
+ * (SHM segment is attached & JSON rendered once by make_JSON)
+ * @param slot - index of worker's statistics in `allstats`
+ */
+static void worker(int slot){
+	struct epoll_event ev, events[MAXEVENTS];
+	int i, n, sock = open_socket(false);
+	if(sock < 0) exit(2);
+	st = &allstats[slot];
+	st->active = 0; // connections of dead worker were closed
+	if((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1){
+		perror("epoll_create1");
+		exit(1);
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL; // listening socket
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev)){
+		perror("epoll_ctl");
+		exit(1);
+	}
+	while(1){
+		int t = push_subscribers(), t1 = check_waiting(), t2 = check_sending();
+		if(t < 0 || (t1 >= 0 && t1 < t)) t = t1;
+		if(t < 0 || (t2 >= 0 && t2 < t)) t = t2;
+		if((n = epoll_wait(epfd, events, MAXEVENTS, t)) < 0){
+			if(errno == EINTR) continue;
+			perror("epoll_wait");
+			exit(1);
+		}
+		for(i = 0; i < n; ++i){
+			conn *c = (conn*)events[i].data.ptr;
+			int ret = 0;
+			if(!c){
+				accept_clients(sock);
+				continue;
+			}
+			if(events[i].events & (EPOLLERR | EPOLLHUP)) ret = -1;
+			else if(events[i].events & EPOLLOUT){
+				ret = conn_flush(c);
+				if(!ret && !c->wantout) ret = conn_process(c, false); // pipelined requests
+			}
+			else if(events[i].events & EPOLLIN) ret = conn_read(c);
+			if(ret) conn_close(c);
+		}
+	}
+}
+
+static pid_t start_worker(int slot){
+	pid_t pid = fork();
+	if(pid == 0){
+		prctl(PR_SET_PDEATHSIG, SIGTERM); // die with master process
+		worker(slot);
+		exit(0);
+	}
+	if(pid == -1) perror("fork");
+	else{
+		DBG("Create worker: %d", pid);
+	}
+	return pid;
+}
+
+int main(int argc, char **argv){
+	int i, sock, nworkers = 1;
+	pid_t pids[MAXWORKERS];
+	check4running(argv, PIDFILE, NULL);
+	for(i = 1; i < argc; ++i){
+		if(strncmp(argv[i], "workers=", 8) == 0) nworkers = atoi(argv[i] + 8);
+		else{
+			fprintf(stderr, "Usage: %s [workers=N]\n", argv[0]);
+			fprintf(stderr, "\tworkers - amount of worker processes (1..%d, default 1)\n", MAXWORKERS);
+			return 1;
+		}
+	}
+	if(nworkers < 1 || nworkers > MAXWORKERS){
+		fprintf(stderr, "Wrong amount of workers: %d\n", nworkers);
 		return 1;
 	}
-	freeaddrinfo(res);
-	// Set up the signal handler
-	sa.sa_handler = wait_for_child;
-	sigemptyset(&sa.sa_mask);
-	sa.sa_flags = SA_RESTART;
-	if (sigaction(SIGCHLD, &sa, NULL) == -1) {
-		perror("sigaction");
+	// check that port is free before daemonizing
+	if((sock = open_socket(true)) < 0) return 1;
+	close(sock);
+	signal(SIGPIPE, SIG_IGN);
+	// statistics of all workers (for METRICS)
+	allstats = mmap(NULL, MAXWORKERS * sizeof(stats), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(allstats == MAP_FAILED){
+		perror("mmap");
 		return 1;
 	}
 	// OK, all done, now we can daemonize
@@ -181,29 +973,25 @@ int main(int argc, char **argv){
 			exit(1);
 		}
 	#endif // EBUG
-	// Main loop
+	if(nworkers == 1){ // serve all clients in main process
+		worker(0);
+		return 0;
+	}
+	for(i = 0; i < nworkers; ++i)
+		if((pids[i] = start_worker(i)) == -1) return 1;
+	// restart dead workers
 	while(1){
-		struct sockaddr_in their_addr;
-		socklen_t size = sizeof(struct sockaddr_in);
-		int newsock = accept(sock, (struct sockaddr*)&their_addr, &size);
-		int pid;
-		if(newsock == -1) return 0;
-		pid = fork();
-		if(pid == 0){
-			// Child process
-			close(sock);
-			handle(newsock);
-			return 0;
-		}else{
-			// Parent process
-			if(pid == -1) return 1;
-			else{
-				close(newsock);
-				DBG("Create child: %d", pid);
-			}
+		pid_t pid = wait(NULL);
+		if(pid == -1){
+			if(errno == EINTR) continue;
+			perror("wait");
+			return 1;
 		}
+		DBG("Worker %d died", pid);
+		sleep(1);
+		for(i = 0; i < nworkers && pids[i] != pid; ++i);
+		if(i < nworkers) pids[i] = start_worker(i);
 	}
-	close(sock);
 	return 0;
 }
 
@@ -34,11 +34,25 @@
 #include <sys/wait.h>
 #include <netdb.h>
 #include <stdbool.h>
+#include <sys/uio.h>
 
 #define RESOURCE "/bta_par" // resource to request in http
+#define METRICS  "/metrics" // resource with server statistics (text exposition format)
 #define PORT    "12345" // Port to listen on
-#define BACKLOG     10  // Passed to listen()
+#define BACKLOG     128 // Passed to listen()
 #define PIDFILE "/tmp/btajson.pid" // PID file
+#define MAXWORKERS  64  // max amount of worker processes
+#define INBUFSZ     8191 // size of connection's input buffer (max request length)
+#define OBUFSZ      4096 // initial size of connection's output buffer
+#define OBUFMAX  (64*1024) // max amount of unsent data of connection
+#define SEND_TMOUT  30. // max time of sending one reply, s (slower clients are disconnected)
+#define JSON_MAXKEYS 96 // max amount of pairs "key: value" in object
+#define JSON_MAXIOV (JSON_MAXKEYS+4) // max amount of pieces in reply (pairs, beginning & end)
+#define JSON_HDRSZ  16  // size of header of binary reply (BTA_BIN_HDRSZ)
+#define SUB_MINPERIOD 0.05 // min period of subscription, s
+#define SUB_POLL    0.02 // period of checking data for "onchange" subscribers, s
+#define RQ_TMOUT    0.1 // max pause inside request line without newline, s
+#define LAT_NBINS   12  // amount of finite bins of latency histograms
 
 #ifdef EBUG // debug mode
 	#define DBG(...)  do{fprintf(stderr, __VA_ARGS__); fprintf(stderr,"\n");}while(0)
@@ -61,6 +75,13 @@ typedef struct{
 	bool telmode;
 	bool valsens;
 	bool vel;
+	// not data blocks
+	bool http;      // request came from web client
+	bool subscribe; // send data to client regularly
+	bool onchange;  // subscription: send data when any of blocks changed
+	double period;  // subscription: send data each `period` seconds
+	bool delta;     // send only changed pairs with sequence number of snapshot
+	bool binary;    // binary format (bta_bin.h)
 } bta_pars;
 
 // named parameters
@@ -84,7 +105,29 @@ defpar(corr);
 defpar(meteo);
 #undef defpar
 
-void make_JSON(int sock, bta_pars *par); // bta_print.c
+// output buffer of connection
+typedef struct{
+	char *buf;
+	size_t len;  // length of data
+	size_t size; // allocated size
+	size_t pos;  // amount of data already sent
+} outbuf;
+
+int ob_add(outbuf *ob, const char *data, size_t L); // bta_json.c
+int ob_printf(outbuf *ob, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// reply to client: pieces of rendered snapshot
+typedef struct{
+	struct iovec iov[JSON_MAXIOV];
+	int iovcnt;
+	size_t len;  // total length
+	unsigned long gen; // generation of requested blocks (changed when they changed)
+	unsigned long seq; // sequence number of snapshot
+	unsigned char hdr[JSON_HDRSZ]; // header of binary data message
+} json_reply;
+
+int make_JSON(bta_pars *par, unsigned long since, json_reply *r); // bta_print.c
+double shm_age(); // bta_print.c
 void check4running(char **argv, char *pidfilename, void (*iffound)(pid_t pid)); // daemon.h
 
 #endif // __BTA_JSON_H__
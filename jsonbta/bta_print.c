@@ -22,6 +22,7 @@
  */
 
 #include <stdlib.h>
+#include <stddef.h> // offsetof
 #include <errno.h>
 #include <math.h>
 #include <time.h>
@@ -34,9 +35,12 @@
 
 //#include "sofa.h"
 
-#include "bta_shdata.h"
+// bta_json.h goes first: bta_shdata.h sets "#pragma pack(4)" for SHM structures
 #define BTA_PRINT_C
 #include "bta_json.h"
+#include "bta_shdata.h"
+#include "bta_fields.h"
+#include "bta_bin.h"
 
 #define BUFSZ 255
 static char buf[BUFSZ+1];
@@ -199,6 +203,27 @@ void calc2000(double *ra, double *dec){
 		 polarX, polarY, Pressure/0.76, Temper, val_Hmd/100.);
 }*/
 
+/**
+ * JSON representation of table field value
+ */
+static char *field_json(const BTA_Field *f){
+	char tmp[32];
+	double v = bta_field_val(f, sdt);
+	switch(f->kind){
+		case BTA_F_TIME:
+			return time_asc(v);
+		case BTA_F_ANGLE:
+			return f->fmt ? angle_fmt(v, (char*)f->fmt) : angle_asc(v);
+		case BTA_F_CODE:
+			snprintf(tmp, 32, f->fmt, (uint32_t)v);
+			snprintf(buf, BUFSZ, "\"%s\"", tmp);
+			return buf;
+		default:
+			double_asc(v, (char*)f->fmt);
+			return (*buf == '+') ? buf + 1 : buf; // JSON numbers can't have leading '+'
+	}
+}
+
 extern void sla_amp(double*, double*, double*, double*, double*, double*);
 
 void slaamp(double ra, double da, double date, double eq, double *rm, double *dm ){
@@ -224,154 +249,185 @@ void calc_mean(double appRA, double appDecl, double *r, double *d){
 	if(d) *d = dec;
 }
 
-void make_JSON(int sock, bta_pars *par){
-	bool ALL = par->ALL;
-	// print next JSON pair; par, val - strings
-	void sendstr(char *str){
-		size_t L = strlen(str);
-		if(send(sock, str, L, 0) != L) exit(-1);
-	}
-	int json_send(char *par, char *val){
-		char buf[256];
-		int L = snprintf(buf, 255, ",\n\"%s\": %s", par, val);
-		if(send(sock, buf, L, 0) != L) return -1;
-		return 0;
+/**
+ * attach SHM segment once for all clients
+ * (once a second check whether server recreated it)
+ * @return 0 if segment attached
+ */
+static int attach_shm(){
+	static time_t tcheck = 0;
+	time_t now = time(NULL);
+	int id;
+	if(sdat.addr && now == tcheck) return 0;
+	tcheck = now;
+	id = shmget(sdat.key.code, sdat.size, sdat.mode);
+	if(sdat.addr && id == sdat.id) return 0;
+	if(sdat.addr){ // segment removed or changed
+		shmdt(sdat.addr);
+		sdat.addr = NULL;
 	}
-	int json_send_s(char *par, char *val){
-		char buf[256];
-		int L = snprintf(buf, 255, ",\n\"%s\": \"%s\"", par, val);
-		if(send(sock, buf, L, 0) != L) return -1;
-		return 0;
+	if(id < 0) return -1;
+	get_shm_block(&sdat, ClientSide);
+	return 0;
+}
+
+/*
+ * binary representation of rendered pairs (bta_bin.h): records of all
+ * pairs in the same order & table of fields (id is index in table)
+ */
+_Static_assert(JSON_HDRSZ == BTA_BIN_HDRSZ, "JSON_HDRSZ should be equal to BTA_BIN_HDRSZ");
+_Static_assert(JSON_MAXKEYS <= BTA_BIN_MAXID, "JSON_MAXKEYS is too large");
+static outbuf bcache, oldbcache;
+static bta_bin_field bin_tbl[BTA_BIN_MAXID];
+static int bin_nids = 0;
+static int cur_grp = 0; // group being rendered
+
+/**
+ * add binary record of pair (register new field in table)
+ * @return 0 if all OK
+ */
+static int bin_add(const char *name, int kind, double val){
+	unsigned char rec[BTA_BIN_RECSZ];
+	int id;
+	for(id = 0; id < bin_nids; ++id)
+		if(strcmp(bin_tbl[id].name, name) == 0) break;
+	if(id == bin_nids){
+		if(bin_nids == BTA_BIN_MAXID || strlen(name) >= BTA_BIN_NAMELEN) return -1;
+		bin_tbl[id].kind = kind;
+		bin_tbl[id].group = cur_grp;
+		strcpy(bin_tbl[id].name, name);
+		++bin_nids;
 	}
-	#define JSON(p, val) do{if(json_send(p, val)) exit(-1);} while(0)
-	#define JSONSTR(p, val) do{if(json_send_s(p, val)) exit(-1);} while(0)
-	get_shm_block( &sdat, ClientSide);
-	char *str;
-	if(!check_shm_block(&sdat)) exit(-1);
-	// beginning of json object
-	sendstr("{\n\"ACS_BTA\": true");
+	bta_bin_put16(rec, id);
+	bta_bin_putd(rec + 2, val);
+	return ob_add(&bcache, (char*)rec, BTA_BIN_RECSZ);
+}
 
+/**
+ * put JSON pairs of groups selected in `par` into buffer `ob`
+ * and their binary records into bcache
+ * (data are taken from current snapshot)
+ * @return 0 if all OK
+ */
+static int render_pars(outbuf *ob, bta_pars *par){
+	bool ALL = par->ALL;
+	int idx;
+	// print next JSON pair; par, val - strings; kind & v - for binary format
+	#define JSON(p, kind, v, val) do{if(ob_printf(ob, ",\n\"%s\": %s", p, val) || \
+		bin_add(p, kind, v)) return -1;} while(0)
+	// string value, which is idx'th string of array
+	#define JSONSTR(p, arr, idx) do{if(ob_printf(ob, ",\n\"%s\": \"%s\"", p, arr[idx]) || \
+		bin_add(p, BTA_BIN_ENUM, idx)) return -1;} while(0)
+	// all table fields of group g
+	#define JSONFIELDS(g) do{FOREACH_BTA_FIELD(f, g) JSON(f->name, f->kind, bta_field_val(f, sdt), field_json(f));} while(0)
 	// mean local time
-	if(ALL || par->mtime)
-		JSON("M_time", time_asc(M_time+DUT1));
+	if(ALL || par->mtime){
+		JSON("M_time", BTA_BIN_TIME, M_time+DUT1, time_asc(M_time+DUT1));
+		JSONFIELDS(BTA_G_MTIME);
+	}
 	// Mean Sidereal Time
 	if(ALL || par->sidtime){
 		#ifdef EE_time
-			JSON("JDate", double_asc(JDate, NULL));
-			str = time_asc(S_time-EE_time);
+			JSON("JDate", BTA_BIN_VALUE, JDate, double_asc(JDate, NULL));
+			JSON("S_time", BTA_BIN_TIME, S_time-EE_time, time_asc(S_time-EE_time));
 		#else
-			str = time_asc(S_time);
+			JSON("S_time", BTA_BIN_TIME, S_time, time_asc(S_time));
 		#endif
-		JSON("S_time", str);
 	}
 	// Telecope mode
 	if(ALL || par->telmode){
-		if(Tel_Hardware == Hard_Off) str = "Off";
-		else if(Tel_Mode != Automatic) str = "Manual";
+		// indexes in bta_bin_telmode[]
+		if(Tel_Hardware == Hard_Off) idx = 0;      // Off
+		else if(Tel_Mode != Automatic) idx = 1;    // Manual
 		else{
 			switch (Sys_Mode){
 				default:
-				case SysStop    :  str = "Stopping";  break;
-				case SysWait    :  str = "Waiting";   break;
+				case SysStop    :  idx = 2;  break; // Stopping
+				case SysWait    :  idx = 3;  break; // Waiting
 				case SysPointAZ :
-				case SysPointAD :  str = "Pointing";  break;
+				case SysPointAD :  idx = 4;  break; // Pointing
 				case SysTrkStop :
 				case SysTrkStart:
 				case SysTrkMove :
-				case SysTrkSeek :  str = "Seeking";   break;
-				case SysTrkOk   :  str = "Tracking";  break;
-				case SysTrkCorr :  str = "Correction";break;
-				case SysTest    :  str = "Testing";   break;
+				case SysTrkSeek :  idx = 5;  break; // Seeking
+				case SysTrkOk   :  idx = 6;  break; // Tracking
+				case SysTrkCorr :  idx = 7;  break; // Correction
+				case SysTest    :  idx = 8;  break; // Testing
 			}
 		}
-		JSONSTR("Tel_Mode", str);
+		JSONSTR("Tel_Mode", bta_bin_telmode, idx);
 	}
 	// Telescope focus
 	if(ALL || par->telfocus){
 		switch (Tel_Focus){
 			default:
-			case Prime    : str = "Prime";     break;
-			case Nasmyth1 : str = "Nasmyth1";  break;
-			case Nasmyth2 : str = "Nasmyth2";  break;
+			case Prime    : idx = 0;  break;
+			case Nasmyth1 : idx = 1;  break;
+			case Nasmyth2 : idx = 2;  break;
 		}
-		JSONSTR("Tel_Focus", str);
-		JSON("ValFoc", double_asc(val_F, "%0.2f"));
+		JSONSTR("Tel_Focus", bta_bin_telfocus, idx);
+		JSONFIELDS(BTA_G_TELFOCUS);
 	}
 	// Telescope target
 	if(ALL || par->target){
 		switch (Sys_Target) {
 			default:
-			case TagObject   : str = "Object";   break;
-			case TagPosition : str = "A/Z-Pos."; break;
-			case TagNest     : str = "Nest";     break;
-			case TagZenith   : str = "Zenith";   break;
-			case TagHorizon  : str = "Horizon";  break;
+			case TagObject   : idx = 0;  break; // Object
+			case TagPosition : idx = 1;  break; // A/Z-Pos.
+			case TagNest     : idx = 2;  break; // Nest
+			case TagZenith   : idx = 3;  break; // Zenith
+			case TagHorizon  : idx = 4;  break; // Horizon
 		}
-		JSONSTR("Tel_Taget", str);
+		JSONSTR("Tel_Taget", bta_bin_target, idx);
 	}
 	// Mode of P2
 	if(ALL || par->p2mode){
 		if(Tel_Hardware == Hard_On){
 			switch (P2_State) {
 				default:
-				case P2_Off   : str = "Stop";  break;
-				case P2_On    : str = "Track"; break;
-				case P2_Plus  : str = "Move+"; break;
-				case P2_Minus : str = "Move-"; break;
+				case P2_Off   : idx = 0; break; // Stop
+				case P2_On    : idx = 1; break; // Track
+				case P2_Plus  : idx = 2; break; // Move+
+				case P2_Minus : idx = 3; break; // Move-
 			}
-		} else str = "Off";
-		JSONSTR("P2_Mode", str);
+		} else idx = 4; // Off
+		JSONSTR("P2_Mode", bta_bin_p2mode, idx);
+		JSONFIELDS(BTA_G_P2MODE);
 	}
 	// Equatorial coordinates
 	if(ALL || par->eqcoor){
-		JSON("CurAlpha", time_asc(CurAlpha));
-		JSON("CurDelta", angle_asc(CurDelta));
-		JSON("SrcAlpha", time_asc(SrcAlpha));
-		JSON("SrcDelta", angle_asc(SrcDelta));
-		JSON("InpAlpha", time_asc(InpAlpha));
-		JSON("InpDelta", angle_asc(InpDelta));
-		JSON("TelAlpha", time_asc(val_Alp));
-		JSON("TelDelta", angle_asc(val_Del));
+		JSONFIELDS(BTA_G_EQCOOR);
 		double a2000, d2000;
 		calc_mean(InpAlpha, InpDelta, &a2000, &d2000);
-		JSON("InpRA2000", time_asc(a2000));
-		JSON("InpDec2000", angle_asc(d2000));
+		JSON("InpRA2000", BTA_BIN_TIME, a2000, time_asc(a2000));
+		JSON("InpDec2000", BTA_BIN_ANGLE, d2000, angle_asc(d2000));
 		calc_mean(CurAlpha, CurDelta, &a2000, &d2000);
-		JSON("CurRA2000", time_asc(a2000));
-		JSON("CurDec2000", angle_asc(d2000));
+		JSON("CurRA2000", BTA_BIN_TIME, a2000, time_asc(a2000));
+		JSON("CurDec2000", BTA_BIN_ANGLE, d2000, angle_asc(d2000));
 	}
 	// Horizontal coordinates
 	if(ALL || par->horcoor){
-		JSON("InpAzim", angle_fmt(InpAzim,"%c%03d:%02d:%04.1f"));
-		JSON("InpZenD", angle_fmt(InpZdist,"%02d:%02d:%04.1f"));
-		JSON("CurAzim", angle_fmt(tag_A,"%c%03d:%02d:%04.1f"));
-		JSON("CurZenD", angle_fmt(tag_Z,"%02d:%02d:%04.1f"));
-		JSON("CurPA", angle_fmt(tag_P,"%03d:%02d:%04.1f"));
-		JSON("SrcPA", angle_fmt(calc_PA(SrcAlpha,SrcDelta,S_time),"%03d:%02d:%04.1f"));
-		JSON("InpPA", angle_fmt(calc_PA(InpAlpha,InpDelta,S_time),"%03d:%02d:%04.1f"));
-		JSON("TelPA", angle_fmt(calc_PA(val_Alp, val_Del, S_time),"%03d:%02d:%04.1f"));
+		JSONFIELDS(BTA_G_HORCOOR);
+		double pa;
+		pa = calc_PA(SrcAlpha, SrcDelta, S_time);
+		JSON("SrcPA", BTA_BIN_ANGLE, pa, angle_fmt(pa, "%03d:%02d:%04.1f"));
+		pa = calc_PA(InpAlpha, InpDelta, S_time);
+		JSON("InpPA", BTA_BIN_ANGLE, pa, angle_fmt(pa, "%03d:%02d:%04.1f"));
+		pa = calc_PA(val_Alp, val_Del, S_time);
+		JSON("TelPA", BTA_BIN_ANGLE, pa, angle_fmt(pa, "%03d:%02d:%04.1f"));
 	}
 	// Values from sensors
 	if(ALL || par->valsens){
-		JSON("ValAzim", angle_fmt(val_A,"%c%03d:%02d:%04.1f"));
-		JSON("ValZenD", angle_fmt(val_Z,"%02d:%02d:%04.1f"));
-		JSON("ValP2", angle_fmt(val_P,"%03d:%02d:%04.1f"));
-		JSON("ValDome", angle_fmt(val_D,"%c%03d:%02d:%04.1f"));
+		JSONFIELDS(BTA_G_VALSENS);
 	}
 	// Differences
 	if(ALL || par->diff){
-		JSON("DiffAzim", angle_fmt(Diff_A,"%c%03d:%02d:%04.1f"));
-		JSON("DiffZenD", angle_fmt(Diff_Z,"%c%02d:%02d:%04.1f"));
-		JSON("DiffP2", angle_fmt(Diff_P,"%c%03d:%02d:%04.1f"));
-		JSON("DiffDome", angle_fmt(val_A-val_D,"%c%03d:%02d:%04.1f"));
+		JSONFIELDS(BTA_G_DIFF);
+		JSON("DiffDome", BTA_BIN_ANGLE, val_A-val_D, angle_fmt(val_A-val_D,"%c%03d:%02d:%04.1f"));
 	}
 	// Velocities
 	if(ALL || par->vel){
-		JSON("VelAzim", angle_fmt(vel_A,"%c%02d:%02d:%04.1f"));
-		JSON("VelZenD", angle_fmt(vel_Z,"%c%02d:%02d:%04.1f"));
-		JSON("VelP2", angle_fmt(vel_P,"%c%02d:%02d:%04.1f"));
-		JSON("VelPA", angle_fmt(vel_objP,"%c%02d:%02d:%04.1f"));
-		JSON("VelDome", angle_fmt(vel_D,"%c%02d:%02d:%04.1f"));
+		JSONFIELDS(BTA_G_VEL);
 	}
 	// Correction
 	if(ALL || par->corr){
@@ -389,27 +445,245 @@ void make_JSON(int sock, bta_pars *par){
 		}else{
 			corAlp = corDel = corA = corZ = 0.;
 		}
-		JSON("CorrAlpha", angle_fmt(corAlp,"%c%01d:%02d:%05.2f"));
-		JSON("CorrDelta", angle_fmt(corDel,"%c%01d:%02d:%04.1f"));
-		JSON("CorrAzim", angle_fmt(corA,"%c%01d:%02d:%04.1f"));
-		JSON("CorrZenD", angle_fmt(corZ,"%c%01d:%02d:%04.1f"));
+		JSON("CorrAlpha", BTA_BIN_ANGLE, corAlp, angle_fmt(corAlp,"%c%01d:%02d:%05.2f"));
+		JSON("CorrDelta", BTA_BIN_ANGLE, corDel, angle_fmt(corDel,"%c%01d:%02d:%04.1f"));
+		JSON("CorrAzim", BTA_BIN_ANGLE, corA, angle_fmt(corA,"%c%01d:%02d:%04.1f"));
+		JSON("CorrZenD", BTA_BIN_ANGLE, corZ, angle_fmt(corZ,"%c%01d:%02d:%04.1f"));
 	}
 	// meteo
 	if(ALL || par->meteo){
-		JSON("ValTout", double_asc(val_T1, "%05.1f"));
-		JSON("ValTind", double_asc(val_T2, "%05.1f"));
-		JSON("ValTmir", double_asc(val_T3, "%05.1f"));
-		JSON("ValPres", double_asc(val_B, "%05.1f"));
-		JSON("ValWind", double_asc(val_Wnd, "%04.1f"));
+		JSONFIELDS(BTA_G_METEO);
+		// these keys are always present (null if there's no data), so delta
+		// subscribers learn when value disappears
 		if(Wnd10_time>0.1 && Wnd10_time<=M_time) {
-			JSON("Blast10", double_asc((M_time-Wnd10_time)/60, "%.1f"));
-			JSON("Blast15", double_asc((M_time-Wnd15_time)/60, "%.1f"));
+			JSON("Blast10", BTA_BIN_VALUE, (M_time-Wnd10_time)/60, double_asc((M_time-Wnd10_time)/60, "%.1f"));
+			JSON("Blast15", BTA_BIN_VALUE, (M_time-Wnd15_time)/60, double_asc((M_time-Wnd15_time)/60, "%.1f"));
+		}else{
+			JSON("Blast10", BTA_BIN_VALUE, NAN, "null");
+			JSON("Blast15", BTA_BIN_VALUE, NAN, "null");
 		}
-		JSON("ValHumd", double_asc(val_Hmd, "%04.1f"));
 		if(Precip_time>0.1 && Precip_time<=M_time)
-			JSON("Precipt", double_asc((M_time-Precip_time)/60, "%.1f"));
+			JSON("Precipt", BTA_BIN_VALUE, (M_time-Precip_time)/60, double_asc((M_time-Precip_time)/60, "%.1f"));
+		else
+			JSON("Precipt", BTA_BIN_VALUE, NAN, "null");
 	}
-	// end of json onject
-	sendstr("\n}\n");
+	return 0;
+	#undef JSON
+	#undef JSONSTR
+	#undef JSONFIELDS
 }
 
+#define JSON_BEGIN "{\n\"ACS_BTA\": true"
+#define JSON_END   "\n}\n"
+
+// flags of bta_pars for groups BTA_G_xx
+static const size_t grp_flag[BTA_G_AMOUNT] = {
+	[BTA_G_MTIME] = offsetof(bta_pars, mtime),
+	[BTA_G_SIDTIME] = offsetof(bta_pars, sidtime),
+	[BTA_G_TELMODE] = offsetof(bta_pars, telmode),
+	[BTA_G_TELFOCUS] = offsetof(bta_pars, telfocus),
+	[BTA_G_TARGET] = offsetof(bta_pars, target),
+	[BTA_G_P2MODE] = offsetof(bta_pars, p2mode),
+	[BTA_G_EQCOOR] = offsetof(bta_pars, eqcoor),
+	[BTA_G_HORCOOR] = offsetof(bta_pars, horcoor),
+	[BTA_G_VALSENS] = offsetof(bta_pars, valsens),
+	[BTA_G_DIFF] = offsetof(bta_pars, diff),
+	[BTA_G_VEL] = offsetof(bta_pars, vel),
+	[BTA_G_CORR] = offsetof(bta_pars, corr),
+	[BTA_G_METEO] = offsetof(bta_pars, meteo),
+};
+#define GRP_WANTED(par, g)  (*(bool*)((char*)(par) + grp_flag[g]))
+
+/*
+ * Snapshot cache: when data changes, the whole object is rendered once:
+ * JSON_BEGIN, all groups in order of BTA_G_xx, JSON_END and the tail of
+ * object with sequence number; replies to all clients are made of pieces
+ * of this buffer. Each pair "key: value" is a line, previous rendering is
+ * kept to find pairs which text changed (for subscribers & deltas).
+ * k'th pair has k'th record in bcache (binary format)
+ */
+static outbuf cache, oldcache;
+static size_t grp_beg[BTA_G_AMOUNT+1]; // offsets of groups in cache (and of JSON_END)
+static size_t seq_beg;                 // offset of ",\n"Seq": N" JSON_END
+static size_t key_beg[JSON_MAXKEYS+1], old_key_beg[JSON_MAXKEYS+1]; // offsets of pairs
+static int key_grp[JSON_MAXKEYS];      // group of pair
+static unsigned long key_chg[JSON_MAXKEYS]; // number of rendering when pair changed
+static unsigned long bkey_chg[JSON_MAXKEYS]; // the same for binary value
+static unsigned long table_chg = 0;    // number of rendering when new field appeared
+static outbuf btable;                  // table message of binary format
+static int nkeys = 0;
+static unsigned long grp_gen[BTA_G_AMOUNT]; // counters of group text changes
+static unsigned long cache_num = 0;    // number of rendering (sequence number of snapshot)
+static bool cache_ok = false;
+
+/**
+ * find pairs in just rendered groups & compare them with previous rendering
+ * @param old_ok - previous rendering is valid
+ * @return 0 if all OK
+ */
+static int find_changes(bool old_ok){
+	int g, k, old_nkeys = nkeys;
+	static int tbl_nids = 0; // amount of fields in btable
+	bool changed[BTA_G_AMOUNT] = {0};
+	nkeys = 0;
+	for(g = 0; g < BTA_G_AMOUNT; ++g){
+		char *p = cache.buf + grp_beg[g], *e = cache.buf + grp_beg[g+1];
+		while(p < e){ // each pair is ",\n\"key\": value"
+			char *nl = (p + 2 < e) ? memchr(p + 2, '\n', e - p - 2) : NULL;
+			if(nkeys == JSON_MAXKEYS) return -1;
+			key_grp[nkeys] = g;
+			key_beg[nkeys++] = p - cache.buf;
+			p = nl ? nl - 1 : e;
+		}
+	}
+	key_beg[nkeys] = grp_beg[BTA_G_AMOUNT];
+	if(bcache.len != (size_t)nkeys * BTA_BIN_RECSZ) return -1;
+	if(nkeys != old_nkeys) old_ok = false;
+	for(k = 0; k < nkeys; ++k){
+		size_t L = key_beg[k+1] - key_beg[k];
+		if(!old_ok || memcmp(bcache.buf + k*BTA_BIN_RECSZ, oldbcache.buf + k*BTA_BIN_RECSZ, BTA_BIN_RECSZ))
+			bkey_chg[k] = cache_num;
+		if(old_ok && L == old_key_beg[k+1] - old_key_beg[k] &&
+			!memcmp(cache.buf + key_beg[k], oldcache.buf + old_key_beg[k], L)) continue;
+		key_chg[k] = cache_num;
+		changed[key_grp[k]] = true;
+	}
+	for(g = 0; g < BTA_G_AMOUNT; ++g)
+		if(changed[g]) ++grp_gen[g];
+	if(bin_nids != tbl_nids){ // new fields: make table message again
+		unsigned char ent[BTA_BIN_TBLSZ];
+		int id;
+		btable.len = 0;
+		bta_bin_header(ent, BTA_BIN_TABLE, bin_nids * BTA_BIN_TBLSZ, cache_num);
+		if(ob_add(&btable, (char*)ent, BTA_BIN_HDRSZ)) return -1;
+		for(id = 0; id < bin_nids; ++id){
+			memset(ent, 0, sizeof(ent));
+			bta_bin_put16(ent, id);
+			ent[2] = bin_tbl[id].kind;
+			ent[3] = bin_tbl[id].group;
+			strcpy((char*)ent + 4, bin_tbl[id].name);
+			if(ob_add(&btable, (char*)ent, BTA_BIN_TBLSZ)) return -1;
+		}
+		tbl_nids = bin_nids;
+		table_chg = cache_num;
+	}
+	return 0;
+}
+
+/**
+ * render cache again if SHM data changed (seqlock counter for servers with
+ * seqlock, M_time for old ones)
+ * @return 0 if all OK
+ */
+static int refresh_cache(){
+	static struct BTA_Data snap;
+	static uint cache_seq = 0;
+	static double cache_mtime = 0.;
+	uint seq;
+	bta_pars par;
+	outbuf tmp;
+	bool old_ok;
+	int g;
+	if(attach_shm()) return -1;
+	seq = sdts ? __atomic_load_n(&sdts->seq, __ATOMIC_ACQUIRE) : 0;
+	if(cache_ok && seq && seq == cache_seq) return 0;
+	bta_snapshot(&snap);
+	sdt = &snap; // all data below are taken from consistent copy
+	if(!check_shm_block(&sdat)) return -1;
+	if(cache_ok && !seq && M_time == cache_mtime) return 0;
+	old_ok = cache_ok;
+	cache_ok = false;
+	tmp = oldcache; oldcache = cache; cache = tmp;
+	tmp = oldbcache; oldbcache = bcache; bcache = tmp;
+	memcpy(old_key_beg, key_beg, sizeof(key_beg));
+	++cache_num;
+	cache.len = 0;
+	bcache.len = 0;
+	if(ob_add(&cache, JSON_BEGIN, sizeof(JSON_BEGIN)-1)) return -1;
+	for(g = 0; g < BTA_G_AMOUNT; ++g){
+		grp_beg[g] = cache.len;
+		cur_grp = g;
+		memset(&par, 0, sizeof(par));
+		GRP_WANTED(&par, g) = true;
+		if(render_pars(&cache, &par)) return -1;
+	}
+	grp_beg[BTA_G_AMOUNT] = cache.len;
+	if(ob_add(&cache, JSON_END, sizeof(JSON_END)-1)) return -1;
+	seq_beg = cache.len;
+	if(ob_printf(&cache, ",\n\"Seq\": %lu" JSON_END, cache_num)) return -1;
+	if(find_changes(old_ok)) return -1;
+	cache_seq = seq;
+	cache_mtime = M_time;
+	cache_ok = true;
+	return 0;
+}
+
+/**
+ * age of data served: difference between wall clock (UTC) and M_time
+ * of current snapshot
+ * @return age in seconds or NAN if SHM isn't available
+ */
+double shm_age(){
+	struct timespec ts;
+	double age;
+	if(refresh_cache()) return NAN;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	age = fmod(ts.tv_sec, 86400.) + ts.tv_nsec / 1e9 - M_time;
+	if(age < -43200.) age += 86400.; // M_time is time of day
+	else if(age >= 43200.) age -= 86400.;
+	return age;
+}
+
+/**
+ * make JSON object with parameters `par` of cached pieces
+ * (adjacent groups are joined into one piece)
+ * if par->delta is set, object has sequence number "Seq" and contains
+ * only pairs changed after snapshot `since` (all pairs if since == 0)
+ * if par->binary is set, reply is data message of binary format (bta_bin.h)
+ * preceded by table message if since == 0 or table changed after `since`
+ * @param r - reply: pointers into cache, valid until next call
+ * @return 0 if all OK
+ */
+int make_JSON(bta_pars *par, unsigned long since, json_reply *r){
+	int g, k, n = 0;
+	if(refresh_cache()) return -1;
+	r->len = 0;
+	r->gen = 0;
+	r->seq = cache_num;
+	#define ADDIOV(ptr, L) do{ \
+		if(n && (char*)r->iov[n-1].iov_base + r->iov[n-1].iov_len == (char*)(ptr)) \
+			r->iov[n-1].iov_len += (L); \
+		else{ \
+			r->iov[n].iov_base = (ptr); \
+			r->iov[n++].iov_len = (L); \
+		} \
+		r->len += (L); \
+	}while(0)
+	for(g = 0; g < BTA_G_AMOUNT; ++g)
+		if(par->ALL || GRP_WANTED(par, g)) r->gen += grp_gen[g];
+	if(par->binary){
+		size_t dbeg;
+		if(!since || since < table_chg) ADDIOV(btable.buf, btable.len);
+		ADDIOV(r->hdr, BTA_BIN_HDRSZ);
+		dbeg = r->len;
+		for(k = 0; k < nkeys; ++k)
+			if((par->ALL || GRP_WANTED(par, key_grp[k])) && (!since || !par->delta || bkey_chg[k] > since))
+				ADDIOV(bcache.buf + k*BTA_BIN_RECSZ, BTA_BIN_RECSZ);
+		bta_bin_header(r->hdr, BTA_BIN_DATA, r->len - dbeg, cache_num);
+	}else{
+		ADDIOV(cache.buf, grp_beg[0]);
+		if(par->delta){
+			for(k = 0; k < nkeys; ++k)
+				if((par->ALL || GRP_WANTED(par, key_grp[k])) && (!since || key_chg[k] > since))
+					ADDIOV(cache.buf + key_beg[k], key_beg[k+1] - key_beg[k]);
+			ADDIOV(cache.buf + seq_beg, cache.len - seq_beg);
+		}else{
+			for(g = 0; g < BTA_G_AMOUNT; ++g)
+				if(par->ALL || GRP_WANTED(par, g)) ADDIOV(cache.buf + grp_beg[g], grp_beg[g+1] - grp_beg[g]);
+			ADDIOV(cache.buf + grp_beg[BTA_G_AMOUNT], seq_beg - grp_beg[BTA_G_AMOUNT]);
+		}
+	}
+	#undef ADDIOV
+	r->iovcnt = n;
+	return 0;
+}
@@ -16,6 +16,7 @@
 #include <sys/shm.h>
 #include <sys/msg.h>
 #include <errno.h>
+#include <sched.h>
 
 #if __GNUC_PREREQ(4,2)
 #pragma GCC diagnostic ignored "-Wunused-function"
@@ -715,6 +716,18 @@ struct BTA_Local *sdtl; /* 
 extern struct BTA_Local *sdtl;
 #endif
 
+struct BTA_Sync { /*   (  ),   bta_control_net */
+   uint32_t seq;   /*  seqlock: ,    BTA_Data */
+   uint32_t gen;   /*   (futex-   ) */
+   uint32_t reserve[14];
+};
+
+#ifndef BTA_MODULE
+struct BTA_Sync *sdts;
+#else
+extern struct BTA_Sync *sdts;
+#endif
+
 #define ClientSide 0
 #define ServerSide 1
 
@@ -737,6 +750,7 @@ static void bta_data_init() {
    int i;
    sdt = (struct BTA_Data *)sdat.addr;
    sdtl = (struct BTA_Local *)(sdat.addr+sizeof(struct BTA_Data));
+   sdts = (struct BTA_Sync *)(sdat.addr+sizeof(struct BTA_Data)+sizeof(struct BTA_Local));
    if(sdat.side == ClientSide) {
       if(sdt->magic != sdat.key.code) {
 	 fprintf(stderr,"Wrong shared data (maybe server turned off)\n");
@@ -952,6 +966,30 @@ static int check_shm_block( struct SHM_Block *sb) {
    else return(1);
 }
 
+/*   BTA_Data:   ,      */
+/*   ( seqlock      ) */
+static int bta_snapshot(struct BTA_Data *dst) {
+   uint32_t s1, s2;
+   int i;
+   if(sdts == NULL) {
+      memcpy(dst, sdat.addr, sizeof(struct BTA_Data));
+      return 0;
+   }
+   for(i=0; i<1000; i++) {
+      s1 = __atomic_load_n(&sdts->seq, __ATOMIC_ACQUIRE);
+      if(s1 & 1) { /*    */
+	 sched_yield();
+	 continue;
+      }
+      memcpy(dst, sdat.addr, sizeof(struct BTA_Data));
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      s2 = __atomic_load_n(&sdts->seq, __ATOMIC_RELAXED);
+      if(s1 == s2) return 0;
+   }
+   memcpy(dst, sdat.addr, sizeof(struct BTA_Data));
+   return -1;
+}
+
 #ifndef BTA_MODULE
 int snd_id=-1; /*  ( ?)     */
 int cmd_src_pid=0; /*      . */
@@ -69,7 +69,7 @@ int main(int argc, char *argv[]){
     #ifndef EBUG
     PRINT(_("Test multicast connection\n"));
     double last = M_time;
-    WAIT_EVENT((fabs(M_time - last) > 0.02), 5.);
+    WAIT_UPDATE((fabs(M_time - last) > 0.02), 5.);
     if(tmout && fabs(M_time - last) < 4.)
         ERRX(_("Multicasts stale!"));
     #endif
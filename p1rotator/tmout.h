@@ -34,6 +34,12 @@ extern char indi[];
         char *iptr = indi; PRINT(" "); while(!tmout && !(evt)){ \
         usleep(100000); if(!*(++iptr)) iptr = indi; if(++__%10==0) PRINT("\b. "); \
         PRINT("\b%c", *iptr);}; PRINT("\n");}while(0)
+// the same, but check `evt` on each BTA data update instead of polling
+#define WAIT_UPDATE(evt, max_delay)  do{int __ = 0; uint32_t __gen = bta_update_gen(); \
+        set_timeout(max_delay); char *iptr = indi; PRINT(" "); while(!tmout && !(evt)){ \
+        if(bta_wait_update(&__gen, 0.1)) continue; \
+        iptr = *(iptr+1) ? iptr+1 : indi; if(++__%10==0) PRINT("\b. "); \
+        PRINT("\b%c", *iptr);}; PRINT("\n");}while(0)
 
 void set_timeout(double delay);
 extern volatile int tmout;